@@ -0,0 +1,154 @@
+/**
+ * @file batch.h
+ * @brief Parallel batch simulation
+ *
+ * A @ref BatchPool runs many independent simulations on a fixed set of worker
+ * threads. Jobs may carry a ready-made program or a function that builds the
+ * program (e.g., by compiling it) on the worker that runs the job.
+ */
+#ifndef __H_BATCH
+#define __H_BATCH
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Function that builds the program of a batch job on a worker thread
+ *
+ * It must be safe to call from several threads at once.
+ *
+ * @param arg Argument given to @ref BatchJob_new_build
+ * @param errors File stream for error messages
+ * @returns Program (owned by the job) or @c NULL if it could not be built
+ */
+typedef InsnList* (*BatchBuildFunction) (void* arg, FILE* errors);
+
+/**
+ * @brief One program run of a batch (see @ref BatchPool)
+ */
+typedef struct BatchJob
+{
+    /**
+     * @brief Program to run (only read, so several jobs may share it)
+     *
+     * For jobs with a @ref build function, this is @c NULL until the job has
+     * run and stays @c NULL if the program could not be built.
+     */
+    InsnList* program;
+
+    /**
+     * @brief Function that builds the program (or @c NULL)
+     */
+    BatchBuildFunction build;
+
+    /**
+     * @brief Argument for @ref build
+     */
+    void* build_arg;
+
+    /**
+     * @brief Error messages printed by @ref build (or @c NULL)
+     */
+    char* build_errors;
+
+    /**
+     * @brief Captured program output
+     */
+    OutputSink* output;
+
+    /**
+     * @brief How the run ended (valid once the job has finished)
+     */
+    SimulatorResult result;
+
+    /**
+     * @brief Elapsed (wall clock) time of the run in seconds
+     */
+    double wall_time;
+
+} BatchJob;
+
+/**
+ * @brief Allocate a new batch job with an empty output capture
+ *
+ * @param program Program to run (not owned by the job)
+ * @returns Pointer to new job
+ */
+BatchJob* BatchJob_new (InsnList* program);
+
+/**
+ * @brief Allocate a new batch job whose program is built by the worker that
+ * runs it
+ *
+ * @param build Function that builds the program (owned by the job)
+ * @param arg Argument for @c build (not owned by the job)
+ * @returns Pointer to new job
+ */
+BatchJob* BatchJob_new_build (BatchBuildFunction build, void* arg);
+
+/**
+ * @brief Print the result of a finished batch job as one line of JSON
+ *
+ * Jobs whose program could not be built are reported with the status
+ * "compile_error" and the build error messages.
+ *
+ * @param job Finished job
+ * @param name Name of the program (e.g., its file name)
+ * @param output File stream to print to
+ */
+void BatchJob_print_json (BatchJob* job, const char* name, FILE* output);
+
+/**
+ * @brief Deallocate a batch job (and its program if the job built it)
+ *
+ * @param job Job to deallocate
+ */
+void BatchJob_free (BatchJob* job);
+
+/**
+ * @brief Fixed-size pool of worker threads that run batch jobs
+ *
+ * Every worker has its own queue of jobs; submitted jobs are spread over the
+ * queues, each worker runs the newest job in its own queue, and a worker whose
+ * queue is empty steals the oldest job from another queue. Idle workers sleep
+ * until a job is submitted. Every run gets its own machine and output sink, so
+ * runs do not affect each other.
+ */
+typedef struct BatchPool BatchPool;
+
+/**
+ * @brief Start a pool of worker threads
+ *
+ * @param num_workers Number of worker threads (at least one)
+ * @param config Simulator settings for every run (copied; the output sink of
+ * each job replaces @ref SimulatorConfig::output, and tracing and profiling
+ * are disabled)
+ * @returns Pointer to new pool or @c NULL if the threads could not be started
+ */
+BatchPool* BatchPool_new (int num_workers, SimulatorConfig* config);
+
+/**
+ * @brief Queue a job to be run by one of the workers
+ *
+ * The job must not be accessed until @ref BatchPool_wait returns.
+ *
+ * @param pool Pool to run the job
+ * @param job Job to run
+ */
+void BatchPool_submit (BatchPool* pool, BatchJob* job);
+
+/**
+ * @brief Wait until every submitted job has finished
+ *
+ * @param pool Pool to wait for
+ */
+void BatchPool_wait (BatchPool* pool);
+
+/**
+ * @brief Wait for every submitted job, stop the workers, and deallocate a pool
+ *
+ * @param pool Pool to deallocate
+ */
+void BatchPool_free (BatchPool* pool);
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * @file c-emit.h
+ * @brief C emitter
+ */
+#ifndef __H_C_EMIT
+#define __H_C_EMIT
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Generate a self-contained C program from ILOC
+ *
+ * Each ILOC function becomes a C function (with its virtual registers as
+ * locals and jumps as gotos), the special and physical registers become
+ * globals, and the address space becomes a static array of @ref MEM_SIZE
+ * bytes laid out as in the simulator (the stack starts at the top, and calls
+ * push the same return addresses). Output, return values, and fault
+ * messages match a simulator run followed by the driver's "RETURN VALUE"
+ * line, except that there is no instruction limit. The result compiles as
+ * C99 or later (e.g., with <tt>gcc -O2</tt>).
+ *
+ * @param iloc ILOC program as a list of instructions
+ * @param output File stream for output
+ */
+void emit_c (InsnList* iloc, FILE* output);
+
+#endif
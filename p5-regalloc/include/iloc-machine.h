@@ -0,0 +1,370 @@
+/**
+ * @file iloc-machine.h
+ * @brief ILOC machine state shared by the simulator modules
+ *
+ * This header is internal to the simulator (the interpreter in iloc.c and
+ * the modules that hook into its runs); programs that only run ILOC code
+ * need nothing beyond iloc.h.
+ */
+#ifndef __H_ILOC_MACHINE
+#define __H_ILOC_MACHINE
+
+#include "common.h"
+#include "iloc.h"
+
+#if WORD_SIZE == 4
+    typedef int32_t word_t;
+    #define PRIW "%" PRId32
+    #define WORD_MIN INT32_MIN
+#else
+    typedef int64_t word_t;
+    #define PRIW "%" PRId64
+    #define WORD_MIN INT64_MIN
+#endif
+typedef uint8_t byte_t;
+
+#define UNINIT_REG       (-9999999)
+
+/* indices of special and physical registers in ILOCMachine.fixed_regs */
+#define FIXED_SP         0
+#define FIXED_BP         1
+#define FIXED_RET        2
+#define FIXED_PR         3
+#define NUM_FIXED_REGS   (FIXED_PR + MAX_PHYSICAL_REGS)
+
+/**
+ * @brief Information about call targets (i.e., functions)
+ * 
+ * This information is prefetched with a single pass over the instruction
+ * before it is simulated.
+ */
+typedef struct CallTarget
+{
+    /**
+     * @brief Function name
+     */
+    char name[MAX_TOKEN_LEN];
+
+    /**
+     * @brief Pointer to corresponding label "instruction"
+     */
+    ILOCInsn* insn;
+
+    /**
+     * @brief Index of the label instruction in the program
+     */
+    int index;
+
+    /**
+     * @brief Number of virtual registers used by the function
+     * 
+     * Determines the size of the register window for each activation.
+     */
+    int num_virtual_regs;
+    
+    /**
+     * @brief Next call target (if stored in a list)
+     */
+    struct CallTarget* next;
+
+} CallTarget;
+
+DECL_LIST_TYPE(CallTarget, CallTarget*)
+
+/**
+ * @brief Virtual register window for one function activation
+ */
+typedef struct RegWindow
+{
+    int base;   /**< @brief Index of the window's r0 in the register file */
+    int size;   /**< @brief Number of registers in the window */
+} RegWindow;
+
+/**
+ * @brief ILOC machine state structure
+ */
+typedef struct ILOCMachine
+{
+    /**
+     * @brief Virtual register values for all active calls
+     * 
+     * Each call gets its own window (sized by the callee's register count)
+     * stacked above the caller's; the file grows on demand.
+     */
+    word_t* reg_file;
+
+    /**
+     * @brief Number of entries allocated in @ref reg_file
+     */
+    int reg_file_size;
+
+    /**
+     * @brief Stack of register windows (the last one belongs to the running function)
+     */
+    RegWindow* windows;
+
+    /**
+     * @brief Number of active windows
+     */
+    int num_windows;
+
+    /**
+     * @brief Number of entries allocated in @ref windows
+     */
+    int max_windows;
+
+    /**
+     * @brief Special and physical register values
+     * 
+     * The named registers overlay @ref fixed_regs so that the pre-decoded
+     * interpreter can address all of them by index.
+     */
+    union {
+        word_t fixed_regs[NUM_FIXED_REGS];
+        struct {
+            word_t sp;                      /**< @brief Stack pointer value */
+            word_t bp;                      /**< @brief Base pointer value */
+            word_t ret;                     /**< @brief Function return value */
+            word_t pr[MAX_PHYSICAL_REGS];   /**< @brief Physical register values */
+        };
+    };
+
+    /**
+     * @brief Program counter (pointer to next instruction to execute)
+     */
+    ILOCInsn* pc;
+
+    /**
+     * @brief Index of the program counter in @ref instructions
+     */
+    int pc_index;
+
+    /**
+     * @brief Program address space (memory w/ global variables and stack)
+     * 
+     * Surrounded by inaccessible guard regions (see @ref MEM_RESERVED_BELOW
+     * and @ref MEM_RESERVED_ABOVE); pages are committed when first touched.
+     */
+    byte_t* mem;
+
+    /**
+     * @brief Size of @ref mem in bytes (the initial stack pointer)
+     */
+    long mem_size;
+
+    /**
+     * @brief Stack overflow limit (the stack pointer must stay above this address)
+     */
+    long stack_limit;
+
+    /**
+     * @brief Maximum number of instructions to execute before timing out
+     */
+    long max_steps;
+
+    /**
+     * @brief Number of instructions executed so far
+     */
+    long steps;
+
+    /**
+     * @brief Instruction counter of the running interpreter (NULL if
+     * @ref steps is up to date)
+     * 
+     * The interpreter counts in a local variable, which is copied to
+     * @ref steps when it returns or faults.
+     */
+    long* running_steps;
+
+    /**
+     * @brief List of program instructions (i.e., code)
+     * 
+     * Note that instructions are NOT stored in the program's "address space."
+     */
+    ILOCInsn** instructions;
+
+    /**
+     * @brief Number of program instructions (@ref instructions is NULL-terminated)
+     */
+    int num_instructions;
+
+    /**
+     * @brief Jump targets (instruction indices indexed by jump label IDs; -1 if undefined)
+     */
+    int* jump_targets;
+
+    /**
+     * @brief Number of entries in @ref jump_targets (one more than the largest label ID)
+     */
+    int num_jump_targets;
+
+    /**
+     * @brief Resolved call targets (indexed by the instruction index of each CALL)
+     * 
+     * NULL for calls to undefined functions; those are reported if executed.
+     */
+    CallTarget** call_links;
+
+    /**
+     * @brief Call targets (list of string label and instruction pointer pairs)
+     */
+    CallTargetList* call_targets;
+
+    /**
+     * @brief Binary trace of register and memory changes (NULL if not tracing)
+     */
+    struct TraceWriter* trace;
+
+    /**
+     * @brief Destination for program output
+     */
+    OutputSink* output;
+
+    /**
+     * @brief Decoded program (NULL unless running the pre-decoded interpreter)
+     */
+    struct DecodedOp* ops;
+
+    /**
+     * @brief Native code for the program (NULL unless running in JIT mode)
+     */
+    struct JitCode* jit;
+
+    /**
+     * @brief Dynamic call stack (NULL unless profiling)
+     */
+    struct ProfileStack* calls;
+
+    /**
+     * @brief Cache and memory traffic model (NULL unless modeling memory)
+     */
+    MemoryHierarchy* memory;
+
+    /**
+     * @brief Result of the current run (filled in when a fault stops it)
+     */
+    SimulatorResult result;
+
+    /**
+     * @brief Recovery point of the current run (see @ref ILOCMachine_fault)
+     */
+    jmp_buf fault_exit;
+
+} ILOCMachine;
+
+/**
+ * @brief Check whether an instruction is a function label
+ */
+bool is_call_label (ILOCInsn* insn);
+
+/**
+ * @brief Split a linked program into functions at function labels (code
+ * before the first label gets a function of its own)
+ *
+ * @param machine Machine with a linked program
+ * @param num_functions Set to the number of functions
+ * @returns Newly-allocated array with the function index of each instruction
+ * (plus one extra entry for the end of the program)
+ */
+int* number_functions (ILOCMachine* machine, int* num_functions);
+
+/**
+ * @brief Report that the program executed too many instructions
+ */
+void timeout (ILOCMachine* machine);
+
+/**
+ * @brief Execute the instruction at the program counter (with full checking)
+ *
+ * @param machine Linked machine state
+ * @returns Index of the next instruction to execute (the instruction count
+ * if the program has finished)
+ */
+int ILOCMachine_step (ILOCMachine* machine);
+
+/*
+ * Pre-decoded programs (see the interpreter in iloc.c)
+ */
+
+/**
+ * @brief Decoded register operand
+ * 
+ * Bank 0 is ILOCMachine.fixed_regs (SP, BP, RET, physical registers) and
+ * bank 1 is the current virtual register window.
+ */
+typedef struct DecodedReg
+{
+    int bank;       /**< @brief Register bank (0 or 1) */
+    int index;      /**< @brief Index within the bank */
+    bool checked;   /**< @brief Warn about uninitialized reads? (not for SP/BP/RET) */
+} DecodedReg;
+
+/**
+ * @brief Superinstructions (pairs of adjacent ops executed by one handler)
+ * 
+ * These are the most frequent adjacent pairs in the dynamic instruction
+ * stream of the tests2 inputs and a loop-heavy benchmark (4 registers):
+ * local variable and constant operand loads, stores of arithmetic results,
+ * array index scaling, compare-and-branch, and the call sequence.
+ */
+#define FUSED_PAIRS(X) \
+    X(LOAD_AI,  LOAD_I)   \
+    X(LOAD_I,   LOAD_AI)  \
+    X(LOAD_AI,  LOAD_AI)  \
+    X(STORE_AI, LOAD_AI)  \
+    X(LOAD_I,   ADD)      \
+    X(LOAD_AI,  ADD)      \
+    X(ADD,      STORE_AI) \
+    X(LOAD_AI,  MULT_I)   \
+    X(MULT_I,   LOAD_AO)  \
+    X(MULT_I,   STORE_AO) \
+    X(CMP_LT,   CBR)      \
+    X(CMP_LE,   CBR)      \
+    X(CMP_EQ,   CBR)      \
+    X(CMP_NE,   CBR)      \
+    X(CMP_GE,   CBR)      \
+    X(CMP_GT,   CBR)      \
+    X(LOAD_AI,  JUMP)     \
+    X(STORE_AI, JUMP)     \
+    X(PUSH,     I2I)      \
+    X(I2I,      ADD_I)    \
+    X(I2I,      LOAD_I)   \
+    X(I2I,      POP)
+
+#define FUSED_OPCODE(A,B)   OP_##A##_##B,
+
+/**
+ * @brief Decoded op codes (ILOC forms plus decoder-specific ops and superinstructions)
+ */
+enum {
+    OP_PRINT_STR = PHI + 1,     /**< @brief Print a string constant */
+    OP_CHECKED,                 /**< @brief Execute the original instruction with full checking */
+    OP_HALT,                    /**< @brief End of program (fall-through past the last instruction) */
+    FUSED_PAIRS(FUSED_OPCODE)
+    NUM_DECODED_OPS
+};
+
+/**
+ * @brief Decoded instruction
+ */
+typedef struct DecodedOp
+{
+    int opcode;         /**< @brief ILOC form or decoder-specific op code */
+    DecodedReg reg[3];  /**< @brief Register operands (by operand position) */
+    word_t imm;         /**< @brief Immediate operand (if any) */
+    int target[2];      /**< @brief Branch targets (op indices); CALL uses target[0] */
+    int window;         /**< @brief Callee register window size (CALL only) */
+    ILOCInsn* insn;     /**< @brief Original instruction */
+} DecodedOp;
+
+/**
+ * @brief Run a decoded program until it returns from main
+ *
+ * @param machine Linked machine state (registers, memory, and register windows)
+ * @param ops Decoded program
+ * @param start Index of the first op to execute
+ * @param mode Execution mode (must match the mode used for decoding)
+ */
+void run_decoded (ILOCMachine* machine, DecodedOp* ops, int start, SimulatorMode mode);
+
+#endif
@@ -21,25 +21,20 @@
 #define WORD_SIZE 8
 
 /**
- * @brief Machine memory size (64K)
+ * @brief Default machine memory size (64K)
  */
 #define MEM_SIZE  65536
 
 /**
- * @brief Maximum number of virtual registers
+ * @brief Largest configurable machine memory size (2G)
  */
-#define MAX_VIRTUAL_REGS 2048
+#define MAX_MEM_SIZE (1L << 31)
 
 /**
  * @brief Maximum number of physical registers
  */
 #define MAX_PHYSICAL_REGS 32
 
-/**
- * @brief Maximum number of instructions
- */
-#define MAX_INSTRUCTIONS 4096
-
 /**
  * @brief Base pointer offset for parameters
  * 
@@ -203,6 +198,19 @@ typedef enum InsnForm
 
 } InsnForm;
 
+/**
+ * @brief Number of instruction forms (see @ref InsnForm)
+ */
+#define NUM_INSN_FORMS (PHI + 1)
+
+/**
+ * @brief Get the mnemonic of an instruction form (e.g., "loadAI")
+ *
+ * @param form Instruction form
+ * @returns Static const string with the mnemonic
+ */
+const char* InsnForm_name (InsnForm form);
+
 /**
  * @brief ILOC instruction
  * 
@@ -251,6 +259,11 @@ typedef struct ILOCInsn
      */
     struct ILOCInsn* next;
 
+    /**
+     * @brief Line of Decaf source code that generated this instruction (0 if unknown)
+     */
+    int source_line;
+
 } ILOCInsn;
 
 /**
@@ -343,6 +356,59 @@ ILOCInsn* ILOCInsn_get_read_registers (ILOCInsn* insn);
  */
 Operand ILOCInsn_get_write_register (ILOCInsn* insn);
 
+/**
+ * @brief Number of register keys for the special and physical registers
+ * (see @ref register_key)
+ */
+#define NUM_FIXED_REGISTER_KEYS (3 + MAX_PHYSICAL_REGS)
+
+/**
+ * @brief Register key of the stack pointer (see @ref register_key)
+ */
+#define SP_KEY 0
+
+/**
+ * @brief Number a register operand for use as a table index
+ *
+ * SP, BP, and RET are 0-2, physical registers follow, and virtual register
+ * n is @ref NUM_FIXED_REGISTER_KEYS + n.
+ *
+ * @param op Operand to number
+ * @returns Register key (or -1 if the operand is not a register)
+ */
+int register_key (Operand op);
+
+/**
+ * @brief Maximum number of registers read by a single instruction
+ */
+#define MAX_INSN_READS 3
+
+/**
+ * @brief Maximum number of registers written by a single instruction
+ */
+#define MAX_INSN_WRITES 2
+
+/**
+ * @brief Registers read and written by an instruction (as register keys)
+ */
+typedef struct InsnRegisters
+{
+    int num_reads;                  /**< @brief Number of entries in @ref reads */
+    int reads[MAX_INSN_READS];      /**< @brief Keys of the registers read */
+    int num_writes;                 /**< @brief Number of entries in @ref writes */
+    int writes[MAX_INSN_WRITES];    /**< @brief Keys of the registers written */
+
+} InsnRegisters;
+
+/**
+ * @brief Get all registers read and written by an instruction, including the
+ * stack pointer adjusted by @c PUSH and @c POP
+ *
+ * @param insn Instruction to examine
+ * @param regs Structure to fill in
+ */
+void ILOCInsn_get_registers (ILOCInsn* insn, InsnRegisters* regs);
+
 /**
  * @brief Deallocate an instruction structure
  * 
@@ -360,6 +426,22 @@ DECL_LIST_TYPE (Insn, ILOCInsn*)
  */
 void InsnList_print (InsnList* list, FILE* output);
 
+/**
+ * @brief Renumber virtual registers densely from zero within each function
+ *
+ * Code generation hands out program-wide register ids, so late functions in
+ * a large program use ids in the thousands even if they only need a few
+ * registers. After this pass each function's ids are numbered 0..n-1 in
+ * order of first appearance, which lets per-function tables (allocator and
+ * simulator) be sized by the function's own register count. Virtual
+ * registers never cross function boundaries, so this does not change the
+ * meaning of the program.
+ *
+ * @param list List of instructions to modify in place
+ * @returns Largest number of virtual registers used by any single function
+ */
+int renumber_virtual_registers (InsnList* list);
+
 /**
  * @brief Create a new AST visitor that allocates addresses for all variable symbols
  *
@@ -394,6 +476,8 @@ void ASTNode_copy_code (ASTNode* dest, ASTNode* src);
 /**
  * @brief Add/append an instruction to the code attribute (instruction list) for an AST node
  * 
+ * The instruction is attributed to the node's source line.
+ * 
  * @param dest Pointer to destination AST node
  * @param insn Instruction to add
  */
@@ -427,15 +511,338 @@ void ASTNode_set_temp_reg (ASTNode* node, Operand reg);
  */
 Operand ASTNode_get_temp_reg (ASTNode* node);
 
+/**
+ * @brief Simulator execution modes
+ */
+typedef enum SimulatorMode
+{
+    /**
+     * @brief Check every step (diagnoses uninitialized register reads and
+     * reports invalid instructions and addresses when they execute)
+     */
+    SIM_CHECKED,
+
+    /**
+     * @brief Validate the whole program once up front, then run it without
+     * per-step diagnostics
+     * 
+     * Programs that run without warnings in checked mode produce identical
+     * output and return values in fast mode. Out-of-range memory accesses
+     * are caught by guard regions around the address space (or, for addresses
+     * beyond 32 bits, by the checked accessors) and reported with the
+     * checked-mode messages.
+     */
+    SIM_FAST,
+
+    /**
+     * @brief Validate the whole program like @ref SIM_FAST, then translate it
+     * into native x86-64 code and run that
+     * 
+     * Instructions with virtual registers (and calls and returns in programs
+     * that have any) run in the interpreter instead, as does every
+     * instruction that faults; output, return values, instruction counts,
+     * and fault messages are the same as in fast mode. Other hosts use the
+     * fast mode.
+     */
+    SIM_JIT
+
+} SimulatorMode;
+
+/**
+ * @brief Execution profile of a simulator run (see profile.h)
+ */
+typedef struct ILOCProfile ILOCProfile;
+
+/**
+ * @brief Cache and memory traffic model of a simulator run (see memory-model.h)
+ */
+typedef struct MemoryHierarchy MemoryHierarchy;
+
+/**
+ * @brief Cycle model of an in-order pipeline (see pipeline.h)
+ */
+typedef struct PipelineModel PipelineModel;
+
+/**
+ * @brief Destination for program output (PRINT instructions)
+ * 
+ * A stream sink writes through the stream's stdio buffer, so program output
+ * stays in order with anything else written to the same stream. A capture
+ * sink collects the output in memory instead (see @ref OutputSink_text).
+ */
+typedef struct OutputSink
+{
+    FILE* stream;       /**< @brief Destination stream (NULL when capturing) */
+    char* buffer;       /**< @brief Captured output (null-terminated) */
+    size_t length;      /**< @brief Number of captured characters */
+    size_t capacity;    /**< @brief Allocated size of @ref buffer */
+
+} OutputSink;
+
+/**
+ * @brief Allocate a sink that writes to a stream
+ * 
+ * @param stream Destination stream
+ */
+OutputSink* OutputSink_new_stream (FILE* stream);
+
+/**
+ * @brief Allocate a sink that captures output in memory
+ */
+OutputSink* OutputSink_new_capture (void);
+
+/**
+ * @brief Write text to a sink
+ * 
+ * @param sink Destination sink
+ * @param text Characters to write
+ * @param length Number of characters to write
+ */
+void OutputSink_write (OutputSink* sink, const char* text, size_t length);
+
+/**
+ * @brief Write an integer (in decimal) to a sink
+ * 
+ * @param sink Destination sink
+ * @param value Value to write
+ */
+void OutputSink_write_int (OutputSink* sink, long value);
+
+/**
+ * @brief Retrieve the output captured so far (empty for stream sinks)
+ * 
+ * @param sink Capture sink
+ * @returns Null-terminated captured text (owned by the sink)
+ */
+const char* OutputSink_text (OutputSink* sink);
+
+/**
+ * @brief Discard the output captured so far (e.g., to reuse a sink for another run)
+ * 
+ * @param sink Capture sink
+ */
+void OutputSink_clear (OutputSink* sink);
+
+/**
+ * @brief Deallocate a sink (streams are flushed but not closed)
+ * 
+ * @param sink Sink to deallocate
+ */
+void OutputSink_free (OutputSink* sink);
+
+/**
+ * @brief Magic number at the beginning of a binary trace file
+ */
+#define TRACE_MAGIC "ILOCTRC1"
+
+/**
+ * @brief Kinds of changes recorded by a binary trace
+ * 
+ * A binary trace holds unsigned LEB128 varints (signed values are zigzag
+ * encoded first). The header is @ref TRACE_MAGIC followed by the word size,
+ * the uninitialized register value, the memory size, the static variable
+ * offset, the initial special and physical register values (sp, bp, ret,
+ * R0..R@ref MAX_PHYSICAL_REGS-1), the size of the initial register window,
+ * and the number of instructions. Each instruction then has a kind (0 for
+ * instructions, 1 for jump labels, 2 for function labels), a text length,
+ * and its text as printed by @ref ILOCInsn_print.
+ * 
+ * Each step is recorded as the index of the executed instruction followed by
+ * the changes it made: a key <tt>(id << 3) | kind</tt>, followed by the new
+ * value for register and memory changes. @ref TRACE_END ends the step.
+ */
+typedef enum TraceDeltaKind
+{
+    TRACE_END,          /**< @brief End of step (id 0) */
+    TRACE_FIXED_REG,    /**< @brief Special or physical register (id 0-2 for sp, bp, ret, then R0...) */
+    TRACE_VIRTUAL_REG,  /**< @brief Virtual register in the current window */
+    TRACE_MEMORY,       /**< @brief Memory word (id is the address) */
+    TRACE_PUSH_WINDOW,  /**< @brief New register window (id is its size; no value) */
+    TRACE_POP_WINDOW    /**< @brief Register window removed (id 0; no value) */
+
+} TraceDeltaKind;
+
+/**
+ * @brief ILOC simulator settings
+ */
+typedef struct SimulatorConfig
+{
+    /**
+     * @brief Execution mode
+     */
+    SimulatorMode mode;
+
+    /**
+     * @brief Print the machine state before executing each instruction
+     * 
+     * Tracing always uses the checked mode.
+     */
+    bool print_trace;
+
+    /**
+     * @brief Size of the address space in bytes (0 for @ref MEM_SIZE)
+     * 
+     * Rounded up to whole pages; at most @ref MAX_MEM_SIZE. Memory is
+     * committed as it is touched, so large sizes cost nothing up front.
+     */
+    long mem_size;
+
+    /**
+     * @brief Maximum stack size in bytes (0 for everything above the static variables)
+     */
+    long stack_size;
+
+    /**
+     * @brief Initial number of virtual registers in the register file (0 to size
+     * it from the program; it grows on demand either way)
+     */
+    int register_file_size;
+
+    /**
+     * @brief Maximum number of instructions to execute before timing out
+     * (0 for the default of 100 million)
+     */
+    long max_instructions_executed;
+
+    /**
+     * @brief Execution profile to fill in (NULL to disable profiling)
+     * 
+     * Profiled runs use the checked step-by-step loop; the interpreter itself
+     * is unaffected when profiling is disabled. Previous contents of the
+     * profile are replaced.
+     */
+    ILOCProfile* profile;
+
+    /**
+     * @brief Binary trace destination (NULL for none)
+     * 
+     * Writes one compact record per step with only the registers and memory
+     * that changed (see @ref TraceDeltaKind) instead of printing the whole
+     * machine state; the iloc-trace tool turns it back into text. Traced runs
+     * use the checked step-by-step loop.
+     */
+    FILE* trace_file;
+
+    /**
+     * @brief Cache and memory traffic model to feed (NULL to disable)
+     *
+     * Modeled runs use the checked step-by-step loop, like profiled runs.
+     */
+    MemoryHierarchy* memory;
+
+    /**
+     * @brief Pipeline model to feed (NULL to disable)
+     *
+     * Modeled runs use the checked step-by-step loop. The model is reset at
+     * the beginning of the run.
+     */
+    PipelineModel* pipeline;
+
+    /**
+     * @brief Destination for program output (NULL for standard output)
+     * 
+     * Simulator warnings, errors, and text traces still go to standard output.
+     */
+    OutputSink* output;
+
+} SimulatorConfig;
+
+/**
+ * @brief Outcome of a simulated run
+ */
+typedef enum SimulatorStatus
+{
+    SIM_SUCCESS,    /**< @brief The program returned from main() */
+    SIM_FAULT       /**< @brief The program was stopped (see @ref SimulatorFault) */
+
+} SimulatorStatus;
+
+/**
+ * @brief Reasons why the simulator stops a program
+ */
+typedef enum SimulatorFault
+{
+    FAULT_NONE,                 /**< @brief No fault (the run succeeded) */
+    FAULT_INVALID_INSN,         /**< @brief Malformed instruction or operand */
+    FAULT_INVALID_REGISTER,     /**< @brief Access to a register that does not exist */
+    FAULT_INVALID_ADDRESS,      /**< @brief Memory access outside of the address space */
+    FAULT_STACK_OVERFLOW,       /**< @brief Push beyond the stack limit */
+    FAULT_STACK_UNDERFLOW,      /**< @brief Pop from an empty stack */
+    FAULT_UNDEFINED_LABEL,      /**< @brief Jump or call to a label that does not exist */
+    FAULT_INVALID_RETURN,       /**< @brief Return to an address outside of the program */
+    FAULT_INVALID_DIVISION,     /**< @brief Division by zero (or of the most negative word by -1) */
+    FAULT_TIMEOUT,              /**< @brief Too many instructions executed */
+    FAULT_INVALID_CONFIG        /**< @brief Unusable simulator settings */
+
+} SimulatorFault;
+
+/**
+ * @brief Get the name of a simulator fault (e.g., "stack_overflow")
+ * 
+ * @param fault Fault kind
+ * @returns Static const string naming the fault
+ */
+const char* SimulatorFault_name (SimulatorFault fault);
+
+/**
+ * @brief Maximum length of a simulator fault message
+ */
+#define MAX_FAULT_LEN 1024
+
+/**
+ * @brief Result of a simulated run (see @ref simulate_program)
+ */
+typedef struct SimulatorResult
+{
+    SimulatorStatus status;         /**< @brief Did the program finish? */
+    SimulatorFault fault;           /**< @brief Why the program was stopped (@ref FAULT_NONE on success) */
+    char message[MAX_FAULT_LEN];    /**< @brief Description of the fault (empty on success) */
+    long return_value;              /**< @brief Value of the return register when main() returns */
+    long instructions_executed;     /**< @brief Number of instructions executed (up to the fault, if any) */
+
+} SimulatorResult;
+
 /**
  * @brief Run ILOC simulator on an ILOC program
  * 
  * If tracing is enabled, the simulator will print the machine state before
- * executing each instruction.
+ * executing each instruction. Otherwise, the program is decoded once into a
+ * flat array of pre-resolved ops and run by a threaded interpreter; program
+ * output, warnings, and errors are the same in both modes.
+ * 
+ * Equivalent to @ref run_simulator_with_config in checked mode.
  * 
  * @param program List of ILOC instructions
  * @param print_trace Enable/disable debug tracing
  */
 long run_simulator (InsnList* program, bool print_trace);
 
+/**
+ * @brief Run ILOC simulator on an ILOC program with the given settings
+ * 
+ * Prints the fault message and exits if the program is stopped by a fault
+ * (see @ref simulate_program for a version that returns instead).
+ * 
+ * @param program List of ILOC instructions
+ * @param config Simulator settings
+ * @returns Value of the return register when main() returns
+ */
+long run_simulator_with_config (InsnList* program, SimulatorConfig* config);
+
+/**
+ * @brief Run ILOC simulator on an ILOC program and report how it ended
+ * 
+ * Faults stop the program and are returned in the result instead of exiting
+ * (program output up to that point has already been written). Each call owns
+ * all of its machine state and only reads the program, so separate threads
+ * may simulate programs (even the same one) concurrently as long as each has
+ * its own configuration, profile, trace file, and output sink. Warnings and
+ * text traces still go to standard output.
+ * 
+ * @param program List of ILOC instructions
+ * @param config Simulator settings
+ * @returns Status, fault, and return value of the run
+ */
+SimulatorResult simulate_program (InsnList* program, SimulatorConfig* config);
+
 #endif
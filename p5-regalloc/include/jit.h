@@ -0,0 +1,36 @@
+/**
+ * @file jit.h
+ * @brief Native x86-64 code for the simulator's JIT mode
+ */
+#ifndef __H_JIT
+#define __H_JIT
+
+#include "common.h"
+#include "iloc-machine.h"
+
+/**
+ * @brief Native code for a linked program
+ */
+typedef struct JitCode JitCode;
+
+/**
+ * @brief Deallocate native code (does nothing for @c NULL)
+ *
+ * @param jit Code to deallocate
+ */
+void JitCode_free (JitCode* jit);
+
+/**
+ * @brief Run a program as native code until it returns from main
+ *
+ * The interpreter takes over for every instruction that the compiled code
+ * hands back (see jit.c), one instruction at a time, until the program
+ * reaches a leader again.
+ *
+ * @param machine Linked machine state
+ * @param ops Program decoded in fast mode
+ * @param start Index of the first instruction to execute
+ */
+void run_jit (ILOCMachine* machine, DecodedOp* ops, int start);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * @file memory-model.h
+ * @brief Cache and memory traffic model for simulator runs
+ */
+#ifndef __H_MEMORY_MODEL
+#define __H_MEMORY_MODEL
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Maximum number of cache levels in a @ref MemoryHierarchy
+ */
+#define MAX_CACHE_LEVELS 2
+
+/**
+ * @brief Geometry of a single cache level
+ */
+typedef struct CacheConfig
+{
+    long size;          /**< @brief Capacity in bytes (a multiple of the line size times the associativity) */
+    int line_size;      /**< @brief Line size in bytes (a power of two, at least @ref WORD_SIZE) */
+    int associativity;  /**< @brief Number of lines (ways) per set */
+
+} CacheConfig;
+
+/**
+ * @brief State and statistics of a single cache level in a @ref MemoryHierarchy
+ *
+ * Levels are write-back and write-allocate with LRU replacement. Lines that
+ * miss are filled from the next level down, and dirty lines that are evicted
+ * are written back to it.
+ */
+typedef struct CacheLevel
+{
+    CacheConfig config;     /**< @brief Geometry of the level */
+    int num_sets;           /**< @brief Number of sets */
+    long accesses;          /**< @brief Lookups (including fills and write-backs from the level above) */
+    long hits;              /**< @brief Lookups that found the line */
+    long misses;            /**< @brief Lookups that did not find the line */
+    long writebacks;        /**< @brief Dirty lines evicted to the next level (or memory) */
+
+    long* tags;             /**< @brief Line number in each way (<tt>set * associativity + way</tt>; -1 if empty) */
+    long* last_used;        /**< @brief Time of the last access to each way (for LRU replacement) */
+    bool* dirty;            /**< @brief Has each way been written since it was filled? */
+
+} CacheLevel;
+
+/**
+ * @brief Memory operation counts for a region, a function, or a whole run
+ */
+typedef struct MemoryTraffic
+{
+    long reads;                         /**< @brief Loads and pops */
+    long writes;                        /**< @brief Stores and pushes */
+    long misses[MAX_CACHE_LEVELS];      /**< @brief Operations that missed in each cache level */
+
+} MemoryTraffic;
+
+/**
+ * @brief Memory operation counts for a single function in a @ref MemoryHierarchy
+ */
+typedef struct MemoryFunction
+{
+    char name[MAX_TOKEN_LEN];   /**< @brief Function name (empty for code before the first function) */
+    MemoryTraffic traffic;      /**< @brief Operations executed by the function itself */
+
+} MemoryFunction;
+
+/**
+ * @brief Cache and memory traffic model of a simulator run
+ *
+ * Created by @ref MemoryHierarchy_new, fed every load, store, push, and pop
+ * (including the return addresses pushed and popped by calls) by
+ * @ref run_simulator_with_config when set in @ref SimulatorConfig::memory,
+ * and deallocated with @ref MemoryHierarchy_free. Operations on addresses at
+ * or above the stack pointer count as stack traffic and everything else as
+ * static traffic. Previous statistics are replaced by each run.
+ */
+struct MemoryHierarchy
+{
+    int num_levels;                         /**< @brief Number of cache levels (L1 first) */
+    CacheLevel levels[MAX_CACHE_LEVELS];    /**< @brief Cache levels */
+    long clock;                             /**< @brief Number of operations so far (LRU time) */
+
+    MemoryTraffic total;        /**< @brief All operations */
+    MemoryTraffic stack;        /**< @brief Operations on the stack */
+    MemoryTraffic statics;      /**< @brief Operations on static variables */
+
+    int num_functions;          /**< @brief Number of entries in @ref functions */
+    MemoryFunction* functions;  /**< @brief Per-function counts (in program order) */
+    int* function_of;           /**< @brief Function index of each instruction */
+
+    long max_stack_depth;       /**< @brief Largest stack size (in bytes) during the run */
+};
+
+/**
+ * @brief Allocate a new memory hierarchy model
+ *
+ * @param levels Geometry of each cache level (L1 first)
+ * @param num_levels Number of cache levels (at most @ref MAX_CACHE_LEVELS)
+ */
+MemoryHierarchy* MemoryHierarchy_new (CacheConfig* levels, int num_levels);
+
+/**
+ * @brief Print cache hit rates, memory traffic by region and function, and
+ * the stack high-water mark
+ *
+ * @param memory Memory hierarchy model to print
+ * @param output File stream to print to
+ */
+void MemoryHierarchy_print (MemoryHierarchy* memory, FILE* output);
+
+/**
+ * @brief Deallocate a memory hierarchy model
+ *
+ * @param memory Memory hierarchy model to deallocate
+ */
+void MemoryHierarchy_free (MemoryHierarchy* memory);
+
+/*
+ * Simulator hooks (see iloc-machine.h)
+ */
+
+struct ILOCMachine;
+
+/**
+ * @brief Check whether a cache geometry is usable (see @ref CacheConfig)
+ */
+bool CacheConfig_is_valid (CacheConfig* config);
+
+/**
+ * @brief Empty the caches of a memory model and size its tables for a linked
+ * program
+ *
+ * @param memory Memory model with valid cache geometry (see @ref CacheConfig_is_valid)
+ * @param machine Machine with a linked program
+ */
+void MemoryHierarchy_init (MemoryHierarchy* memory, struct ILOCMachine* machine);
+
+/**
+ * @brief Feed a program load or store to a memory model
+ *
+ * @param memory Memory model
+ * @param address Accessed address
+ * @param write Is the operation a store (or push)?
+ * @param stack Is the address on the stack?
+ * @param function Index of the function executing the operation
+ */
+void MemoryHierarchy_access (MemoryHierarchy* memory, long address, bool write, bool stack, int function);
+
+#endif
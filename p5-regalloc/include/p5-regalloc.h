@@ -8,6 +8,56 @@
 
 #include "common.h"
 #include "iloc.h"
+#include "pipeline.h"
+
+/**
+ * @brief Register allocation statistics for a single function
+ */
+typedef struct FunctionAllocStats
+{
+    /**
+     * @brief Function name (empty for code before the first function label)
+     */
+    char name[MAX_TOKEN_LEN];
+
+    /**
+     * @brief Number of (per-function) virtual registers
+     */
+    int num_virtual_regs;
+
+    /**
+     * @brief Largest number of virtual registers live at the same time
+     * (before allocation, using straight-line live intervals)
+     */
+    int peak_pressure;
+
+    int spills;             /**< @brief Spill stores inserted */
+    int reloads;            /**< @brief Reload (loadAI) instructions inserted */
+    int remats;             /**< @brief Rematerialization (loadI) instructions inserted */
+    int frame_bytes;        /**< @brief Bytes added to the stack frame for spill slots */
+    int call_site_spills;   /**< @brief Live values evicted because a call clobbers their register */
+    int coalesced_copies;   /**< @brief Copies removed by coalescing before allocation */
+    int split_slots;        /**< @brief Stack slots kept in a register inside a loop (counted per loop) */
+    int insns_before;       /**< @brief Static instruction count before allocation */
+    int insns_after;        /**< @brief Static instruction count after allocation */
+
+} FunctionAllocStats;
+
+/**
+ * @brief Register allocation statistics for a whole program
+ * 
+ * Created by @ref allocate_registers_with_stats and deallocated with
+ * @ref AllocStats_free.
+ */
+typedef struct AllocStats
+{
+    int num_physical_registers; /**< @brief Number of physical registers available */
+    int coalesced_copies;       /**< @brief Copies removed by coalescing before allocation */
+    int removed_self_moves;     /**< @brief Copies removed after allocation (same source and destination) */
+    int num_functions;          /**< @brief Number of entries in @ref functions */
+    FunctionAllocStats* functions;  /**< @brief Per-function statistics (in program order) */
+
+} AllocStats;
 
 /**
  * @brief Allocate registers for an ILOC program
@@ -17,4 +67,51 @@
  */
 void allocate_registers (InsnList* list, int num_physical_registers);
 
+/**
+ * @brief Allocate registers for an ILOC program and report what the allocator did
+ * 
+ * @param list ILOC program as a list of instructions (the list is modified in place)
+ * @param num_physical_registers Maximum number of physical registers to be used
+ * @returns Newly-allocated statistics structure
+ */
+AllocStats* allocate_registers_with_stats (InsnList* list, int num_physical_registers);
+
+/**
+ * @brief Print allocation statistics as a human-readable table
+ * 
+ * @param stats Statistics to print
+ * @param output File stream to print to
+ */
+void AllocStats_print (AllocStats* stats, FILE* output);
+
+/**
+ * @brief Print allocation statistics as JSON
+ * 
+ * @param stats Statistics to print
+ * @param output File stream to print to
+ */
+void AllocStats_print_json (AllocStats* stats, FILE* output);
+
+/**
+ * @brief Deallocate a statistics structure
+ * 
+ * @param stats Statistics to deallocate
+ */
+void AllocStats_free (AllocStats* stats);
+
+/**
+ * @brief Reorder independent instructions within each basic block to hide
+ * latency on an in-order pipeline (see @ref PipelineModel)
+ * 
+ * May run before or after register allocation. Labels, control transfers,
+ * prints, and instructions that adjust SP or BP stay in place; everything
+ * between them is list-scheduled, and a block's new order is only kept if
+ * the pipeline model estimates that it takes fewer cycles.
+ * 
+ * @param list ILOC program as a list of instructions (the list is modified in place)
+ * @param config Pipeline timing to schedule for
+ * @returns Number of blocks that were reordered
+ */
+int schedule_instructions (InsnList* list, PipelineConfig* config);
+
 #endif
@@ -0,0 +1,131 @@
+/**
+ * @file pipeline.h
+ * @brief Cycle model of an in-order pipeline for simulator runs and the
+ * instruction scheduler
+ */
+#ifndef __H_PIPELINE
+#define __H_PIPELINE
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Timing of an in-order pipeline (see @ref PipelineModel)
+ */
+typedef struct PipelineConfig
+{
+    /**
+     * @brief Maximum number of instructions issued per cycle
+     */
+    int issue_width;
+
+    /**
+     * @brief Cycles from issue until the result of each form can be used
+     *
+     * Push and pop adjust the stack pointer in a single cycle regardless.
+     */
+    int latency[NUM_INSN_FORMS];
+
+    /**
+     * @brief Cycles lost after each jump, branch, call, or return (in addition
+     * to ending the issue group)
+     */
+    int branch_penalty;
+
+} PipelineConfig;
+
+/**
+ * @brief Fill in the default pipeline timing
+ *
+ * Two instructions issue per cycle, results are available after one cycle
+ * except for loads and pops (3), multiplies (3), and divides (20), and
+ * control transfers cost one extra cycle.
+ *
+ * @param config Timing to fill in
+ */
+void PipelineConfig_init (PipelineConfig* config);
+
+/**
+ * @brief Get the number of cycles until an instruction's result in a
+ * register can be used
+ *
+ * @param config Pipeline timing
+ * @param form Form of the instruction
+ * @param key Register key of the result (see @ref register_key)
+ */
+int PipelineConfig_latency (PipelineConfig* config, InsnForm form, int key);
+
+/**
+ * @brief Cycle estimate of an in-order pipeline
+ *
+ * Created by @ref PipelineModel_new and fed each executed instruction in
+ * order by @ref PipelineModel_issue (the simulator does this for every
+ * instruction when set in @ref SimulatorConfig::pipeline). An instruction
+ * issues once every register it reads is ready and the issue width allows;
+ * instructions never issue ahead of earlier ones. Deallocated with
+ * @ref PipelineModel_free.
+ */
+struct PipelineModel
+{
+    PipelineConfig config;      /**< @brief Pipeline timing */
+
+    long instructions;          /**< @brief Instructions issued */
+    long cycles;                /**< @brief Cycles until every issued instruction finished */
+    long operand_stalls;        /**< @brief Cycles spent waiting for operands */
+    long branch_stalls;         /**< @brief Cycles lost to control transfers */
+
+    /**
+     * @brief Operand stall cycles by the form of the instruction that
+     * produced the awaited operand
+     */
+    long stalls_by_form[NUM_INSN_FORMS];
+
+    long cycle;                 /**< @brief Cycle of the latest issue */
+    int issued;                 /**< @brief Instructions issued in @ref cycle */
+    long next_issue;            /**< @brief Earliest cycle for the next issue (after a control transfer) */
+    int num_keys;               /**< @brief Number of entries in @ref ready and @ref producer */
+    long* ready;                /**< @brief Cycle when each register (by key) is ready */
+    InsnForm* producer;         /**< @brief Form of the latest write to each register */
+};
+
+/**
+ * @brief Allocate a new (idle) pipeline model
+ *
+ * @param config Pipeline timing (copied)
+ */
+PipelineModel* PipelineModel_new (PipelineConfig* config);
+
+/**
+ * @brief Reset a pipeline model to idle and clear its statistics
+ *
+ * @param model Pipeline model to reset
+ */
+void PipelineModel_reset (PipelineModel* model);
+
+/**
+ * @brief Issue the next instruction
+ *
+ * Labels take no time.
+ *
+ * @param model Pipeline model
+ * @param insn Instruction to issue
+ * @returns Cycle in which the instruction issues
+ */
+long PipelineModel_issue (PipelineModel* model, ILOCInsn* insn);
+
+/**
+ * @brief Print estimated cycles and stalls
+ *
+ * @param model Pipeline model to print
+ * @param output File stream to print to
+ */
+void PipelineModel_print (PipelineModel* model, FILE* output);
+
+/**
+ * @brief Deallocate a pipeline model
+ *
+ * @param model Pipeline model to deallocate
+ */
+void PipelineModel_free (PipelineModel* model);
+
+#endif
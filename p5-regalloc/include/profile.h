@@ -0,0 +1,167 @@
+/**
+ * @file profile.h
+ * @brief Execution profiles of simulator runs
+ */
+#ifndef __H_PROFILE
+#define __H_PROFILE
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Execution counts for a single function in an @ref ILOCProfile
+ */
+typedef struct ProfileFunction
+{
+    char name[MAX_TOKEN_LEN];   /**< @brief Function name (empty for code before the first function) */
+    int first_insn;             /**< @brief Index of the function's label */
+    int end_insn;               /**< @brief Index of the first instruction after the function */
+    long calls;                 /**< @brief Number of times the function was called */
+
+    /**
+     * @brief Instructions executed in the function itself (exclusive count)
+     */
+    long self;
+
+    /**
+     * @brief Instructions executed in the function and everything it called
+     * (inclusive count; recursive activations are only counted once)
+     */
+    long inclusive;
+
+} ProfileFunction;
+
+/**
+ * @brief Execution counts for a single basic block (label) in an @ref ILOCProfile
+ * 
+ * Blocks run from a label to the next label. Code after a CALL belongs to
+ * the block containing the CALL.
+ */
+typedef struct ProfileBlock
+{
+    int first_insn;     /**< @brief Index of the block's label (or first instruction) */
+    int end_insn;       /**< @brief Index of the first instruction after the block */
+    int function;       /**< @brief Index of the containing function */
+    long entries;       /**< @brief Number of times execution reached the label */
+    long count;         /**< @brief Instructions executed in the block */
+
+} ProfileBlock;
+
+/**
+ * @brief Execution profile of a simulator run
+ * 
+ * Created by @ref ILOCProfile_new, filled in by @ref run_simulator_with_config
+ * when set in @ref SimulatorConfig::profile, and deallocated with
+ * @ref ILOCProfile_free. The profile refers to the instructions of the
+ * profiled program, so it must be printed before the program is freed.
+ */
+struct ILOCProfile
+{
+    long total;                 /**< @brief Total instructions executed */
+
+    int num_insns;              /**< @brief Number of program instructions */
+    ILOCInsn** insns;           /**< @brief Program instructions (in program order) */
+    long* insn_counts;          /**< @brief Execution count of each instruction */
+
+    int num_blocks;             /**< @brief Number of entries in @ref blocks */
+    ProfileBlock* blocks;       /**< @brief Per-block counts (in program order) */
+
+    int num_functions;          /**< @brief Number of entries in @ref functions */
+    ProfileFunction* functions; /**< @brief Per-function counts (in program order) */
+
+    /**
+     * @brief Number of calls along each call graph edge (indexed by
+     * <tt>caller * num_functions + callee</tt>)
+     */
+    long* edge_calls;
+
+    /**
+     * @brief Inclusive instructions executed by the callee on behalf of each
+     * call graph edge (same indexing as @ref edge_calls)
+     */
+    long* edge_inclusive;
+
+};
+
+/**
+ * @brief Allocate a new (empty) execution profile
+ */
+ILOCProfile* ILOCProfile_new (void);
+
+/**
+ * @brief Print a gprof-style flat profile, call graph, and basic block and
+ * instruction counts
+ * 
+ * @param profile Profile to print
+ * @param output File stream to print to
+ */
+void ILOCProfile_print (ILOCProfile* profile, FILE* output);
+
+/**
+ * @brief Print an execution profile as JSON
+ * 
+ * @param profile Profile to print
+ * @param output File stream to print to
+ */
+void ILOCProfile_print_json (ILOCProfile* profile, FILE* output);
+
+/**
+ * @brief Print Decaf source code annotated with the number of instructions and
+ * memory operations (loads, stores, pushes, and pops) executed for each line
+ * 
+ * @param profile Profile to print
+ * @param source Decaf source code of the profiled program
+ * @param output File stream to print to
+ */
+void ILOCProfile_print_source (ILOCProfile* profile, const char* source, FILE* output);
+
+/**
+ * @brief Deallocate an execution profile
+ * 
+ * @param profile Profile to deallocate
+ */
+void ILOCProfile_free (ILOCProfile* profile);
+
+/*
+ * Simulator hooks (see iloc-machine.h)
+ */
+
+struct ILOCMachine;
+
+/**
+ * @brief Dynamic call stack of a profiled run (owned by the machine)
+ */
+typedef struct ProfileStack ProfileStack;
+
+/**
+ * @brief Size a profile for a linked program and start its call stack
+ *
+ * @param profile Profile to (re)initialize
+ * @param machine Machine with a linked program
+ * @param start Index of the first instruction to execute
+ * @returns Newly-allocated call stack (with a call to the starting function)
+ */
+ProfileStack* ProfileStack_new (ILOCProfile* profile, struct ILOCMachine* machine, int start);
+
+/**
+ * @brief Count an executed instruction and follow calls and returns
+ *
+ * @param stack Call stack of the run
+ * @param profile Profile of the run
+ * @param index Index of the executed instruction
+ * @param form Form of the executed instruction
+ * @param next Index of the next instruction to execute
+ */
+void ProfileStack_step (ProfileStack* stack, ILOCProfile* profile, int index, InsnForm form, int next);
+
+/**
+ * @brief End the calls still active when a run ended (by running off the end
+ * of main() or by a fault), compute the profile's per-function and per-block
+ * counts, and deallocate the call stack
+ *
+ * @param stack Call stack of the run
+ * @param profile Profile of the run
+ */
+void ProfileStack_finish (ProfileStack* stack, ILOCProfile* profile);
+
+#endif
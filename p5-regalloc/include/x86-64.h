@@ -0,0 +1,34 @@
+/**
+ * @file x86-64.h
+ * @brief x86-64 emitter
+ */
+#ifndef __H_X86_64
+#define __H_X86_64
+
+#include "common.h"
+#include "iloc.h"
+
+/**
+ * @brief Number of ILOC physical registers that map onto x86-64 registers
+ * (allocate with at most this many)
+ */
+#define X86_64_NUM_REGS 11
+
+/**
+ * @brief Generate x86-64 assembly (GNU assembler syntax) from allocated ILOC
+ *
+ * Physical registers R0 through R10 map onto hardware registers, and the
+ * address space is a zero-filled array of @ref MEM_SIZE bytes laid out as in
+ * the simulator. Multiplication and division use @c imul and @c idiv. Each
+ * file includes a small runtime (output, faults, and program exit) on top
+ * of the C library, so it builds into an executable with
+ * <tt>gcc -static -no-pie</tt> (the code uses absolute addresses). Output,
+ * return values, and fault messages match a simulator run followed by the
+ * driver's "RETURN VALUE" line, except that there is no instruction limit.
+ *
+ * @param iloc ILOC program as a list of instructions
+ * @param output File stream for output
+ */
+void emit_x86_64 (InsnList* iloc, FILE* output);
+
+#endif
@@ -0,0 +1,298 @@
+#define _DEFAULT_SOURCE     /* clock_gettime() and open_memstream() */
+
+#include "batch.h"
+
+#include <pthread.h>
+#include <time.h>
+
+BatchJob* BatchJob_new (InsnList* program)
+{
+    BatchJob* job = (BatchJob*)calloc(1, sizeof(BatchJob));
+    CHECK_MALLOC_PTR(job);
+    job->program = program;
+    job->output = OutputSink_new_capture();
+    return job;
+}
+
+BatchJob* BatchJob_new_build (BatchBuildFunction build, void* arg)
+{
+    BatchJob* job = BatchJob_new(NULL);
+    job->build = build;
+    job->build_arg = arg;
+    return job;
+}
+
+void BatchJob_print_json (BatchJob* job, const char* name, FILE* output)
+{
+    SimulatorResult* result = &job->result;
+    fprintf(output, "{\"name\": \"");
+    print_escaped_string(name, output);
+    if (job->program == NULL) {
+        /* drop trailing newlines of the last message */
+        size_t length = strlen(job->build_errors);
+        while (length > 0 && job->build_errors[length-1] == '\n') {
+            job->build_errors[--length] = '\0';
+        }
+        fprintf(output, "\", \"status\": \"compile_error\", \"message\": \"");
+        print_escaped_string(job->build_errors, output);
+        fprintf(output, "\"}\n");
+        return;
+    }
+    fprintf(output, "\", \"status\": \"%s\", \"fault\": \"%s\", \"message\": \"",
+            (result->status == SIM_SUCCESS ? "success" : "fault"), SimulatorFault_name(result->fault));
+    print_escaped_string(result->message, output);
+    fprintf(output, "\", \"return_value\": %ld, \"instructions\": %ld, \"wall_time\": %.6f, \"output\": \"",
+            result->return_value, result->instructions_executed, job->wall_time);
+    print_escaped_string(OutputSink_text(job->output), output);
+    fprintf(output, "\"}\n");
+}
+
+void BatchJob_free (BatchJob* job)
+{
+    if (job->build != NULL && job->program != NULL) {
+        InsnList_free(job->program);
+    }
+    free(job->build_errors);
+    OutputSink_free(job->output);
+    free(job);
+}
+
+/**
+ * @brief Queue of jobs owned by one worker (other workers steal from the front)
+ */
+typedef struct BatchQueue
+{
+    BatchJob** jobs;        /**< @brief Ring buffer of queued jobs */
+    int capacity;           /**< @brief Allocated size of @ref jobs */
+    int first;              /**< @brief Index of the oldest job */
+    int count;              /**< @brief Number of queued jobs */
+
+} BatchQueue;
+
+/**
+ * @brief Worker thread argument
+ */
+typedef struct BatchWorker
+{
+    BatchPool* pool;        /**< @brief Pool the worker belongs to */
+    int index;              /**< @brief Index of the worker (and its queue) */
+    pthread_t thread;       /**< @brief Worker thread */
+
+} BatchWorker;
+
+/*
+ * Jobs are whole program runs, so a single lock for the queues and counts is
+ * held only briefly compared to the work in between: submitting a job takes
+ * it once, and a worker takes it once per job (to finish the previous job and
+ * take the next one).
+ */
+struct BatchPool
+{
+    SimulatorConfig config;     /**< @brief Settings for every run */
+    int num_workers;            /**< @brief Number of worker threads */
+    BatchWorker* workers;       /**< @brief Worker threads */
+    BatchQueue* queues;         /**< @brief Job queue of each worker */
+    int next_queue;             /**< @brief Queue for the next submitted job */
+
+    pthread_mutex_t lock;       /**< @brief Protects the queues and the counts below */
+    pthread_cond_t work_ready;  /**< @brief Signaled when jobs are queued or the pool stops */
+    pthread_cond_t all_done;    /**< @brief Signaled when the last job finishes */
+    int queued;                 /**< @brief Number of queued jobs */
+    int unfinished;             /**< @brief Number of queued or running jobs */
+    bool stopping;              /**< @brief Should the workers exit when the queues are empty? */
+};
+
+void BatchQueue_push (BatchQueue* queue, BatchJob* job)
+{
+    if (queue->count == queue->capacity) {
+        int capacity = (queue->capacity > 0 ? queue->capacity * 2 : 16);
+        BatchJob** jobs = (BatchJob**)malloc(capacity * sizeof(BatchJob*));
+        CHECK_MALLOC_PTR(jobs);
+        for (int i = 0; i < queue->count; i++) {
+            jobs[i] = queue->jobs[(queue->first + i) % queue->capacity];
+        }
+        free(queue->jobs);
+        queue->jobs = jobs;
+        queue->capacity = capacity;
+        queue->first = 0;
+    }
+    queue->jobs[(queue->first + queue->count) % queue->capacity] = job;
+    queue->count++;
+}
+
+/**
+ * @brief Remove the newest job (@c steal is false) or the oldest job (@c steal
+ * is true) from a queue
+ *
+ * @returns Job or NULL if the queue is empty
+ */
+BatchJob* BatchQueue_take (BatchQueue* queue, bool steal)
+{
+    BatchJob* job = NULL;
+    if (queue->count > 0) {
+        if (steal) {
+            job = queue->jobs[queue->first];
+            queue->first = (queue->first + 1) % queue->capacity;
+        } else {
+            job = queue->jobs[(queue->first + queue->count - 1) % queue->capacity];
+        }
+        queue->count--;
+    }
+    return job;
+}
+
+/**
+ * @brief Take a job from a worker's own queue or steal one from another queue
+ * (the caller must hold the pool's lock)
+ *
+ * @returns Job or NULL if every queue was empty
+ */
+BatchJob* BatchPool_take (BatchPool* pool, int worker)
+{
+    if (pool->queued == 0) {
+        return NULL;
+    }
+    BatchJob* job = BatchQueue_take(&pool->queues[worker], false);
+    for (int i = 1; job == NULL && i < pool->num_workers; i++) {
+        job = BatchQueue_take(&pool->queues[(worker + i) % pool->num_workers], true);
+    }
+    pool->queued--;
+    return job;
+}
+
+/**
+ * @brief Build (if necessary), run, and time a single job
+ */
+void BatchJob_run (BatchJob* job, SimulatorConfig* config)
+{
+    if (job->build != NULL) {
+        size_t length = 0;
+        FILE* errors = open_memstream(&job->build_errors, &length);
+        CHECK_MALLOC_PTR(errors);
+        job->program = job->build(job->build_arg, errors);
+        fclose(errors);
+        if (job->program == NULL) {
+            return;
+        }
+    }
+
+    SimulatorConfig job_config = *config;
+    job_config.output = job->output;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->result = simulate_program(job->program, &job_config);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->wall_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief Worker thread: run jobs until the pool stops
+ */
+void* BatchWorker_run (void* arg)
+{
+    BatchWorker* worker = (BatchWorker*)arg;
+    BatchPool* pool = worker->pool;
+    bool finished_job = false;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        if (finished_job && --pool->unfinished == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        BatchJob* job;
+        while ((job = BatchPool_take(pool, worker->index)) == NULL && !pool->stopping) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (job == NULL) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        BatchJob_run(job, &pool->config);
+        finished_job = true;
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * @brief Stop and join the first @c num_started workers and deallocate a pool
+ */
+void BatchPool_stop (BatchPool* pool, int num_started)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        free(pool->queues[i].jobs);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+}
+
+BatchPool* BatchPool_new (int num_workers, SimulatorConfig* config)
+{
+    BatchPool* pool = (BatchPool*)calloc(1, sizeof(BatchPool));
+    CHECK_MALLOC_PTR(pool);
+    pool->config = *config;
+    pool->config.print_trace = false;
+    pool->config.profile = NULL;
+    pool->config.trace_file = NULL;
+    pool->config.memory = NULL;
+    pool->config.pipeline = NULL;
+    pool->num_workers = (num_workers > 0 ? num_workers : 1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    pool->queues = (BatchQueue*)calloc(pool->num_workers, sizeof(BatchQueue));
+    pool->workers = (BatchWorker*)calloc(pool->num_workers, sizeof(BatchWorker));
+    CHECK_MALLOC_PTR(pool->queues);
+    CHECK_MALLOC_PTR(pool->workers);
+    for (int i = 0; i < pool->num_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, BatchWorker_run, &pool->workers[i]) != 0) {
+            BatchPool_stop(pool, i);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void BatchPool_submit (BatchPool* pool, BatchJob* job)
+{
+    pthread_mutex_lock(&pool->lock);
+    BatchQueue_push(&pool->queues[pool->next_queue], job);
+    pool->next_queue = (pool->next_queue + 1) % pool->num_workers;
+    pool->queued++;
+    pool->unfinished++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void BatchPool_wait (BatchPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->unfinished > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void BatchPool_free (BatchPool* pool)
+{
+    BatchPool_wait(pool);
+    BatchPool_stop(pool, pool->num_workers);
+}
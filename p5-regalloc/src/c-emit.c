@@ -0,0 +1,328 @@
+#include "c-emit.h"
+
+#include <limits.h>
+
+static FILE* c_out = NULL;
+
+/*
+ * For reference:
+ *
+ * SP, BP, RET  - special registers (globals)
+ * R0, R1, ...  - physical registers (globals, since they live across calls)
+ * r0, r1, ...  - virtual registers (locals of each function)
+ * fn_<name>    - ILOC function <name>
+ * l<id>        - jump label (goto target inside its function)
+ *
+ * Registers start out with the simulator's "uninitialized" value so that
+ * even incorrect programs behave the same natively.
+ */
+const char* c_reg_name (Operand op)
+{
+    static char name[MAX_ID_LEN];
+    switch (op.type) {
+        case STACK_REG:     return "SP";
+        case BASE_REG:      return "BP";
+        case RETURN_REG:    return "RET";
+        case VIRTUAL_REG:   snprintf(name, MAX_ID_LEN, "r%d", op.id); return name;
+        case PHYSICAL_REG:  snprintf(name, MAX_ID_LEN, "R%d", op.id); return name;
+        default:            return "INVALID";
+    }
+}
+
+void c_emitf (const char* format, ...)
+{
+    fprintf(c_out, "    ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(c_out, format, args);
+    va_end(args);
+    fprintf(c_out, "\n");
+}
+
+/**
+ * @brief Format a 64-bit integer literal (@c buffer must hold @ref MAX_ID_LEN
+ * characters)
+ */
+void c_format_const (long value, char* buffer)
+{
+    if (value == LONG_MIN) {
+        snprintf(buffer, MAX_ID_LEN, "INT64_MIN");
+    } else {
+        snprintf(buffer, MAX_ID_LEN, "INT64_C(%ld)", value);
+    }
+}
+
+/**
+ * @brief Emit the runtime: memory, registers, and checked memory access
+ *
+ * @param num_physical_regs Number of physical registers used by the program
+ */
+void c_emit_runtime (int num_physical_regs)
+{
+    fprintf(c_out, "/* generated from ILOC by decaf */\n\n"
+            "#include <inttypes.h>\n"
+            "#include <stdio.h>\n"
+            "#include <stdlib.h>\n"
+            "#include <string.h>\n\n"
+            "typedef int64_t word_t;\n"
+            "typedef uint64_t uword_t;\n\n"
+            "#define MEM_SIZE    %d\n"
+            "#define STACK_LIMIT %d\n"
+            "#define WORD_SIZE   %d\n"
+            "#define UNINIT      (-9999999)\n\n"
+            "/* arithmetic wraps around like the simulator's */\n"
+            "#define ADD(A,B)    ((word_t)((uword_t)(A) + (uword_t)(B)))\n"
+            "#define SUB(A,B)    ((word_t)((uword_t)(A) - (uword_t)(B)))\n"
+            "#define MULT(A,B)   ((word_t)((uword_t)(A) * (uword_t)(B)))\n\n"
+            "static unsigned char mem[MEM_SIZE];\n"
+            "static word_t SP = MEM_SIZE, BP = UNINIT, RET = UNINIT;\n",
+            MEM_SIZE, STATIC_VAR_OFFSET, WORD_SIZE);
+    for (int i = 0; i < num_physical_regs; i++) {
+        fprintf(c_out, "static word_t R%d = UNINIT;\n", i);
+    }
+    fprintf(c_out, "\n"
+            "static void fault (const char* message)\n"
+            "{\n"
+            "    printf(\"ERROR: %%s\\n\", message);\n"
+            "    exit(EXIT_FAILURE);\n"
+            "}\n\n"
+            "static word_t check_address (word_t address)\n"
+            "{\n"
+            "    if ((uword_t)address > MEM_SIZE - WORD_SIZE) {\n"
+            "        char message[64];\n"
+            "        snprintf(message, sizeof(message), \"Address %%\" PRId64 \" is invalid (out of range)\", address);\n"
+            "        fault(message);\n"
+            "    }\n"
+            "    return address;\n"
+            "}\n\n"
+            "static word_t load (word_t address)\n"
+            "{\n"
+            "    word_t value;\n"
+            "    memcpy(&value, mem + check_address(address), sizeof(value));\n"
+            "    return value;\n"
+            "}\n\n"
+            "static word_t divide (word_t dividend, word_t divisor)\n"
+            "{\n"
+            "    if (divisor == 0) {\n"
+            "        fault(\"Division by zero\");\n"
+            "    }\n"
+            "    if (divisor == -1 && dividend == INT64_MIN) {\n"
+            "        char message[64];\n"
+            "        snprintf(message, sizeof(message), \"Division overflow (%%\" PRId64 \" / -1)\", dividend);\n"
+            "        fault(message);\n"
+            "    }\n"
+            "    return dividend / divisor;\n"
+            "}\n\n"
+            "static void store (word_t address, word_t value)\n"
+            "{\n"
+            "    memcpy(mem + check_address(address), &value, sizeof(value));\n"
+            "}\n\n"
+            "static void push (word_t value)\n"
+            "{\n"
+            "    SP = SUB(SP, WORD_SIZE);\n"
+            "    if (SP <= STACK_LIMIT) {\n"
+            "        fault(\"Stack overflow\");\n"
+            "    }\n"
+            "    store(SP, value);\n"
+            "}\n\n"
+            "static word_t pop (void)\n"
+            "{\n"
+            "    if (SP > MEM_SIZE - WORD_SIZE) {\n"
+            "        fault(\"Cannot pop from empty stack\");\n"
+            "    }\n"
+            "    word_t value = load(SP);\n"
+            "    SP = ADD(SP, WORD_SIZE);\n"
+            "    return value;\n"
+            "}\n\n"
+            "/* returning with an empty stack ends the program (as in the simulator) */\n"
+            "static void finish (void)\n"
+            "{\n"
+            "    printf(\"RETURN VALUE = %%d\\n\", (int)RET);\n"
+            "    exit(EXIT_SUCCESS);\n"
+            "}\n\n");
+}
+
+/**
+ * @brief Emit the declarations of a function's virtual registers
+ *
+ * @param first First instruction of the function (its label)
+ */
+void c_emit_locals (ILOCInsn* first)
+{
+    int max_id = -1;
+    for (ILOCInsn* i = first; i != NULL && (i == first || !(i->form == LABEL && i->op[0].type == CALL_LABEL)); i = i->next) {
+        for (int j = 0; j < 3; j++) {
+            if (i->op[j].type == VIRTUAL_REG && i->op[j].id > max_id) {
+                max_id = i->op[j].id;
+            }
+        }
+    }
+    if (max_id < 0) {
+        return;
+    }
+
+    /* only declare the registers that are used */
+    bool* used = (bool*)calloc(max_id + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(used);
+    for (ILOCInsn* i = first; i != NULL && (i == first || !(i->form == LABEL && i->op[0].type == CALL_LABEL)); i = i->next) {
+        for (int j = 0; j < 3; j++) {
+            if (i->op[j].type == VIRTUAL_REG) {
+                used[i->op[j].id] = true;
+            }
+        }
+    }
+    for (int id = 0; id <= max_id; id++) {
+        if (used[id]) {
+            c_emitf("word_t r%d = UNINIT;", id);
+        }
+    }
+    free(used);
+}
+
+#define OP0 (i->op[0])
+#define OP1 (i->op[1])
+#define OP2 (i->op[2])
+#define REG0 reg[0]
+#define REG1 reg[1]
+#define REG2 reg[2]
+
+void emit_c (InsnList* iloc, FILE* output)
+{
+    c_out = output;
+
+    /* globals for every physical register used */
+    int num_physical_regs = 0;
+    FOR_EACH (ILOCInsn*, i, iloc) {
+        for (int j = 0; j < 3; j++) {
+            if (i->op[j].type == PHYSICAL_REG && i->op[j].id >= num_physical_regs) {
+                num_physical_regs = i->op[j].id + 1;
+            }
+        }
+    }
+    c_emit_runtime(num_physical_regs);
+
+    /* prototypes (functions may call each other in any order) */
+    FOR_EACH (ILOCInsn*, i, iloc) {
+        if (i->form == LABEL && OP0.type == CALL_LABEL) {
+            fprintf(c_out, "static void fn_%s (void);\n", OP0.str);
+        }
+    }
+    fprintf(c_out, "\n");
+
+    /* instructions before the first function never run */
+    bool in_function = false;
+    int index = -1;
+    FOR_EACH (ILOCInsn*, i, iloc)
+    {
+        index++;
+        if (i->form == LABEL && OP0.type == CALL_LABEL) {
+            if (in_function) {
+                fprintf(c_out, "}\n\n");
+            }
+            fprintf(c_out, "static void fn_%s (void)\n{\n", OP0.str);
+            c_emit_locals(i);
+            in_function = true;
+            continue;
+        }
+        if (!in_function) {
+            continue;
+        }
+
+        /* register names are reused by c_reg_name, so copy them */
+        char reg[3][MAX_ID_LEN];
+        char imm[3][MAX_ID_LEN];
+        for (int j = 0; j < 3; j++) {
+            snprintf(reg[j], MAX_ID_LEN, "%s", c_reg_name(i->op[j]));
+            if (i->op[j].type == INT_CONST) {
+                c_format_const(i->op[j].imm, imm[j]);
+            }
+        }
+
+        switch (i->form)
+        {
+            /* data movement */
+
+            case LOAD_I:    c_emitf("%s = %s;", REG1, imm[0]);                          break;
+            case LOAD:      c_emitf("%s = load(%s);", REG1, REG0);                      break;
+            case LOAD_AI:   c_emitf("%s = load(ADD(%s, %s));", REG2, REG0, imm[1]);     break;
+            case LOAD_AO:   c_emitf("%s = load(ADD(%s, %s));", REG2, REG0, REG1);       break;
+            case STORE:     c_emitf("store(%s, %s);", REG1, REG0);                      break;
+            case STORE_AI:  c_emitf("store(ADD(%s, %s), %s);", REG1, imm[2], REG0);     break;
+            case STORE_AO:  c_emitf("store(ADD(%s, %s), %s);", REG1, REG2, REG0);       break;
+            case I2I:       c_emitf("%s = %s;", REG1, REG0);                            break;
+            case PUSH:      c_emitf("push(%s);", REG0);                                 break;
+            case POP:       c_emitf("%s = pop();", REG0);                               break;
+
+            /* unary and binary operations */
+
+            case ADD:       c_emitf("%s = ADD(%s, %s);", REG2, REG0, REG1);             break;
+            case SUB:       c_emitf("%s = SUB(%s, %s);", REG2, REG0, REG1);             break;
+            case MULT:      c_emitf("%s = MULT(%s, %s);", REG2, REG0, REG1);            break;
+            case DIV:       c_emitf("%s = divide(%s, %s);", REG2, REG0, REG1);          break;
+            case AND:       c_emitf("%s = %s & %s;", REG2, REG0, REG1);                 break;
+            case OR:        c_emitf("%s = %s | %s;", REG2, REG0, REG1);                 break;
+            case ADD_I:     c_emitf("%s = ADD(%s, %s);", REG2, REG0, imm[1]);           break;
+            case MULT_I:    c_emitf("%s = MULT(%s, %s);", REG2, REG0, imm[1]);          break;
+            case NOT:       c_emitf("%s = ~%s & 1;", REG1, REG0);                       break;
+            case NEG:       c_emitf("%s = SUB(0, %s);", REG1, REG0);                    break;
+
+            /* comparisons */
+
+            case CMP_LT:    c_emitf("%s = %s < %s;", REG2, REG0, REG1);                 break;
+            case CMP_LE:    c_emitf("%s = %s <= %s;", REG2, REG0, REG1);                break;
+            case CMP_EQ:    c_emitf("%s = %s == %s;", REG2, REG0, REG1);                break;
+            case CMP_NE:    c_emitf("%s = %s != %s;", REG2, REG0, REG1);                break;
+            case CMP_GE:    c_emitf("%s = %s >= %s;", REG2, REG0, REG1);                break;
+            case CMP_GT:    c_emitf("%s = %s > %s;", REG2, REG0, REG1);                 break;
+
+            /* control flow (calls push the index of the next instruction,
+             * just like the simulator, so stack layouts are identical) */
+
+            case LABEL:     fprintf(c_out, "l%d: ;\n", OP0.id);                         break;
+            case JUMP:      c_emitf("goto l%d;", OP0.id);                               break;
+            case CBR:       c_emitf("if (%s) goto l%d; else goto l%d;", REG0, OP1.id, OP2.id);
+                            break;
+            case CALL:      c_emitf("push(%d);", index + 1);
+                            c_emitf("fn_%s();", OP0.str);
+                            break;
+            case RETURN:    c_emitf("if (SP == MEM_SIZE) finish();");
+                            c_emitf("pop();");
+                            c_emitf("return;");
+                            break;
+
+            /* misc instructions */
+
+            case PRINT:
+                if (OP0.type == STR_CONST) {
+                    fprintf(c_out, "    fputs(\"");
+                    print_escaped_string(OP0.str, c_out);
+                    fprintf(c_out, "\", stdout);\n");
+                } else {
+                    c_emitf("printf(\"%%\" PRId64, %s);", REG0);
+                }
+                break;
+
+            case NOP:       c_emitf(";");                                               break;
+
+            case PHI:
+                /* nothing to do */
+                break;
+
+            default:
+                printf("Unsupported instruction: ");
+                ILOCInsn_print(i, stdout);
+                printf("\n");
+                break;
+        }
+    }
+    if (in_function) {
+        fprintf(c_out, "}\n\n");
+    }
+
+    /* entry point (main's return normally ends the program first) */
+    fprintf(c_out, "int main (void)\n{\n");
+    c_emitf("fn_main();");
+    c_emitf("finish();");
+    c_emitf("return EXIT_SUCCESS;");
+    fprintf(c_out, "}\n");
+}
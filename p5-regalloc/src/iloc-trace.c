@@ -0,0 +1,504 @@
+/**
+ * @file iloc-trace.c
+ * @brief Decoder for binary ILOC simulator traces
+ *
+ * Replays a trace written by the simulator (see @ref TraceDeltaKind) and
+ * prints it either as the full machine state before every step (the same
+ * text that the simulator prints when tracing) or as one line of changes per
+ * step.
+ */
+
+#include "iloc.h"
+
+/**
+ * @brief Number of special (sp, bp, ret) and physical registers in a trace
+ */
+#define NUM_TRACE_FIXED_REGS (3 + MAX_PHYSICAL_REGS)
+
+/**
+ * @brief Single register or memory change within a step
+ */
+typedef struct Delta
+{
+    TraceDeltaKind kind;    /**< @brief What changed */
+    uint64_t id;            /**< @brief Register ID, address, or window size */
+    int64_t value;          /**< @brief New value (registers and memory only) */
+
+} Delta;
+
+/**
+ * @brief Register window (see the simulator's machine state)
+ */
+typedef struct Window
+{
+    int base;   /**< @brief Index of the window's first register */
+    int size;   /**< @brief Number of registers in the window */
+
+} Window;
+
+/**
+ * @brief Machine state reconstructed from a trace
+ */
+typedef struct TraceState
+{
+    int word_size;              /**< @brief Bytes per memory word */
+    int64_t uninit;             /**< @brief Value of uninitialized registers */
+    long mem_size;              /**< @brief Size of the address space in bytes */
+    long static_offset;         /**< @brief Address of the first static variable */
+
+    int64_t fixed[NUM_TRACE_FIXED_REGS];    /**< @brief sp, bp, ret, R0... */
+
+    int64_t* regs;              /**< @brief Virtual register file */
+    int regs_size;              /**< @brief Allocated size of @ref regs */
+    Window* windows;            /**< @brief Register windows (innermost last) */
+    int num_windows;            /**< @brief Number of active windows */
+    int max_windows;            /**< @brief Allocated size of @ref windows */
+    uint8_t* mem;               /**< @brief Address space */
+
+    int num_insns;              /**< @brief Number of program instructions */
+    char** text;                /**< @brief Text of each instruction */
+    int* function;              /**< @brief Index of each instruction's function label (-1 if none) */
+    int* block;                 /**< @brief Index of each instruction's block label (-1 if none) */
+
+} TraceState;
+
+/**
+ * @brief Print an error message and exit
+ */
+void fail (const char* message)
+{
+    fprintf(stderr, "%s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Read an unsigned varint
+ *
+ * @returns False at the end of the file
+ */
+bool read_varint (FILE* input, uint64_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(input);
+        if (c == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    fail("Corrupt trace (varint too long)");
+    return false;
+}
+
+/**
+ * @brief Read a varint that must be present
+ */
+uint64_t expect_varint (FILE* input)
+{
+    uint64_t value;
+    if (!read_varint(input, &value)) {
+        fail("Corrupt trace (truncated header)");
+    }
+    return value;
+}
+
+/**
+ * @brief Decode a zigzag-encoded signed value
+ */
+int64_t unzigzag (uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief Add a register window (initialized to the uninitialized value)
+ */
+void TraceState_push_window (TraceState* state, int size)
+{
+    Window window = { .base = 0, .size = size };
+    if (state->num_windows > 0) {
+        Window* top = &state->windows[state->num_windows - 1];
+        window.base = top->base + top->size;
+    }
+    if (state->num_windows == state->max_windows) {
+        state->max_windows = (state->max_windows > 0 ? state->max_windows * 2 : 64);
+        state->windows = (Window*)realloc(state->windows, state->max_windows * sizeof(Window));
+        CHECK_MALLOC_PTR(state->windows);
+    }
+    if (window.base + window.size > state->regs_size) {
+        while (window.base + window.size > state->regs_size) {
+            state->regs_size = (state->regs_size > 0 ? state->regs_size * 2 : 64);
+        }
+        state->regs = (int64_t*)realloc(state->regs, state->regs_size * sizeof(int64_t));
+        CHECK_MALLOC_PTR(state->regs);
+    }
+    for (int i = 0; i < window.size; i++) {
+        state->regs[window.base + i] = state->uninit;
+    }
+    state->windows[state->num_windows++] = window;
+}
+
+/**
+ * @brief Read a memory word
+ */
+int64_t TraceState_get_mem (TraceState* state, long address)
+{
+    if (state->word_size == 4) {
+        int32_t value;
+        memcpy(&value, state->mem + address, sizeof(value));
+        return value;
+    }
+    int64_t value;
+    memcpy(&value, state->mem + address, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Apply a single change to the machine state
+ */
+void TraceState_apply (TraceState* state, Delta* delta)
+{
+    switch (delta->kind) {
+        case TRACE_FIXED_REG:
+            if (delta->id >= NUM_TRACE_FIXED_REGS) {
+                fail("Corrupt trace (invalid register)");
+            }
+            state->fixed[delta->id] = delta->value;
+            break;
+        case TRACE_VIRTUAL_REG:
+        {
+            Window* top = &state->windows[state->num_windows - 1];
+            if (delta->id >= (uint64_t)top->size) {
+                fail("Corrupt trace (invalid virtual register)");
+            }
+            state->regs[top->base + delta->id] = delta->value;
+            break;
+        }
+        case TRACE_MEMORY:
+            if (delta->id > (uint64_t)(state->mem_size - state->word_size)) {
+                fail("Corrupt trace (invalid address)");
+            }
+            if (state->word_size == 4) {
+                int32_t value = (int32_t)delta->value;
+                memcpy(state->mem + delta->id, &value, sizeof(value));
+            } else {
+                memcpy(state->mem + delta->id, &delta->value, sizeof(delta->value));
+            }
+            break;
+        case TRACE_PUSH_WINDOW:
+            TraceState_push_window(state, (int)delta->id);
+            break;
+        case TRACE_POP_WINDOW:
+            if (state->num_windows > 1) {
+                state->num_windows--;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Read the trace header and instruction listing
+ */
+void TraceState_read_header (TraceState* state, FILE* input)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    if (fread(magic, 1, strlen(TRACE_MAGIC), input) != strlen(TRACE_MAGIC) ||
+            memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+        fail("Not an ILOC trace file");
+    }
+    state->word_size = (int)expect_varint(input);
+    state->uninit = unzigzag(expect_varint(input));
+    state->mem_size = (long)expect_varint(input);
+    state->static_offset = (long)expect_varint(input);
+    if ((state->word_size != 4 && state->word_size != 8) || state->mem_size <= 0) {
+        fail("Corrupt trace (invalid machine parameters)");
+    }
+    for (int i = 0; i < NUM_TRACE_FIXED_REGS; i++) {
+        state->fixed[i] = unzigzag(expect_varint(input));
+    }
+    state->mem = (uint8_t*)calloc(state->mem_size, 1);
+    CHECK_MALLOC_PTR(state->mem);
+    TraceState_push_window(state, (int)expect_varint(input));
+
+    state->num_insns = (int)expect_varint(input);
+    state->text = (char**)calloc(state->num_insns + 1, sizeof(char*));
+    state->function = (int*)calloc(state->num_insns + 1, sizeof(int));
+    state->block = (int*)calloc(state->num_insns + 1, sizeof(int));
+    CHECK_MALLOC_PTR(state->text);
+    CHECK_MALLOC_PTR(state->function);
+    CHECK_MALLOC_PTR(state->block);
+    int function = -1, block = -1;
+    for (int i = 0; i < state->num_insns; i++) {
+        uint64_t kind = expect_varint(input);
+        size_t length = (size_t)expect_varint(input);
+        state->text[i] = (char*)malloc(length + 1);
+        CHECK_MALLOC_PTR(state->text[i]);
+        if (fread(state->text[i], 1, length, input) != length) {
+            fail("Corrupt trace (truncated header)");
+        }
+        state->text[i][length] = '\0';
+        if (kind != 0) {
+            block = i;
+            if (kind == 2) {
+                function = i;
+            }
+        }
+        state->function[i] = function;
+        state->block[i] = block;
+    }
+}
+
+/**
+ * @brief Print the machine state (in the same format as the simulator's trace)
+ */
+void TraceState_print (TraceState* state, FILE* output)
+{
+    fprintf(output, "==========================\n");
+
+    /* registers (special and virtual) */
+    fprintf(output, "sp=%" PRId64 " bp=%" PRId64 " ret=%" PRId64 "\n",
+            state->fixed[0], state->fixed[1], state->fixed[2]);
+    fprintf(output, "registers: ");
+    Window* top = &state->windows[state->num_windows - 1];
+    for (int i = 0; i < top->size; i++) {
+        if (state->regs[top->base + i] != state->uninit) {
+            fprintf(output, " r%d=%" PRId64, i, state->regs[top->base + i]);
+        }
+    }
+    for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
+        if (state->fixed[3 + i] != state->uninit) {
+            fprintf(output, " R%d=%" PRId64, i, state->fixed[3 + i]);
+        }
+    }
+    fprintf(output, "\n");
+
+    /* stack (memory from the top of the address space down to stack pointer) */
+    fprintf(output, "stack:");
+    for (long addr = state->mem_size - state->word_size; addr >= state->fixed[0] && addr >= 0;
+            addr -= state->word_size) {
+        fprintf(output, "  %ld: %" PRId64, addr, TraceState_get_mem(state, addr));
+    }
+    fprintf(output, "\n");
+
+    /* other memory (any aligned value that is non-zero) */
+    fprintf(output, "other memory:");
+    for (long addr = state->static_offset; addr < state->fixed[0] &&
+            addr <= state->mem_size - state->word_size; addr += state->word_size) {
+        int64_t value = TraceState_get_mem(state, addr);
+        if (value != 0) {
+            fprintf(output, "  %ld: %" PRId64, addr, value);
+        }
+    }
+    fprintf(output, "\n");
+
+    fprintf(output, "==========================\n");
+}
+
+/**
+ * @brief Format the name of a changed register (empty for other changes)
+ */
+void Delta_register_name (Delta* delta, char* name, size_t size)
+{
+    static const char* special[] = { "sp", "bp", "ret" };
+    if (delta->kind == TRACE_FIXED_REG && delta->id < 3) {
+        snprintf(name, size, "%s", special[delta->id]);
+    } else if (delta->kind == TRACE_FIXED_REG) {
+        snprintf(name, size, "R%d", (int)delta->id - 3);
+    } else if (delta->kind == TRACE_VIRTUAL_REG) {
+        snprintf(name, size, "r%d", (int)delta->id);
+    } else {
+        name[0] = '\0';
+    }
+}
+
+/**
+ * @brief Print the changes made by a step on one line
+ */
+void print_deltas (long step, int index, TraceState* state, Delta* deltas, int num_deltas, FILE* output)
+{
+    fprintf(output, "%8ld %6d  %-32s", step, index, state->text[index]);
+    for (int d = 0; d < num_deltas; d++) {
+        char name[32];
+        Delta_register_name(&deltas[d], name, sizeof(name));
+        switch (deltas[d].kind) {
+            case TRACE_FIXED_REG:
+            case TRACE_VIRTUAL_REG:
+                fprintf(output, " %s=%" PRId64, name, deltas[d].value);
+                break;
+            case TRACE_MEMORY:
+                fprintf(output, " [%" PRIu64 "]=%" PRId64, deltas[d].id, deltas[d].value);
+                break;
+            case TRACE_PUSH_WINDOW:
+                fprintf(output, " +window(%" PRIu64 ")", deltas[d].id);
+                break;
+            case TRACE_POP_WINDOW:
+                fprintf(output, " -window");
+                break;
+            default:
+                break;
+        }
+    }
+    fprintf(output, "\n");
+}
+
+/**
+ * @brief Check whether a label instruction ("name:") has the given name
+ */
+bool is_label (const char* text, const char* name)
+{
+    size_t length = strlen(name);
+    return strncmp(text, name, length) == 0 && strcmp(text + length, ":") == 0;
+}
+
+/**
+ * @brief Check whether a step passes the command-line filters
+ */
+bool matches (TraceState* state, int index, Delta* deltas, int num_deltas,
+        const char* function, const char* label, const char* reg)
+{
+    if (function != NULL && (state->function[index] < 0 ||
+                !is_label(state->text[state->function[index]], function))) {
+        return false;
+    }
+    if (label != NULL && (state->block[index] < 0 ||
+                !is_label(state->text[state->block[index]], label))) {
+        return false;
+    }
+    if (reg != NULL) {
+        for (int d = 0; d < num_deltas; d++) {
+            char name[32];
+            Delta_register_name(&deltas[d], name, sizeof(name));
+            if (strcmp(name, reg) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Trace decoder entry point
+ *
+ * Usage: iloc-trace [options] <trace-file>
+ *
+ * Options:
+ *   --deltas             print one line per step with the changes it made
+ *                        instead of the full machine state
+ *   --function <name>    only print steps in the given function
+ *   --label <label>      only print steps in the block that starts at the
+ *                        given label (e.g., "l3" or "main")
+ *   --register <reg>     only print steps that change the given register
+ *                        (e.g., "r3", "R0", "sp", "bp", or "ret")
+ *
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line argument strings
+ * @returns @c EXIT_SUCCESS if the trace was decoded and @c EXIT_FAILURE
+ * otherwise
+ */
+int main (int argc, char** argv)
+{
+    /* check for options and filename */
+    bool deltas_only = false;
+    const char* function = NULL;
+    const char* label = NULL;
+    const char* reg = NULL;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--deltas") == 0) {
+            deltas_only = true;
+        } else if (strcmp(argv[i], "--function") == 0 && i + 1 < argc - 1) {
+            function = argv[++i];
+        } else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc - 1) {
+            label = argv[++i];
+        } else if (strcmp(argv[i], "--register") == 0 && i + 1 < argc - 1) {
+            reg = argv[++i];
+        } else {
+            argc = 0;   /* unknown option */
+        }
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [--deltas] [--function <name>] [--label <label>] "
+                "[--register <reg>] <trace-file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE* input = fopen(argv[argc-1], "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Could not read file: %s\n", argv[argc-1]);
+        return EXIT_FAILURE;
+    }
+    setvbuf(input, NULL, _IOFBF, 1 << 20);
+
+    TraceState state;
+    memset(&state, 0, sizeof(state));
+    TraceState_read_header(&state, input);
+
+    /* replay each step: read its changes, print it (with the state from
+     * before the step), then apply the changes */
+    int max_deltas = 64;
+    Delta* deltas = (Delta*)malloc(max_deltas * sizeof(Delta));
+    CHECK_MALLOC_PTR(deltas);
+    uint64_t index;
+    long step = 0;
+    while (read_varint(input, &index)) {
+        if (index >= (uint64_t)state.num_insns) {
+            fail("Corrupt trace (invalid instruction index)");
+        }
+
+        /* the last step may be cut short if the program stopped with an error */
+        int num_deltas = 0;
+        uint64_t key;
+        while (read_varint(input, &key) && (key & 7) != TRACE_END) {
+            if (num_deltas == max_deltas) {
+                max_deltas *= 2;
+                deltas = (Delta*)realloc(deltas, max_deltas * sizeof(Delta));
+                CHECK_MALLOC_PTR(deltas);
+            }
+            Delta* delta = &deltas[num_deltas++];
+            delta->kind = (TraceDeltaKind)(key & 7);
+            delta->id = key >> 3;
+            delta->value = 0;
+            if (delta->kind == TRACE_FIXED_REG || delta->kind == TRACE_VIRTUAL_REG ||
+                    delta->kind == TRACE_MEMORY) {
+                uint64_t value;
+                if (!read_varint(input, &value)) {
+                    num_deltas--;
+                    break;
+                }
+                delta->value = unzigzag(value);
+            }
+        }
+
+        if (matches(&state, (int)index, deltas, num_deltas, function, label, reg)) {
+            if (deltas_only) {
+                print_deltas(step, (int)index, &state, deltas, num_deltas, stdout);
+            } else {
+                printf("\n");
+                TraceState_print(&state, stdout);
+                printf("\nExecuting: %s\n", state.text[index]);
+            }
+        }
+        for (int d = 0; d < num_deltas; d++) {
+            TraceState_apply(&state, &deltas[d]);
+        }
+        step++;
+    }
+    fclose(input);
+
+    /* clean up */
+    free(deltas);
+    for (int i = 0; i < state.num_insns; i++) {
+        free(state.text[i]);
+    }
+    free(state.text);
+    free(state.function);
+    free(state.block);
+    free(state.regs);
+    free(state.windows);
+    free(state.mem);
+    return EXIT_SUCCESS;
+}
@@ -1,4 +1,17 @@
+#define _DEFAULT_SOURCE     /* mmap() flags and sigaction() */
+
 #include "iloc.h"
+#include "iloc-machine.h"
+#include "jit.h"
+#include "memory-model.h"
+#include "pipeline.h"
+#include "profile.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 /*
  * ILOC operands
@@ -30,7 +43,7 @@ Operand return_register (void)
 
 Operand virtual_register (void)
 {
-    static int next_id = 0;
+    static _Thread_local int next_id = 0;
     Operand op = { .type = VIRTUAL_REG, .id = next_id++ };
     return op;
 }
@@ -43,7 +56,7 @@ Operand physical_register (int id)
 
 Operand anonymous_label (void)
 {
-    static int next_id = 0;
+    static _Thread_local int next_id = 0;
     Operand op = { .type = JUMP_LABEL, .id = next_id++ };
     return op;
 }
@@ -136,6 +149,7 @@ ILOCInsn* ILOCInsn_copy (ILOCInsn* insn)
     new_insn->op[0] = insn->op[0];
     new_insn->op[1] = insn->op[1];
     new_insn->op[2] = insn->op[2];
+    new_insn->source_line = insn->source_line;
     new_insn->next = NULL;
     return new_insn;
 }
@@ -271,6 +285,60 @@ Operand ILOCInsn_get_write_register (ILOCInsn* insn)
     }
 }
 
+const char* InsnForm_name (InsnForm form)
+{
+    static const char* names[NUM_INSN_FORMS] = {
+        [ADD]      = "add",     [SUB]      = "sub",     [MULT]     = "mult",    [DIV]      = "div",
+        [AND]      = "and",     [OR]       = "or",      [LOAD_I]   = "loadI",   [LOAD]     = "load",
+        [LOAD_AI]  = "loadAI",  [LOAD_AO]  = "loadAO",  [STORE]    = "store",   [STORE_AI] = "storeAI",
+        [STORE_AO] = "storeAO", [NOP]      = "nop",     [I2I]      = "i2i",     [JUMP]     = "jump",
+        [CBR]      = "cbr",     [CMP_LT]   = "cmp_LT",  [CMP_LE]   = "cmp_LE",  [CMP_EQ]   = "cmp_EQ",
+        [CMP_GE]   = "cmp_GE",  [CMP_GT]   = "cmp_GT",  [CMP_NE]   = "cmp_NE",  [ADD_I]    = "addI",
+        [MULT_I]   = "multI",   [NOT]      = "not",     [NEG]      = "neg",     [PUSH]     = "push",
+        [POP]      = "pop",     [LABEL]    = "label",   [CALL]     = "call",    [RETURN]   = "return",
+        [PRINT]    = "print",   [PHI]      = "phi"
+    };
+    return names[form];
+}
+
+int register_key (Operand op)
+{
+    switch (op.type)
+    {
+        case STACK_REG:     return SP_KEY;
+        case BASE_REG:      return 1;
+        case RETURN_REG:    return 2;
+        case PHYSICAL_REG:  return 3 + op.id;
+        case VIRTUAL_REG:   return NUM_FIXED_REGISTER_KEYS + op.id;
+        default:            return -1;
+    }
+}
+
+void ILOCInsn_get_registers (ILOCInsn* insn, InsnRegisters* regs)
+{
+    regs->num_reads = 0;
+    regs->num_writes = 0;
+
+    ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+    for (int i = 0; i < 3; i++) {
+        int key = register_key(read_regs->op[i]);
+        if (key >= 0) {
+            regs->reads[regs->num_reads++] = key;
+        }
+    }
+    ILOCInsn_free(read_regs);
+    int key = register_key(ILOCInsn_get_write_register(insn));
+    if (key >= 0) {
+        regs->writes[regs->num_writes++] = key;
+    }
+
+    /* push and pop also adjust the stack pointer */
+    if (insn->form == PUSH || insn->form == POP) {
+        regs->reads[regs->num_reads++] = SP_KEY;
+        regs->writes[regs->num_writes++] = SP_KEY;
+    }
+}
+
 void ILOCInsn_free (ILOCInsn* insn)
 {
     free(insn);
@@ -292,6 +360,57 @@ void InsnList_print (InsnList* list, FILE* output)
     }
 }
 
+int renumber_virtual_registers (InsnList* list)
+{
+    /* find the largest program-wide id to size the mapping table */
+    int num_ids = 0;
+    FOR_EACH(ILOCInsn*, insn, list) {
+        for (int i = 0; i < 3; i++) {
+            if (insn->op[i].type == VIRTUAL_REG && insn->op[i].id >= num_ids) {
+                num_ids = insn->op[i].id + 1;
+            }
+        }
+    }
+
+    /* map old ids to new ones; a mapping is only valid within the function
+     * (identified by its index) that created it */
+    int* new_ids = (int*)calloc(num_ids + 1, sizeof(int));
+    int* owners  = (int*)calloc(num_ids + 1, sizeof(int));
+    CHECK_MALLOC_PTR(new_ids);
+    CHECK_MALLOC_PTR(owners);
+    for (int i = 0; i < num_ids; i++) {
+        owners[i] = -1;
+    }
+
+    int function = 0;
+    int next_id = 0;
+    int max_count = 0;
+    FOR_EACH(ILOCInsn*, insn, list) {
+        if (insn->form == LABEL && insn->op[0].type == CALL_LABEL) {
+            function++;
+            next_id = 0;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (insn->op[i].type != VIRTUAL_REG || insn->op[i].id < 0) {
+                continue;
+            }
+            int old_id = insn->op[i].id;
+            if (owners[old_id] != function) {
+                owners[old_id] = function;
+                new_ids[old_id] = next_id++;
+            }
+            insn->op[i].id = new_ids[old_id];
+        }
+        if (next_id > max_count) {
+            max_count = next_id;
+        }
+    }
+
+    free(new_ids);
+    free(owners);
+    return max_count;
+}
+
 
 /*
  * AST VISITOR: Symbol storage/memory allocation
@@ -439,6 +558,7 @@ void ASTNode_emit_insn (ASTNode* dest, ILOCInsn* insn)
                 (AttributeValueDOTPrinter)insnlist_attr_print, (Destructor)InsnList_free);
     }
     InsnList* list = ASTNode_get_attribute(dest, "code");
+    insn->source_line = dest->source_line;
     InsnList_add(list, insn);
 }
 
@@ -473,136 +593,327 @@ Operand ASTNode_get_temp_reg (ASTNode* node)
 
 
 /*
- * ILOC machine simulator
+ * Program output
  */
 
-#if WORD_SIZE == 4
-    typedef int32_t word_t;
-    #define PRIW "%" PRId32
-#else
-    typedef int64_t word_t;
-    #define PRIW "%" PRId64
-#endif
-typedef uint8_t byte_t;
+OutputSink* OutputSink_new_stream (FILE* stream)
+{
+    OutputSink* sink = (OutputSink*)calloc(1, sizeof(OutputSink));
+    CHECK_MALLOC_PTR(sink);
+    sink->stream = stream;
+    return sink;
+}
 
-#define UNINIT_REG       (-9999999)
+OutputSink* OutputSink_new_capture (void)
+{
+    OutputSink* sink = (OutputSink*)calloc(1, sizeof(OutputSink));
+    CHECK_MALLOC_PTR(sink);
+    sink->capacity = 4096;
+    sink->buffer = (char*)malloc(sink->capacity);
+    CHECK_MALLOC_PTR(sink->buffer);
+    sink->buffer[0] = '\0';
+    return sink;
+}
 
-/**
- * @brief Information about call targets (i.e., functions)
- * 
- * This information is prefetched with a single pass over the instruction
- * before it is simulated.
- */
-typedef struct CallTarget
+void OutputSink_write (OutputSink* sink, const char* text, size_t length)
 {
-    /**
-     * @brief Function name
-     */
-    char name[MAX_TOKEN_LEN];
+    if (sink->stream != NULL) {
+        fwrite(text, 1, length, sink->stream);
+        return;
+    }
+    if (sink->length + length + 1 > sink->capacity) {
+        while (sink->length + length + 1 > sink->capacity) {
+            sink->capacity *= 2;
+        }
+        sink->buffer = (char*)realloc(sink->buffer, sink->capacity);
+        CHECK_MALLOC_PTR(sink->buffer);
+    }
+    memcpy(sink->buffer + sink->length, text, length);
+    sink->length += length;
+    sink->buffer[sink->length] = '\0';
+}
+
+void OutputSink_write_int (OutputSink* sink, long value)
+{
+    /* format right to left (avoids printf's format parsing) */
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned long magnitude = (value < 0 ? 0UL - (unsigned long)value : (unsigned long)value);
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    OutputSink_write(sink, p, digits + sizeof(digits) - p);
+}
+
+const char* OutputSink_text (OutputSink* sink)
+{
+    return (sink->buffer != NULL ? sink->buffer : "");
+}
+
+void OutputSink_clear (OutputSink* sink)
+{
+    sink->length = 0;
+    if (sink->buffer != NULL) {
+        sink->buffer[0] = '\0';
+    }
+}
+
+void OutputSink_free (OutputSink* sink)
+{
+    if (sink->stream != NULL) {
+        fflush(sink->stream);
+    }
+    free(sink->buffer);
+    free(sink);
+}
 
-    /**
-     * @brief Pointer to corresponding label "instruction"
-     */
-    ILOCInsn* insn;
-    
-    /**
-     * @brief Next call target (if stored in a list)
-     */
-    struct CallTarget* next;
 
-} CallTarget;
+/*
+ * ILOC machine simulator
+ */
 
-DECL_LIST_TYPE(CallTarget, CallTarget*)
 DEF_LIST_IMPL(CallTarget, CallTarget*, free)
 
-void CallTargetList_add_new (CallTargetList* list, const char* name, ILOCInsn* target)
+CallTarget* CallTargetList_add_new (CallTargetList* list, const char* name, ILOCInsn* target, int index)
 {
     CallTarget* new_target = (CallTarget*)calloc(1, sizeof(CallTarget));
     CHECK_MALLOC_PTR(new_target);
     snprintf(new_target->name, MAX_TOKEN_LEN, "%s", name);
     new_target->insn = target;
+    new_target->index = index;
     CallTargetList_add(list, new_target);
+    return new_target;
 }
 
-ILOCInsn* CallTargetList_find (CallTargetList* list, const char* name)
+CallTarget* CallTargetList_find_quiet (CallTargetList* list, const char* name)
 {
     FOR_EACH (CallTarget*, target, list) {
         if (token_str_eq(target->name, name)) {
-            return target->insn;
+            return target;
+        }
+    }
+    return NULL;
+}
+
+bool is_call_label (ILOCInsn* insn)
+{
+    return insn->form == LABEL && insn->op[0].type == CALL_LABEL;
+}
+
+int* number_functions (ILOCMachine* machine, int* num_functions)
+{
+    int n = machine->num_instructions;
+    int* function_of = (int*)malloc((n + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(function_of);
+    int f = -1;
+    for (int i = 0; i < n; i++) {
+        if (f < 0 || is_call_label(machine->instructions[i])) {
+            f++;
         }
+        function_of[i] = f;
     }
-    printf("ERROR: No call target found for '%s'\n", name);
-    exit(EXIT_FAILURE);
+    function_of[n] = f;
+    *num_functions = f + 1;
+    return function_of;
 }
 
 /**
- * @brief ILOC machine state structure
+ * @brief Default number of instructions to execute before timing out
+ */
+#define TIMEOUT_NUM_INSTRUCTIONS 100000000
+
+/**
+ * @brief Size of the reserved region below the address space
+ * 
+ * Together with @ref MEM_RESERVED_ABOVE this covers every address that fits
+ * in 32 bits, which is the range the fast mode uses for loads and stores (see
+ * @ref run_decoded). Everything but the address space itself is inaccessible.
+ */
+#define MEM_RESERVED_BELOW (1L << 31)
+
+/**
+ * @brief Size of the reserved region starting at the address space
+ * 
+ * Includes a guard region of at least 64K above the largest address space.
+ */
+#define MEM_RESERVED_ABOVE (MAX_MEM_SIZE + 65536)
+
+/**
+ * @brief Size of the output buffer for binary traces
+ */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+/**
+ * @brief Buffered writer for binary traces (see @ref TraceDeltaKind)
  */
-typedef struct ILOCMachine
+typedef struct TraceWriter
 {
-    /**
-     * @brief Virtual register values
-     */
-    word_t reg[MAX_VIRTUAL_REGS];
+    FILE* output;       /**< @brief Trace destination */
+    byte_t* buffer;     /**< @brief Pending output (@ref TRACE_BUFFER_SIZE bytes) */
+    size_t used;        /**< @brief Number of pending bytes */
 
-    /**
-     * @brief Physical register values
-     */
-    word_t pr[MAX_PHYSICAL_REGS];
+} TraceWriter;
 
-    /**
-     * @brief Program counter (pointer to next instruction to execute)
-     */
-    ILOCInsn* pc;
+TraceWriter* TraceWriter_new (FILE* output)
+{
+    TraceWriter* writer = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+    CHECK_MALLOC_PTR(writer);
+    writer->buffer = (byte_t*)malloc(TRACE_BUFFER_SIZE);
+    CHECK_MALLOC_PTR(writer->buffer);
+    writer->output = output;
+    return writer;
+}
 
-    /**
-     * @brief Stack pointer value
-     */
-    word_t sp;
-    
-    /**
-     * @brief Base pointer value
-     */
-    word_t bp;
+void TraceWriter_flush (TraceWriter* writer)
+{
+    fwrite(writer->buffer, 1, writer->used, writer->output);
+    writer->used = 0;
+}
 
-    /**
-     * @brief Function return value
-     */
-    word_t ret;
+void TraceWriter_free (TraceWriter* writer)
+{
+    TraceWriter_flush(writer);
+    fflush(writer->output);
+    free(writer->buffer);
+    free(writer);
+}
 
-    /**
-     * @brief Program address space (memory w/ global variables and stack)
-     */
-    byte_t mem[MEM_SIZE];
+void TraceWriter_bytes (TraceWriter* writer, const void* data, size_t length)
+{
+    if (writer->used + length > TRACE_BUFFER_SIZE) {
+        TraceWriter_flush(writer);
+    }
+    if (length > TRACE_BUFFER_SIZE) {
+        fwrite(data, 1, length, writer->output);
+        return;
+    }
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
 
-    /**
-     * @brief List of program instructions (i.e., code)
-     * 
-     * Note that instructions are NOT stored in the program's "address space."
-     */
-    ILOCInsn* instructions[MAX_INSTRUCTIONS];
+void TraceWriter_varint (TraceWriter* writer, uint64_t value)
+{
+    /* a varint is at most 10 bytes */
+    if (writer->used + 10 > TRACE_BUFFER_SIZE) {
+        TraceWriter_flush(writer);
+    }
+    while (value >= 0x80) {
+        writer->buffer[writer->used++] = (byte_t)(value | 0x80);
+        value >>= 7;
+    }
+    writer->buffer[writer->used++] = (byte_t)value;
+}
 
-    /**
-     * @brief Jump targets (instrution pointers indexed by jump label IDs)
-     */
-    ILOCInsn* jump_targets[MAX_INSTRUCTIONS];
+void TraceWriter_signed (TraceWriter* writer, int64_t value)
+{
+    TraceWriter_varint(writer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
 
-    /**
-     * @brief Call targets (list of string label and instruction pointer pairs)
-     */
-    CallTargetList* call_targets;
+/**
+ * @brief Record a change without a value (end of step or window change)
+ */
+void TraceWriter_event (TraceWriter* writer, TraceDeltaKind kind, uint64_t id)
+{
+    TraceWriter_varint(writer, (id << 3) | kind);
+}
+
+/**
+ * @brief Record a new register or memory value
+ */
+void TraceWriter_delta (TraceWriter* writer, TraceDeltaKind kind, uint64_t id, int64_t value)
+{
+    TraceWriter_varint(writer, (id << 3) | kind);
+    TraceWriter_signed(writer, value);
+}
+
+/**
+ * @brief Address space kept for reuse by the next machine on this thread
+ * 
+ * Mapping and unmapping the guard regions costs more than running most small
+ * programs, so one freed address space is cached and cleared on reuse.
+ */
+static _Thread_local byte_t* spare_address_space = NULL;
+
+/**
+ * @brief Size of @ref spare_address_space in bytes
+ */
+static _Thread_local long spare_address_space_size = 0;
+
+byte_t* address_space_new(long size)
+{
+    if (spare_address_space != NULL && spare_address_space_size == size) {
+        byte_t* mem = spare_address_space;
+        spare_address_space = NULL;
+        if (size <= MEM_SIZE) {
+            memset(mem, 0, size);
+        } else {
+            /* discard the pages instead (they read as zero when touched again) */
+            madvise(mem, size, MADV_DONTNEED);
+        }
+        return mem;
+    }
+
+    /* reserve the whole region, then make the address space itself accessible */
+    byte_t* mapping = (byte_t*)mmap(NULL, MEM_RESERVED_BELOW + MEM_RESERVED_ABOVE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+    }
+    CHECK_MALLOC_PTR(mapping);
+    byte_t* mem = mapping + MEM_RESERVED_BELOW;
+    if (mprotect(mem, size, PROT_READ | PROT_WRITE) != 0) {
+        mem = NULL;
+    }
+    CHECK_MALLOC_PTR(mem);
+    return mem;
+}
 
-} ILOCMachine;
+void address_space_free(byte_t* mem, long size)
+{
+    if (spare_address_space != NULL) {
+        munmap(spare_address_space - MEM_RESERVED_BELOW, MEM_RESERVED_BELOW + MEM_RESERVED_ABOVE);
+    }
+    spare_address_space = mem;
+    spare_address_space_size = size;
+}
+
+/**
+ * @brief Make room for at least @c count virtual registers in the register file
+ */
+void ILOCMachine_reserve_registers(ILOCMachine* machine, int count)
+{
+    if (count <= machine->reg_file_size) {
+        return;
+    }
+    while (count > machine->reg_file_size) {
+        machine->reg_file_size = (machine->reg_file_size > 0 ? machine->reg_file_size * 2 : 64);
+    }
+    machine->reg_file = (word_t*)realloc(machine->reg_file, machine->reg_file_size * sizeof(word_t));
+    CHECK_MALLOC_PTR(machine->reg_file);
+}
 
-ILOCMachine* ILOCMachine_new(void)
+ILOCMachine* ILOCMachine_new(long mem_size)
 {
     ILOCMachine* machine = (ILOCMachine*)calloc(1, sizeof(ILOCMachine));
     CHECK_MALLOC_PTR(machine);
 
+    /* zero-filled address space between two guard regions */
+    machine->mem = address_space_new(mem_size);
+    machine->mem_size = mem_size;
+    machine->stack_limit = STATIC_VAR_OFFSET;
+    machine->max_steps = TIMEOUT_NUM_INSTRUCTIONS;
+
+    /* the register file is sized once the program is linked, and virtual
+     * register windows are initialized as they are pushed */
+    machine->max_windows = 64;
+    machine->windows = (RegWindow*)calloc(machine->max_windows, sizeof(RegWindow));
+    CHECK_MALLOC_PTR(machine->windows);
+
     /* set all registers to special "uninitialized" value (helps find code gen bugs) */
-    for (int i = 0; i < MAX_VIRTUAL_REGS; i++) {
-        machine->reg[i] = UNINIT_REG;
-    }
     for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
         machine->pr[i] = UNINIT_REG;
     }
@@ -615,6 +926,183 @@ ILOCMachine* ILOCMachine_new(void)
     return machine;
 }
 
+/**
+ * @brief Size of the buffers used to render operands and instructions in fault messages
+ */
+#define FAULT_TEXT_LEN (2 * MAX_LINE_LEN)
+
+/**
+ * @brief Render an operand as text (for fault messages)
+ * 
+ * @param op Operand
+ * @param text Destination (@ref FAULT_TEXT_LEN characters long)
+ * @returns The destination
+ */
+char* operand_text (Operand op, char* text)
+{
+    FILE* stream = fmemopen(text, FAULT_TEXT_LEN, "w");
+    CHECK_MALLOC_PTR(stream);
+    Operand_print(op, stream);
+    fclose(stream);
+    return text;
+}
+
+/**
+ * @brief Render an instruction as text (for fault messages)
+ * 
+ * @param insn Instruction
+ * @param text Destination (@ref FAULT_TEXT_LEN characters long)
+ * @returns The destination
+ */
+char* insn_text (ILOCInsn* insn, char* text)
+{
+    FILE* stream = fmemopen(text, FAULT_TEXT_LEN, "w");
+    CHECK_MALLOC_PTR(stream);
+    ILOCInsn_print(insn, stream);
+    fclose(stream);
+    return text;
+}
+
+/**
+ * @brief Stop the running program with a fault using printf syntax
+ * 
+ * Records the fault in the machine's result and jumps back to the recovery
+ * point saved by @ref simulate_program, which releases the machine.
+ */
+_Noreturn void ILOCMachine_fault (ILOCMachine* machine, SimulatorFault fault, const char* format, ...)
+{
+    machine->result.status = SIM_FAULT;
+    machine->result.fault = fault;
+    if (machine->running_steps != NULL) {
+        machine->steps = *machine->running_steps;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(machine->result.message, MAX_FAULT_LEN, format, args);
+    va_end(args);
+
+    longjmp(machine->fault_exit, 1);
+}
+
+void ILOCMachine_push_window(ILOCMachine* machine, int size)
+{
+    RegWindow window = { .base = 0, .size = size };
+    if (machine->num_windows > 0) {
+        RegWindow* top = &machine->windows[machine->num_windows - 1];
+        window.base = top->base + top->size;
+    }
+    if (machine->num_windows == machine->max_windows) {
+        machine->max_windows *= 2;
+        machine->windows = (RegWindow*)realloc(machine->windows, machine->max_windows * sizeof(RegWindow));
+        CHECK_MALLOC_PTR(machine->windows);
+    }
+    ILOCMachine_reserve_registers(machine, window.base + window.size);
+    for (int i = 0; i < window.size; i++) {
+        machine->reg_file[window.base + i] = UNINIT_REG;
+    }
+    machine->windows[machine->num_windows++] = window;
+    if (machine->trace != NULL) {
+        TraceWriter_event(machine->trace, TRACE_PUSH_WINDOW, size);
+    }
+}
+
+void ILOCMachine_pop_window(ILOCMachine* machine)
+{
+    if (machine->num_windows > 1) {
+        machine->num_windows--;
+        if (machine->trace != NULL) {
+            TraceWriter_event(machine->trace, TRACE_POP_WINDOW, 0);
+        }
+    }
+}
+
+word_t* ILOCMachine_virtual_reg(ILOCMachine* machine, int id)
+{
+    RegWindow* top = &machine->windows[machine->num_windows - 1];
+    if (id < 0 || id >= top->size) {
+        ILOCMachine_fault(machine, FAULT_INVALID_REGISTER, "Register r%d does not exist", id);
+    }
+    return &machine->reg_file[top->base + id];
+}
+
+int ILOCMachine_jump_target(ILOCMachine* machine, Operand label)
+{
+    if (label.id < 0 || label.id >= machine->num_jump_targets || machine->jump_targets[label.id] < 0) {
+        ILOCMachine_fault(machine, FAULT_UNDEFINED_LABEL, "No jump target found for 'l%d'", label.id);
+    }
+    return machine->jump_targets[label.id];
+}
+
+CallTarget* ILOCMachine_call_target(ILOCMachine* machine, const char* name)
+{
+    CallTarget* target = CallTargetList_find_quiet(machine->call_targets, name);
+    if (target == NULL) {
+        ILOCMachine_fault(machine, FAULT_UNDEFINED_LABEL, "No call target found for '%s'", name);
+    }
+    return target;
+}
+
+/**
+ * @brief Link a program into the machine before execution
+ * 
+ * Assigns each instruction its index, records the index of every jump and
+ * call label, sizes each function's register window, and resolves the target
+ * of every CALL so that calls and returns take constant time.
+ */
+void ILOCMachine_link(ILOCMachine* machine, InsnList* program)
+{
+    /* size the tables from the program */
+    int num_insns = 0;
+    int num_labels = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        num_insns++;
+        if (insn->form == LABEL && insn->op[0].type == JUMP_LABEL && insn->op[0].id >= num_labels) {
+            num_labels = insn->op[0].id + 1;
+        }
+    }
+    machine->instructions = (ILOCInsn**)calloc(num_insns + 1, sizeof(ILOCInsn*));
+    CHECK_MALLOC_PTR(machine->instructions);
+    machine->call_links = (CallTarget**)calloc(num_insns + 1, sizeof(CallTarget*));
+    CHECK_MALLOC_PTR(machine->call_links);
+    machine->jump_targets = (int*)malloc((num_labels + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(machine->jump_targets);
+    machine->num_jump_targets = num_labels;
+    for (int id = 0; id < num_labels; id++) {
+        machine->jump_targets[id] = -1;
+    }
+
+    int i = 0;
+    CallTarget* function = NULL;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        if (insn->form == LABEL) {
+            if (insn->op[0].type == JUMP_LABEL) {
+                if (insn->op[0].id >= 0) {
+                    machine->jump_targets[insn->op[0].id] = i;
+                }
+            } else {
+                function = CallTargetList_add_new(machine->call_targets, insn->op[0].str, insn, i);
+            }
+        }
+        for (int j = 0; j < 3; j++) {
+            if (function != NULL && insn->op[j].type == VIRTUAL_REG &&
+                    insn->op[j].id >= function->num_virtual_regs) {
+                function->num_virtual_regs = insn->op[j].id + 1;
+            }
+        }
+        machine->instructions[i++] = insn;
+    }
+    machine->instructions[i] = NULL;
+    machine->num_instructions = i;
+
+    /* resolve call targets (now that all functions have been seen) */
+    for (i = 0; i < machine->num_instructions; i++) {
+        ILOCInsn* insn = machine->instructions[i];
+        if (insn->form == CALL && insn->op[0].type == CALL_LABEL) {
+            machine->call_links[i] = CallTargetList_find_quiet(machine->call_targets, insn->op[0].str);
+        }
+    }
+}
+
 void ILOCMachine_set_reg(ILOCMachine* machine, Operand op, word_t value)
 {
     switch (op.type) {
@@ -622,16 +1110,14 @@ void ILOCMachine_set_reg(ILOCMachine* machine, Operand op, word_t value)
         case BASE_REG:   machine->bp  = value; break;
         case RETURN_REG: machine->ret = value; break;
         case VIRTUAL_REG:
-            if (op.id < 0 || op.id > MAX_VIRTUAL_REGS) {
-                printf("ERROR: Register r%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
+            *ILOCMachine_virtual_reg(machine, op.id) = value;
+            if (machine->trace != NULL) {
+                TraceWriter_delta(machine->trace, TRACE_VIRTUAL_REG, op.id, value);
             }
-            machine->reg[op.id] = value;
             break;
         case PHYSICAL_REG:
-            if (op.id < 0 || op.id > MAX_PHYSICAL_REGS) {
-                printf("ERROR: Register R%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
+            if (op.id < 0 || op.id >= MAX_PHYSICAL_REGS) {
+                ILOCMachine_fault(machine, FAULT_INVALID_REGISTER, "Register R%d does not exist", op.id);
             }
             machine->pr[op.id] = value;
             break;
@@ -650,59 +1136,104 @@ word_t ILOCMachine_get_reg(ILOCMachine* machine, Operand op)
         case BASE_REG:   return machine->bp;
         case RETURN_REG: return machine->ret;
         case VIRTUAL_REG:
-            if (op.id < 0 || op.id > MAX_VIRTUAL_REGS) {
-                printf("ERROR: Register r%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
-            } else if (machine->reg[op.id] == UNINIT_REG) {
+        {
+            word_t* reg = ILOCMachine_virtual_reg(machine, op.id);
+            if (*reg == UNINIT_REG) {
                 printf("WARNING: Potential uninitialized read from register r%d\n", op.id);
             }
-            return machine->reg[op.id];
+            return *reg;
+        }
         case PHYSICAL_REG:
-            if (op.id < 0 || op.id > MAX_PHYSICAL_REGS) {
-                printf("ERROR: Register R%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
+            if (op.id < 0 || op.id >= MAX_PHYSICAL_REGS) {
+                ILOCMachine_fault(machine, FAULT_INVALID_REGISTER, "Register R%d does not exist", op.id);
             } else if (machine->pr[op.id] == UNINIT_REG) {
                 printf("WARNING: Potential uninitialized read from register R%d\n", op.id);
             }
             return machine->pr[op.id];
         default:
-            printf("ERROR: Cannot read register using a non-register operand: ");
-            Operand_print(op, stdout);
-            printf("\n");
-            exit(EXIT_FAILURE);
+        {
+            char text[FAULT_TEXT_LEN];
+            ILOCMachine_fault(machine, FAULT_INVALID_REGISTER,
+                    "Cannot read register using a non-register operand: %s", operand_text(op, text));
+        }
     }
 }
 
 void ILOCMachine_set_mem(ILOCMachine* machine, long address, word_t value)
 {
-    if (address < 0 || address > MEM_SIZE - WORD_SIZE) {
-        printf("ERROR: Address %ld is invalid (out of range)\n", address);
-        exit(EXIT_FAILURE);
+    if (address < 0 || address > machine->mem_size - WORD_SIZE) {
+        ILOCMachine_fault(machine, FAULT_INVALID_ADDRESS, "Address %ld is invalid (out of range)", address);
     }
     /* actual memory write */
     *(word_t*)(machine->mem + address) = value;
+    if (machine->trace != NULL) {
+        TraceWriter_delta(machine->trace, TRACE_MEMORY, address, value);
+    }
 }
 
 word_t ILOCMachine_get_mem(ILOCMachine* machine, long address)
 {
-    if (address < 0 || address > MEM_SIZE - WORD_SIZE) {
-        printf("ERROR: Address %ld is invalid (out of range)\n", address);
-        exit(EXIT_FAILURE);
+    if (address < 0 || address > machine->mem_size - WORD_SIZE) {
+        ILOCMachine_fault(machine, FAULT_INVALID_ADDRESS, "Address %ld is invalid (out of range)", address);
     }
     /* actual memory read */
     return *(word_t*)(machine->mem + address);
 }
 
-void ILOCMachine_print(ILOCMachine* machine, FILE* output)
+/**
+ * @brief Store a word as the program (feeding the memory model, if any)
+ */
+void ILOCMachine_store(ILOCMachine* machine, long address, word_t value)
+{
+    ILOCMachine_set_mem(machine, address, value);
+    if (machine->memory != NULL) {
+        MemoryHierarchy_access(machine->memory, address, true, address >= machine->sp,
+                machine->memory->function_of[machine->pc_index]);
+    }
+}
+
+/**
+ * @brief Load a word as the program (feeding the memory model, if any)
+ */
+word_t ILOCMachine_load(ILOCMachine* machine, long address)
+{
+    word_t value = ILOCMachine_get_mem(machine, address);
+    if (machine->memory != NULL) {
+        MemoryHierarchy_access(machine->memory, address, false, address >= machine->sp,
+                machine->memory->function_of[machine->pc_index]);
+    }
+    return value;
+}
+
+/**
+ * @brief Divide two words, stopping the program if the quotient is undefined
+ * (division by zero, or the most negative word by -1, which overflows and
+ * traps on the host like division by zero)
+ */
+word_t ILOCMachine_divide(ILOCMachine* machine, word_t dividend, word_t divisor)
+{
+    if (divisor == 0) {
+        ILOCMachine_fault(machine, FAULT_INVALID_DIVISION, "Division by zero");
+    }
+    if (divisor == -1 && dividend == WORD_MIN) {
+        ILOCMachine_fault(machine, FAULT_INVALID_DIVISION, "Division overflow (" PRIW " / -1)", dividend);
+    }
+    return dividend / divisor;
+}
+
+void ILOCMachine_print(ILOCMachine* machine, FILE* output)
 {
     fprintf(output, "==========================\n");
 
     /* registers (special and virtual) */
     fprintf(output, "sp=" PRIW " bp=" PRIW " ret=" PRIW "\n", machine->sp, machine->bp, machine->ret);
     fprintf(output, "registers: ");
-    for (int i = 0; i < MAX_VIRTUAL_REGS; i++) {
-        if (machine->reg[i] != UNINIT_REG) {
-            fprintf(output, " r%d=" PRIW, i, machine->reg[i]);
+    if (machine->num_windows > 0) {
+        RegWindow* top = &machine->windows[machine->num_windows - 1];
+        for (int i = 0; i < top->size; i++) {
+            if (machine->reg_file[top->base + i] != UNINIT_REG) {
+                fprintf(output, " r%d=" PRIW, i, machine->reg_file[top->base + i]);
+            }
         }
     }
     for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
@@ -712,19 +1243,19 @@ void ILOCMachine_print(ILOCMachine* machine, FILE* output)
     }
     fprintf(output, "\n");
     
-    /* stack (memory from MEM_SIZE down to stack pointer) */
+    /* stack (memory from the top of the address space down to stack pointer) */
     fprintf(output, "stack:");
-    for (int addr = MEM_SIZE - WORD_SIZE; addr >= machine->sp; addr -= WORD_SIZE) {
-        fprintf(output, "  %d: " PRIW, addr, ILOCMachine_get_mem(machine, addr));
+    for (long addr = machine->mem_size - WORD_SIZE; addr >= machine->sp; addr -= WORD_SIZE) {
+        fprintf(output, "  %ld: " PRIW, addr, ILOCMachine_get_mem(machine, addr));
     }
     fprintf(output, "\n");
 
     /* other memory (any WORD_SIZE-aligned value that is non-zero) */
     fprintf(output, "other memory:");
-    for (int addr = STATIC_VAR_OFFSET; addr < machine->sp; addr += WORD_SIZE) {
+    for (long addr = STATIC_VAR_OFFSET; addr < machine->sp; addr += WORD_SIZE) {
         word_t value = ILOCMachine_get_mem(machine, addr);
         if (value != 0) {
-            fprintf(output, "  %d: " PRIW, addr, value);
+            fprintf(output, "  %ld: " PRIW, addr, value);
         }
     }
     fprintf(output, "\n");
@@ -735,70 +1266,70 @@ void ILOCMachine_print(ILOCMachine* machine, FILE* output)
 void ILOCMachine_free(ILOCMachine* machine)
 {
     CallTargetList_free(machine->call_targets);
+    address_space_free(machine->mem, machine->mem_size);
+    free(machine->instructions);
+    free(machine->jump_targets);
+    free(machine->call_links);
+    free(machine->reg_file);
+    free(machine->windows);
     free(machine);
 }
 
-void assert_operand_count (ILOCInsn* insn, int count)
+void assert_operand_count (ILOCMachine* machine, ILOCInsn* insn, int count)
 {
     int actual_count = ILOCInsn_get_operand_count(insn);
     if (actual_count != count) {
-        printf("ERROR: Invalid instruction (expected %d operands but found %d): ",
-                count, actual_count);
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+        char text[FAULT_TEXT_LEN];
+        ILOCMachine_fault(machine, FAULT_INVALID_INSN,
+                "Invalid instruction (expected %d operands but found %d): %s",
+                count, actual_count, insn_text(insn, text));
     }
 }
 
-void assert_operand_is_register (ILOCInsn* insn, Operand op)
+void assert_operand_is_register (ILOCMachine* machine, ILOCInsn* insn, Operand op)
 {
     if (op.type != STACK_REG  && op.type != BASE_REG &&
         op.type != RETURN_REG && op.type != VIRTUAL_REG && op.type != PHYSICAL_REG)
     {
-        printf("ERROR: Invalid operand '");
-        Operand_print(op, stdout);
-        printf("' (expected register): ");
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+        char op_text[FAULT_TEXT_LEN], text[FAULT_TEXT_LEN];
+        ILOCMachine_fault(machine, FAULT_INVALID_INSN, "Invalid operand '%s' (expected register): %s",
+                operand_text(op, op_text), insn_text(insn, text));
     }
 }
 
-void assert_all_register_operands (ILOCInsn* insn, int count)
+void assert_all_register_operands (ILOCMachine* machine, ILOCInsn* insn, int count)
 {
-    assert_operand_count(insn, count);
+    assert_operand_count(machine, insn, count);
     for (int i = 0; i < count; i++) {
-        assert_operand_is_register(insn, insn->op[i]);
+        assert_operand_is_register(machine, insn, insn->op[i]);
     }
 }
 
-void assert_operand_type (ILOCInsn* insn, Operand op, OperandType type)
+void assert_operand_type (ILOCMachine* machine, ILOCInsn* insn, Operand op, OperandType type)
 {
     if (op.type != type) {
-        printf("ERROR: Invalid operand '");
-        Operand_print(op, stdout);
-        printf("': ");
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+        char op_text[FAULT_TEXT_LEN], text[FAULT_TEXT_LEN];
+        ILOCMachine_fault(machine, FAULT_INVALID_INSN, "Invalid operand '%s': %s",
+                operand_text(op, op_text), insn_text(insn, text));
     }
 }
 
-void assert_valid_insn (ILOCInsn* insn)
+void assert_valid_insn (ILOCMachine* machine, ILOCInsn* insn)
 {
+    char op_text[FAULT_TEXT_LEN], text[FAULT_TEXT_LEN];
     switch (insn->form)
     {
         /* no operands */
         case RETURN:
         case NOP:
-            assert_operand_count(insn, 0);
+            assert_operand_count(machine, insn, 0);
             break;
 
         /* reg */
         case PUSH:
         case POP:
-            assert_operand_count(insn, 1);
-            assert_operand_is_register(insn, insn->op[0]);
+            assert_operand_count(machine, insn, 1);
+            assert_operand_is_register(machine, insn, insn->op[0]);
             break;
 
         /* reg, reg */
@@ -807,7 +1338,7 @@ void assert_valid_insn (ILOCInsn* insn)
         case NEG:
         case LOAD:
         case STORE:
-            assert_all_register_operands(insn, 2);
+            assert_all_register_operands(machine, insn, 2);
             break;
 
         /* reg, reg, reg */
@@ -826,70 +1357,66 @@ void assert_valid_insn (ILOCInsn* insn)
         case LOAD_AO:
         case STORE_AO:
         case PHI:
-            assert_all_register_operands(insn, 3);
+            assert_all_register_operands(machine, insn, 3);
             break;
 
         /* int, reg */
         case LOAD_I:
-            assert_operand_count(insn, 2);
-            assert_operand_type(insn, insn->op[0], INT_CONST);
-            assert_operand_is_register(insn, insn->op[1]);
+            assert_operand_count(machine, insn, 2);
+            assert_operand_type(machine, insn, insn->op[0], INT_CONST);
+            assert_operand_is_register(machine, insn, insn->op[1]);
             break;
 
         /* reg, int, reg */
         case ADD_I:
         case MULT_I:
         case LOAD_AI:
-            assert_operand_count(insn, 3);
-            assert_operand_is_register(insn, insn->op[0]);
-            assert_operand_type(insn, insn->op[1], INT_CONST);
-            assert_operand_is_register(insn, insn->op[2]);
+            assert_operand_count(machine, insn, 3);
+            assert_operand_is_register(machine, insn, insn->op[0]);
+            assert_operand_type(machine, insn, insn->op[1], INT_CONST);
+            assert_operand_is_register(machine, insn, insn->op[2]);
             break;
 
         /* reg, reg, int */
         case STORE_AI:
-            assert_operand_count(insn, 3);
-            assert_operand_is_register(insn, insn->op[0]);
-            assert_operand_is_register(insn, insn->op[1]);
-            assert_operand_type(insn, insn->op[2], INT_CONST);
+            assert_operand_count(machine, insn, 3);
+            assert_operand_is_register(machine, insn, insn->op[0]);
+            assert_operand_is_register(machine, insn, insn->op[1]);
+            assert_operand_type(machine, insn, insn->op[2], INT_CONST);
             break;
 
         /* lbl */
         case CALL:
-            assert_operand_count(insn, 1);
-            assert_operand_type(insn, insn->op[0], CALL_LABEL);
+            assert_operand_count(machine, insn, 1);
+            assert_operand_type(machine, insn, insn->op[0], CALL_LABEL);
             break;
         case JUMP:
-            assert_operand_count(insn, 1);
-            assert_operand_type(insn, insn->op[0], JUMP_LABEL);
+            assert_operand_count(machine, insn, 1);
+            assert_operand_type(machine, insn, insn->op[0], JUMP_LABEL);
             break;
 
         /* reg, lbl, lbl */
         case CBR:
-            assert_operand_count(insn, 3);
-            assert_operand_is_register(insn, insn->op[0]);
-            assert_operand_type(insn, insn->op[1], JUMP_LABEL);
-            assert_operand_type(insn, insn->op[2], JUMP_LABEL);
+            assert_operand_count(machine, insn, 3);
+            assert_operand_is_register(machine, insn, insn->op[0]);
+            assert_operand_type(machine, insn, insn->op[1], JUMP_LABEL);
+            assert_operand_type(machine, insn, insn->op[2], JUMP_LABEL);
             break;
 
         /* lbl */
         case LABEL:
-            assert_operand_count(insn, 1);
+            assert_operand_count(machine, insn, 1);
             if (insn->op[0].type != CALL_LABEL &&
                 insn->op[0].type != JUMP_LABEL)
             {
-                printf("Invalid label '");
-                Operand_print(insn->op[0], stdout);
-                printf("': ");
-                ILOCInsn_print(insn, stdout);
-                printf("\n");
-                exit(EXIT_FAILURE);
+                ILOCMachine_fault(machine, FAULT_INVALID_INSN, "Invalid label '%s': %s",
+                        operand_text(insn->op[0], op_text), insn_text(insn, text));
             }
             break;
 
         /* int/str/reg */
         case PRINT:
-            assert_operand_count(insn, 1);
+            assert_operand_count(machine, insn, 1);
             if (insn->op[0].type != STACK_REG &&
                 insn->op[0].type != BASE_REG &&
                 insn->op[0].type != RETURN_REG &&
@@ -898,20 +1425,14 @@ void assert_valid_insn (ILOCInsn* insn)
                 insn->op[0].type != INT_CONST &&
                 insn->op[0].type != STR_CONST)
             {
-                printf("Invalid parameter '");
-                Operand_print(insn->op[0], stdout);
-                printf("': ");
-                ILOCInsn_print(insn, stdout);
-                printf("\n");
-                exit(EXIT_FAILURE);
+                ILOCMachine_fault(machine, FAULT_INVALID_INSN, "Invalid parameter '%s': %s",
+                        operand_text(insn->op[0], op_text), insn_text(insn, text));
             }
             break;
 
         default:
-            printf("Unrecognized instruction: ");
-            ILOCInsn_print(insn, stdout);
-            printf("\n");
-            exit(EXIT_FAILURE);
+            ILOCMachine_fault(machine, FAULT_INVALID_INSN, "Unrecognized instruction: %s",
+                    insn_text(insn, text));
     }
 }
 
@@ -929,59 +1450,740 @@ void assert_valid_insn (ILOCInsn* insn)
 
 #define SET_REG(OP,VAL)   ILOCMachine_set_reg(machine, (OP), (VAL))
 #define GET_REG(OP)       ILOCMachine_get_reg(machine, (OP))
-#define SET_MEM(ADDR,VAL) ILOCMachine_set_mem(machine, (ADDR), (VAL))
-#define GET_MEM(ADDR)     ILOCMachine_get_mem(machine, (ADDR))
+#define SET_MEM(ADDR,VAL) ILOCMachine_store(machine, (ADDR), (VAL))
+#define GET_MEM(ADDR)     ILOCMachine_load(machine, (ADDR))
 
 #define PUSH(VAL)   machine->sp -= WORD_SIZE; \
-                    if (machine->sp <= STATIC_VAR_OFFSET) { \
-                        printf("ERROR: Stack overflow\n"); \
-                        exit(EXIT_FAILURE); \
+                    if (machine->sp <= machine->stack_limit) { \
+                        ILOCMachine_fault(machine, FAULT_STACK_OVERFLOW, "Stack overflow"); \
                     } \
-                    ILOCMachine_set_mem(machine, machine->sp, (VAL));
+                    ILOCMachine_store(machine, machine->sp, (VAL));
 
-#define POP(LOC)    if (machine->sp > MEM_SIZE - WORD_SIZE) { \
-                        printf("ERROR: Cannot pop from empty stack\n"); \
-                        exit(EXIT_FAILURE); \
+#define POP(LOC)    if (machine->sp > machine->mem_size - WORD_SIZE) { \
+                        ILOCMachine_fault(machine, FAULT_STACK_UNDERFLOW, "Cannot pop from empty stack"); \
                     } \
-                    *(LOC) = ILOCMachine_get_mem(machine, machine->sp); \
+                    *(LOC) = ILOCMachine_load(machine, machine->sp); \
                     machine->sp += WORD_SIZE;
 
-#define TIMEOUT_NUM_INSTRUCTIONS 100000000
+void timeout (ILOCMachine* machine)
+{
+    ILOCMachine_fault(machine, FAULT_TIMEOUT,
+            "Program executed too many instructions (probably an infinite loop)");
+}
 
-long run_simulator (InsnList* program, bool print_trace)
+int ILOCMachine_step (ILOCMachine* machine)
 {
-    /* initialize machine */
-    ILOCMachine* machine = ILOCMachine_new();
-    machine->sp = MEM_SIZE;
+    /* assumes no jumps; may be overwritten later */
+    int next_insn = machine->pc_index + 1;
 
-    /* build jump and call target indices */
-    int i = 0;
-    FOR_EACH (ILOCInsn*, insn, program) {
-        machine->instructions[i++] = insn;
-        if (insn->form == LABEL) {
-            if (insn->op[0].type == JUMP_LABEL) {
-                machine->jump_targets[insn->op[0].id] = insn;
+    /* verify that current instruction is valid */
+    assert_valid_insn(machine, machine->pc);
+
+    /* handle current instruction */
+    switch (machine->pc->form)
+    {
+        case LOAD_I:   SET_REG(OP1, IMMOP0);                               break;
+        case LOAD:     SET_REG(OP1, GET_MEM(GET_REG(OP0)));                break;
+        case LOAD_AI:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + IMMOP1));       break;
+        case LOAD_AO:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + GET_REG(OP1))); break;
+        case STORE:    SET_MEM(GET_REG(OP1),                GET_REG(OP0)); break;
+        case STORE_AI: SET_MEM(GET_REG(OP1) + IMMOP2,       GET_REG(OP0)); break;
+        case STORE_AO: SET_MEM(GET_REG(OP1) + GET_REG(OP2), GET_REG(OP0)); break;
+
+        case ADD:    SET_REG(OP2, GET_REG(OP0) +  GET_REG(OP1)); break;
+        case SUB:    SET_REG(OP2, GET_REG(OP0) -  GET_REG(OP1)); break;
+        case MULT:   SET_REG(OP2, GET_REG(OP0) *  GET_REG(OP1)); break;
+        case DIV:    SET_REG(OP2, ILOCMachine_divide(machine, GET_REG(OP0), GET_REG(OP1))); break;
+        case AND:    SET_REG(OP2, GET_REG(OP0) &  GET_REG(OP1)); break;
+        case OR:     SET_REG(OP2, GET_REG(OP0) |  GET_REG(OP1)); break;
+        case CMP_LT: SET_REG(OP2, GET_REG(OP0) <  GET_REG(OP1)); break;
+        case CMP_LE: SET_REG(OP2, GET_REG(OP0) <= GET_REG(OP1)); break;
+        case CMP_EQ: SET_REG(OP2, GET_REG(OP0) == GET_REG(OP1)); break;
+        case CMP_NE: SET_REG(OP2, GET_REG(OP0) != GET_REG(OP1)); break;
+        case CMP_GE: SET_REG(OP2, GET_REG(OP0) >= GET_REG(OP1)); break;
+        case CMP_GT: SET_REG(OP2, GET_REG(OP0) >  GET_REG(OP1)); break;
+
+        case ADD_I:  SET_REG(OP2, GET_REG(OP0) + IMMOP1); break;
+        case MULT_I: SET_REG(OP2, GET_REG(OP0) * IMMOP1); break;
+
+        case I2I:    SET_REG(OP1,    GET_REG(OP0) );    break;
+        case NOT:    SET_REG(OP1, ((~GET_REG(OP0))&1)); break;
+        case NEG:    SET_REG(OP1,  -(GET_REG(OP0)));    break;
+
+        case PUSH:
+            PUSH(GET_REG(OP0));
+            break;
+
+        case POP:
+        {
+            word_t tmp;
+            POP(&tmp);
+            SET_REG(OP0, tmp);
+            break;
+        }
+
+        case JUMP:
+            next_insn = ILOCMachine_jump_target(machine, OP0) + 1;
+            break;
+
+        case CBR:
+            if ((bool)GET_REG(OP0)) {
+                next_insn = ILOCMachine_jump_target(machine, OP1) + 1;
             } else {
-                CallTargetList_add_new(machine->call_targets, insn->op[0].str, insn);
+                next_insn = ILOCMachine_jump_target(machine, OP2) + 1;
+            }
+            break;
+
+        case CALL:
+        {
+            CallTarget* target = machine->call_links[machine->pc_index];
+            if (target == NULL) {
+                target = ILOCMachine_call_target(machine, STROP0);
             }
+            PUSH((word_t)next_insn);
+            ILOCMachine_push_window(machine, target->num_virtual_regs);
+            next_insn = target->index + 1;
+            break;
         }
-        if (i == MAX_INSTRUCTIONS) {
-            printf("Exceeds maximum instruction count (%d) of the simulator\n", MAX_INSTRUCTIONS);
-            exit(EXIT_FAILURE);
+
+        case RETURN:
+        {
+            if (machine->sp == machine->mem_size) {
+                /* stack is empty, so this must be the return from main() */
+                next_insn = machine->num_instructions;
+                break;
+            }
+            word_t tmp;
+            POP(&tmp);
+            ILOCMachine_pop_window(machine);
+            if (tmp < 0 || tmp > machine->num_instructions) {
+                ILOCMachine_fault(machine, FAULT_INVALID_RETURN, "Invalid return address " PRIW, tmp);
+            }
+            next_insn = (int)tmp;
+            break;
         }
+
+        case PRINT:
+            if (OP0.type == STR_CONST) {
+                OutputSink_write(machine->output, STROP0, strlen(STROP0));
+            } else {  /* virtual register */
+                OutputSink_write_int(machine->output, GET_REG(OP0));
+            }
+            break;
+
+        case LABEL:
+        case NOP:
+        case PHI:
+            /* nothing to do */
+            break;
     }
+    return next_insn;
+}
 
-    /* search for main and begin there */
-    machine->pc = CallTargetList_find(machine->call_targets, "main")->next;
 
-    /* main program loop */
-    int num_instructions_executed = 0;
-    while (machine->pc != NULL) {
+/*
+ * Pre-decoded ILOC interpreter
+ *
+ * Untraced runs translate the program once into a flat array of decoded ops
+ * (one per instruction, in program order) with register slots, immediates,
+ * and branch/call targets already resolved, and then run them with threaded
+ * (computed-goto) dispatch. Anything the decoder cannot handle safely (e.g.,
+ * invalid instructions or out-of-range registers) becomes a CHECKED op that
+ * runs the original instruction through ILOCMachine_step when (and only if)
+ * it is executed, so diagnostics are the same as in the traced simulator.
+ */
+
+/**
+ * @brief Superinstruction for each pair of ILOC forms (zero if not fused)
+ */
+static const unsigned char fused_ops[PHI+1][PHI+1] = {
+#define FUSED_ENTRY(A,B)    [A][B] = OP_##A##_##B,
+    FUSED_PAIRS(FUSED_ENTRY)
+#undef FUSED_ENTRY
+};
+
+/**
+ * @brief Look up the superinstruction for a pair of adjacent decoded ops
+ * 
+ * @returns Fused op code (or -1 if the pair is not fused)
+ */
+int fused_opcode (int first, int second)
+{
+    if (first > PHI || second > PHI || fused_ops[first][second] == 0) {
+        return -1;
+    }
+    return fused_ops[first][second];
+}
+
+/**
+ * @brief Check an instruction's operands without reporting errors
+ * 
+ * Mirrors @ref assert_valid_insn; instructions that fail this check are
+ * decoded as @c OP_CHECKED so the error is reported when they execute.
+ */
+bool is_valid_insn (ILOCInsn* insn)
+{
+    static const char* patterns[] = {
+        [ADD] = "rrr", [SUB] = "rrr", [MULT] = "rrr", [DIV] = "rrr",
+        [AND] = "rrr", [OR] = "rrr", [CMP_LT] = "rrr", [CMP_LE] = "rrr",
+        [CMP_EQ] = "rrr", [CMP_GE] = "rrr", [CMP_GT] = "rrr", [CMP_NE] = "rrr",
+        [LOAD_AO] = "rrr", [STORE_AO] = "rrr", [PHI] = "rrr",
+        [I2I] = "rr", [NOT] = "rr", [NEG] = "rr", [LOAD] = "rr", [STORE] = "rr",
+        [LOAD_I] = "ir", [ADD_I] = "rir", [MULT_I] = "rir", [LOAD_AI] = "rir",
+        [STORE_AI] = "rri", [PUSH] = "r", [POP] = "r", [CALL] = "c", [JUMP] = "j",
+        [CBR] = "rjj", [LABEL] = "l", [PRINT] = "p", [RETURN] = "", [NOP] = ""
+    };
+    if (insn->form < ADD || insn->form > PHI || patterns[insn->form] == NULL) {
+        return false;
+    }
+    const char* pattern = patterns[insn->form];
+    for (int i = 0; i < 3; i++) {
+        OperandType type = insn->op[i].type;
+        bool is_reg = (type == STACK_REG || type == BASE_REG || type == RETURN_REG ||
+                       type == VIRTUAL_REG || type == PHYSICAL_REG);
+        bool ok;
+        switch (i < (int)strlen(pattern) ? pattern[i] : '\0') {
+            case 'r':  ok = is_reg;                                         break;
+            case 'i':  ok = (type == INT_CONST);                            break;
+            case 'c':  ok = (type == CALL_LABEL);                           break;
+            case 'j':  ok = (type == JUMP_LABEL);                           break;
+            case 'l':  ok = (type == CALL_LABEL || type == JUMP_LABEL);     break;
+            case 'p':  ok = (is_reg || type == INT_CONST || type == STR_CONST); break;
+            default:   ok = (type == EMPTY);                                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Decode a register operand
+ * 
+ * @returns False if the register cannot be accessed directly (the
+ * instruction must then be executed with full checking)
+ */
+bool decode_reg (Operand op, int window_size, DecodedReg* reg)
+{
+    reg->bank = 0;
+    reg->checked = false;
+    switch (op.type) {
+        case STACK_REG:  reg->index = FIXED_SP;  return true;
+        case BASE_REG:   reg->index = FIXED_BP;  return true;
+        case RETURN_REG: reg->index = FIXED_RET; return true;
+        case PHYSICAL_REG:
+            reg->index = FIXED_PR + op.id;
+            reg->checked = true;
+            return op.id >= 0 && op.id < MAX_PHYSICAL_REGS;
+        case VIRTUAL_REG:
+            reg->bank = 1;
+            reg->index = op.id;
+            reg->checked = true;
+            return op.id >= 0 && op.id < window_size;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Report why an instruction could not be decoded (as a fault)
+ * 
+ * The fast mode validates the whole program before running it; the messages
+ * are the ones the checked simulator prints if it executes the instruction.
+ */
+void report_undecodable_insn (ILOCMachine* machine, ILOCInsn* insn, int window_size)
+{
+    assert_valid_insn(machine, insn);
+    for (int j = 0; j < 3; j++) {
+        Operand op = insn->op[j];
+        if (op.type == VIRTUAL_REG && (op.id < 0 || op.id >= window_size)) {
+            ILOCMachine_fault(machine, FAULT_INVALID_REGISTER, "Register r%d does not exist", op.id);
+        } else if (op.type == PHYSICAL_REG && (op.id < 0 || op.id >= MAX_PHYSICAL_REGS)) {
+            ILOCMachine_fault(machine, FAULT_INVALID_REGISTER, "Register R%d does not exist", op.id);
+        } else if (op.type == JUMP_LABEL && insn->form != LABEL) {
+            ILOCMachine_jump_target(machine, op);
+        }
+    }
+    if (insn->form == CALL) {
+        ILOCMachine_call_target(machine, insn->op[0].str);
+    }
+    if (insn->form == PRINT && insn->op[0].type == INT_CONST) {
+        ILOCMachine_get_reg(machine, insn->op[0]);
+    }
+}
+
+/**
+ * @brief Translate a linked program into a flat array of decoded ops
+ * 
+ * In checked mode, instructions that cannot be decoded are deferred to the
+ * checked simulator (and reported only if executed); in fast mode they are
+ * reported immediately and no register reads are checked.
+ * 
+ * @param machine Machine after @ref ILOCMachine_link
+ * @param mode Execution mode
+ * @returns Newly-allocated array with one op per instruction plus a final op
+ * that halts
+ */
+DecodedOp* decode_program (ILOCMachine* machine, SimulatorMode mode)
+{
+    int num_insns = machine->num_instructions;
+    DecodedOp* ops = (DecodedOp*)calloc(num_insns + 1, sizeof(DecodedOp));
+    CHECK_MALLOC_PTR(ops);
+
+    int window_size = 0;
+    for (int i = 0; i < num_insns; i++) {
+        ILOCInsn* insn = machine->instructions[i];
+        DecodedOp* op = &ops[i];
+        op->insn = insn;
+        op->opcode = insn->form;
+        if (insn->form == LABEL && insn->op[0].type == CALL_LABEL) {
+            window_size = CallTargetList_find_quiet(machine->call_targets, insn->op[0].str)->num_virtual_regs;
+        }
+        if (!is_valid_insn(insn)) {
+            if (mode == SIM_FAST) {
+                report_undecodable_insn(machine, insn, window_size);
+            }
+            op->opcode = OP_CHECKED;
+            continue;
+        }
+
+        bool ok = true;
+        for (int j = 0; j < 3; j++) {
+            OperandType type = insn->op[j].type;
+            if (type == INT_CONST) {
+                op->imm = (word_t)insn->op[j].imm;
+            } else if (type == STACK_REG || type == BASE_REG || type == RETURN_REG ||
+                       type == VIRTUAL_REG || type == PHYSICAL_REG) {
+                ok = ok && decode_reg(insn->op[j], window_size, &op->reg[j]);
+                op->reg[j].checked = op->reg[j].checked && (mode == SIM_CHECKED);
+            } else if (type == JUMP_LABEL && insn->form != LABEL) {
+                int id = insn->op[j].id;
+                bool found = (id >= 0 && id < machine->num_jump_targets && machine->jump_targets[id] >= 0);
+                ok = ok && found;
+                op->target[j == 2 ? 1 : 0] = (found ? machine->jump_targets[id] + 1 : 0);
+            }
+        }
+        if (insn->form == CALL) {
+            CallTarget* target = machine->call_links[i];
+            ok = (target != NULL);
+            if (ok) {
+                op->target[0] = target->index + 1;
+                op->window = target->num_virtual_regs;
+            }
+        }
+        if (insn->form == PRINT) {
+            if (insn->op[0].type == STR_CONST) {
+                op->opcode = OP_PRINT_STR;
+                op->imm = (word_t)strlen(insn->op[0].str);
+            } else if (insn->op[0].type == INT_CONST) {
+                ok = false;     /* reported as a non-register read */
+            }
+        }
+        if (insn->form == LABEL || insn->form == PHI) {
+            op->opcode = NOP;
+        }
+        if (!ok) {
+            if (mode == SIM_FAST) {
+                report_undecodable_insn(machine, insn, window_size);
+            }
+            op->opcode = OP_CHECKED;
+        }
+    }
+    ops[num_insns].opcode = OP_HALT;
+
+    /* fuse frequent pairs; the second op keeps its own decoding, so jumps to
+     * it (and faults in it) still work */
+    for (int i = 0; i + 1 < num_insns; i++) {
+        int fused = fused_opcode(ops[i].opcode, ops[i+1].opcode);
+        if (fused >= 0) {
+            ops[i].opcode = fused;
+        }
+    }
+    return ops;
+}
+
+/**
+ * @brief Read a decoded register operand (warning about uninitialized values)
+ */
+static inline word_t decoded_read (word_t** banks, DecodedReg* reg)
+{
+    word_t value = banks[reg->bank][reg->index];
+    if (value == UNINIT_REG && reg->checked) {
+        if (reg->bank == 1) {
+            printf("WARNING: Potential uninitialized read from register r%d\n", reg->index);
+        } else {
+            printf("WARNING: Potential uninitialized read from register R%d\n", reg->index - FIXED_PR);
+        }
+    }
+    return value;
+}
+
+/*
+ * Memory fault handling (fast mode)
+ *
+ * Fast-mode loads and stores access the address space directly. An access
+ * outside of it lands in a guard region, and the SIGSEGV handler jumps back
+ * to the interpreter, which re-executes the faulting instruction with full
+ * checking to report the error.
+ */
+
+/**
+ * @brief Recovery point of the fast interpreter on this thread (NULL if not running)
+ */
+static _Thread_local sigjmp_buf* fault_recovery = NULL;
+
+/**
+ * @brief Guarded region (address space plus guards) of the machine on this thread
+ */
+static _Thread_local byte_t* fault_region_start = NULL;
+static _Thread_local byte_t* fault_region_end = NULL;
+
+/**
+ * @brief SIGSEGV action that was installed before ours
+ */
+static struct sigaction previous_fault_action;
+
+/**
+ * @brief Is @ref handle_memory_fault the current SIGSEGV action?
+ */
+static volatile sig_atomic_t fault_handler_installed = 0;
+
+/**
+ * @brief Serializes installation of the SIGSEGV action by concurrent runs
+ */
+static pthread_mutex_t fault_handler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void handle_memory_fault (int signal, siginfo_t* info, void* context)
+{
+    byte_t* address = (byte_t*)info->si_addr;
+    if (fault_recovery != NULL && address >= fault_region_start && address < fault_region_end) {
+        siglongjmp(*fault_recovery, 1);
+    }
+
+    /* not a simulated access; restore the previous action and let the
+     * faulting instruction re-execute under it */
+    sigaction(SIGSEGV, &previous_fault_action, NULL);
+    fault_handler_installed = 0;
+}
+
+void install_memory_fault_handler (void)
+{
+    if (fault_handler_installed) {
+        return;
+    }
+    pthread_mutex_lock(&fault_handler_lock);
+    if (!fault_handler_installed) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = handle_memory_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_fault_action);
+        fault_handler_installed = 1;
+    }
+    pthread_mutex_unlock(&fault_handler_lock);
+}
+
+/*
+ * Computed-goto dispatch is a GNU extension; other compilers (or builds with
+ * ILOC_SWITCH_DISPATCH defined) use an equivalent switch-based loop.
+ */
+#if defined(__GNUC__) && !defined(ILOC_SWITCH_DISPATCH)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+#define DREG(I)       (op->reg[I].checked ? decoded_read(banks, &op->reg[I]) \
+                                          : banks[op->reg[I].bank][op->reg[I].index])
+
+/* fast mode accesses memory directly (any 32-bit address lands inside the
+ * address space or a guard region); wider addresses and checked mode go
+ * through the regular accessors */
+#define FAST_MEM(ADDR)    (*(word_t*)(mem + (int32_t)(ADDR)))
+#define FAST_ADDR(ADDR)   (fast && (ADDR) == (int32_t)(ADDR))
+#define DLOAD(ADDR)       (FAST_ADDR(ADDR) ? FAST_MEM(ADDR) : ILOCMachine_get_mem(machine, (ADDR)))
+#define DSTORE(ADDR,VAL)  if (FAST_ADDR(ADDR)) { FAST_MEM(ADDR) = (VAL); } \
+                          else { ILOCMachine_set_mem(machine, (ADDR), (VAL)); }
+
+/* the stack limit is inside the address space (not at a page boundary), so
+ * overflow is still checked explicitly; underflow hits the upper guard */
+#define DPUSH(VAL)        if (FAST_ADDR(machine->sp) && machine->sp - WORD_SIZE > machine->stack_limit) { \
+                              machine->sp -= WORD_SIZE; \
+                              FAST_MEM(machine->sp) = (VAL); \
+                          } else { PUSH(VAL); }
+#define DPOP(LOC)         if (FAST_ADDR(machine->sp)) { \
+                              *(LOC) = FAST_MEM(machine->sp); machine->sp += WORD_SIZE; \
+                          } else { POP(LOC); }
+#define DSET(I,VAL)   banks[op->reg[I].bank][op->reg[I].index] = (VAL)
+#define DWINDOW()     banks[1] = machine->reg_file + machine->windows[machine->num_windows - 1].base
+
+#if USE_COMPUTED_GOTO
+#define CASE(OPC)     op_##OPC
+#define DISPATCH()    goto *dispatch[op->opcode]
+#else
+#define CASE(OPC)     case OPC
+#define DISPATCH()    continue
+#endif
+
+/* handler bodies (shared by single ops and superinstructions) */
+#define DO_LOAD_I     DSET(1, op->imm)
+#define DO_LOAD       addr = DREG(0);            DSET(1, DLOAD(addr))
+#define DO_LOAD_AI    addr = DREG(0) + op->imm;  DSET(2, DLOAD(addr))
+#define DO_LOAD_AO    addr = DREG(0) + DREG(1);  DSET(2, DLOAD(addr))
+#define DO_STORE      addr = DREG(1);            DSTORE(addr, DREG(0))
+#define DO_STORE_AI   addr = DREG(1) + op->imm;  DSTORE(addr, DREG(0))
+#define DO_STORE_AO   addr = DREG(1) + DREG(2);  DSTORE(addr, DREG(0))
+#define DO_ADD        DSET(2, DREG(0) +  DREG(1))
+#define DO_SUB        DSET(2, DREG(0) -  DREG(1))
+#define DO_MULT       DSET(2, DREG(0) *  DREG(1))
+#define DO_DIV        DSET(2, ILOCMachine_divide(machine, DREG(0), DREG(1)))
+#define DO_AND        DSET(2, DREG(0) &  DREG(1))
+#define DO_OR         DSET(2, DREG(0) |  DREG(1))
+#define DO_CMP_LT     DSET(2, DREG(0) <  DREG(1))
+#define DO_CMP_LE     DSET(2, DREG(0) <= DREG(1))
+#define DO_CMP_EQ     DSET(2, DREG(0) == DREG(1))
+#define DO_CMP_NE     DSET(2, DREG(0) != DREG(1))
+#define DO_CMP_GE     DSET(2, DREG(0) >= DREG(1))
+#define DO_CMP_GT     DSET(2, DREG(0) >  DREG(1))
+#define DO_ADD_I      DSET(2, DREG(0) + op->imm)
+#define DO_MULT_I     DSET(2, DREG(0) * op->imm)
+#define DO_I2I        DSET(1, DREG(0))
+#define DO_NOT        DSET(1, (~DREG(0)) & 1)
+#define DO_NEG        DSET(1, -DREG(0))
+#define DO_PUSH       value = DREG(0); DPUSH(value)
+#define DO_POP        DPOP(&value); DSET(0, value)
+#define DO_JUMP       GOTO(op->target[0])
+#define DO_CBR        if ((bool)DREG(0)) { GOTO(op->target[0]); } else { GOTO(op->target[1]); }
+
+/* advance to the next op (or jump to op index T) and dispatch it */
+#define NEXT()        op++; TICK(); DISPATCH()
+#define GOTO(T)       op = ops + (T); TICK(); DISPATCH()
+#define TICK()        if (++num_instructions_executed > max_steps) { timeout(machine); }
+
+void run_decoded (ILOCMachine* machine, DecodedOp* ops, int start, SimulatorMode mode)
+{
+    bool fast = (mode == SIM_FAST);
+    byte_t* mem = machine->mem;
+    word_t addr;
+    word_t value;
+    word_t* banks[2] = { machine->fixed_regs, NULL };
+    DWINDOW();
+    DecodedOp* volatile op = ops + start;     /* volatile: read after a fault */
+    long num_instructions_executed = machine->steps;
+    long max_steps = machine->max_steps;
+    machine->running_steps = &num_instructions_executed;
+
+    sigjmp_buf recovery;
+    if (fast) {
+        install_memory_fault_handler();
+        fault_region_start = machine->mem - MEM_RESERVED_BELOW;
+        fault_region_end = machine->mem + MEM_RESERVED_ABOVE;
+        if (sigsetjmp(recovery, 0) != 0) {
+            /* the signal mask was not saved (to keep runs cheap), so unblock
+             * SIGSEGV before re-executing the faulting instruction with full
+             * checking (which reports the fault) */
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, SIGSEGV);
+            sigprocmask(SIG_UNBLOCK, &signals, NULL);
+            fault_recovery = NULL;
+            machine->pc = op->insn;
+            machine->pc_index = (int)(op - ops);
+            ILOCMachine_step(machine);
+            char text[FAULT_TEXT_LEN];
+            ILOCMachine_fault(machine, FAULT_INVALID_ADDRESS, "Invalid memory access: %s",
+                    insn_text(op->insn, text));
+        }
+        fault_recovery = &recovery;
+    }
+
+#if USE_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+    static void* dispatch[NUM_DECODED_OPS] = {
+        [LOAD_I] = &&op_LOAD_I, [LOAD] = &&op_LOAD, [LOAD_AI] = &&op_LOAD_AI,
+        [LOAD_AO] = &&op_LOAD_AO, [STORE] = &&op_STORE, [STORE_AI] = &&op_STORE_AI,
+        [STORE_AO] = &&op_STORE_AO, [ADD] = &&op_ADD, [SUB] = &&op_SUB,
+        [MULT] = &&op_MULT, [DIV] = &&op_DIV, [AND] = &&op_AND, [OR] = &&op_OR,
+        [CMP_LT] = &&op_CMP_LT, [CMP_LE] = &&op_CMP_LE, [CMP_EQ] = &&op_CMP_EQ,
+        [CMP_NE] = &&op_CMP_NE, [CMP_GE] = &&op_CMP_GE, [CMP_GT] = &&op_CMP_GT,
+        [ADD_I] = &&op_ADD_I, [MULT_I] = &&op_MULT_I, [I2I] = &&op_I2I,
+        [NOT] = &&op_NOT, [NEG] = &&op_NEG, [PUSH] = &&op_PUSH, [POP] = &&op_POP,
+        [JUMP] = &&op_JUMP, [CBR] = &&op_CBR, [CALL] = &&op_CALL,
+        [RETURN] = &&op_RETURN, [PRINT] = &&op_PRINT, [NOP] = &&op_NOP,
+        [LABEL] = &&op_NOP, [PHI] = &&op_NOP, [OP_PRINT_STR] = &&op_OP_PRINT_STR,
+        [OP_CHECKED] = &&op_OP_CHECKED, [OP_HALT] = &&op_OP_HALT,
+#define FUSED_LABEL(A,B)    [OP_##A##_##B] = &&op_OP_##A##_##B,
+        FUSED_PAIRS(FUSED_LABEL)
+#undef FUSED_LABEL
+    };
+    DISPATCH();
+#else
+    while (true) switch (op->opcode) {
+#endif
+
+    CASE(LOAD_I):   DO_LOAD_I;      NEXT();
+    CASE(LOAD):     DO_LOAD;        NEXT();
+    CASE(LOAD_AI):  DO_LOAD_AI;     NEXT();
+    CASE(LOAD_AO):  DO_LOAD_AO;     NEXT();
+    CASE(STORE):    DO_STORE;       NEXT();
+    CASE(STORE_AI): DO_STORE_AI;    NEXT();
+    CASE(STORE_AO): DO_STORE_AO;    NEXT();
+
+    CASE(ADD):      DO_ADD;         NEXT();
+    CASE(SUB):      DO_SUB;         NEXT();
+    CASE(MULT):     DO_MULT;        NEXT();
+    CASE(DIV):      DO_DIV;         NEXT();
+    CASE(AND):      DO_AND;         NEXT();
+    CASE(OR):       DO_OR;          NEXT();
+    CASE(CMP_LT):   DO_CMP_LT;      NEXT();
+    CASE(CMP_LE):   DO_CMP_LE;      NEXT();
+    CASE(CMP_EQ):   DO_CMP_EQ;      NEXT();
+    CASE(CMP_NE):   DO_CMP_NE;      NEXT();
+    CASE(CMP_GE):   DO_CMP_GE;      NEXT();
+    CASE(CMP_GT):   DO_CMP_GT;      NEXT();
+
+    CASE(ADD_I):    DO_ADD_I;       NEXT();
+    CASE(MULT_I):   DO_MULT_I;      NEXT();
+
+    CASE(I2I):      DO_I2I;         NEXT();
+    CASE(NOT):      DO_NOT;         NEXT();
+    CASE(NEG):      DO_NEG;         NEXT();
+
+    CASE(PUSH):     DO_PUSH;        NEXT();
+    CASE(POP):      DO_POP;         NEXT();
+
+    CASE(JUMP):     DO_JUMP;
+    CASE(CBR):      DO_CBR;
+
+    /* superinstructions: the pointer advances to the second op before it
+     * executes, so a fault is attributed to the right instruction */
+#define FUSED_HANDLER(A,B)  CASE(OP_##A##_##B): DO_##A; op++; TICK(); DO_##B; NEXT();
+    FUSED_PAIRS(FUSED_HANDLER)
+#undef FUSED_HANDLER
+
+    CASE(CALL):
+        DPUSH((word_t)(op - ops + 1));
+        ILOCMachine_push_window(machine, op->window);
+        DWINDOW();
+        GOTO(op->target[0]);
+
+    CASE(RETURN):
+    {
+        if (machine->sp == machine->mem_size) {
+            /* stack is empty, so this must be the return from main() */
+            TICK();
+            goto done;
+        }
+        word_t tmp;
+        DPOP(&tmp);
+        ILOCMachine_pop_window(machine);
+        DWINDOW();
+        if (tmp < 0 || tmp > machine->num_instructions) {
+            ILOCMachine_fault(machine, FAULT_INVALID_RETURN, "Invalid return address " PRIW, tmp);
+        }
+        GOTO(tmp);
+    }
 
-        /* assumes no jumps; may be overwritten later */
-        ILOCInsn* next_insn = machine->pc->next;
+    CASE(PRINT):    OutputSink_write_int(machine->output, DREG(0));          NEXT();
+    CASE(OP_PRINT_STR):
+        OutputSink_write(machine->output, op->insn->op[0].str, op->imm);
+        NEXT();
+    CASE(NOP):                                                               NEXT();
+
+    CASE(OP_CHECKED):
+        /* only reached by instructions that report a fault in the checked
+         * simulator; anything else continues in sequence */
+        machine->pc = op->insn;
+        machine->pc_index = (int)(op - ops);
+        ILOCMachine_step(machine);
+        DWINDOW();
+        NEXT();
+
+    CASE(OP_HALT):
+        goto done;
+
+#if USE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#else
+        default:
+            goto done;
+    }
+#endif
+
+done:
+    fault_recovery = NULL;
+    machine->steps = num_instructions_executed;
+    machine->running_steps = NULL;
+}
+
+/*
+ * Stepped runs (tracing, profiling, and the memory and pipeline models)
+ */
 
-        /* print trace debug info if desired */
+/**
+ * @brief Write the header of a binary trace (see @ref TraceDeltaKind)
+ */
+void TraceWriter_header (TraceWriter* writer, ILOCMachine* machine)
+{
+    TraceWriter_bytes(writer, TRACE_MAGIC, strlen(TRACE_MAGIC));
+    TraceWriter_varint(writer, WORD_SIZE);
+    TraceWriter_signed(writer, UNINIT_REG);
+    TraceWriter_varint(writer, machine->mem_size);
+    TraceWriter_varint(writer, STATIC_VAR_OFFSET);
+    for (int i = 0; i < NUM_FIXED_REGS; i++) {
+        TraceWriter_signed(writer, machine->fixed_regs[i]);
+    }
+    TraceWriter_varint(writer, machine->windows[machine->num_windows - 1].size);
+
+    /* instruction listing (for the decoder's textual view and filters) */
+    TraceWriter_varint(writer, machine->num_instructions);
+    for (int i = 0; i < machine->num_instructions; i++) {
+        ILOCInsn* insn = machine->instructions[i];
+        char* text = NULL;
+        size_t length = 0;
+        FILE* stream = open_memstream(&text, &length);
+        CHECK_MALLOC_PTR(stream);
+        ILOCInsn_print(insn, stream);
+        fclose(stream);
+        TraceWriter_varint(writer, insn->form != LABEL ? 0 : (insn->op[0].type == JUMP_LABEL ? 1 : 2));
+        TraceWriter_varint(writer, length);
+        TraceWriter_bytes(writer, text, length);
+        free(text);
+    }
+}
+
+/**
+ * @brief Run a program one instruction at a time with full checking,
+ * optionally printing or writing a trace and collecting an execution profile
+ * 
+ * @param machine Machine with a linked program
+ * @param start Index of the first instruction to execute
+ * @param print_trace Print the machine state before each instruction
+ * @param trace_file Binary trace destination (or NULL)
+ * @param profile Profile to fill in (or NULL)
+ * @param pipeline Pipeline model to feed (or NULL)
+ */
+void run_stepped (ILOCMachine* machine, int start, bool print_trace, FILE* trace_file, ILOCProfile* profile,
+        PipelineModel* pipeline)
+{
+    /* the trace writer and call stack belong to the machine, so they are
+     * released (and the trace flushed) even if the program faults */
+    word_t fixed_regs[NUM_FIXED_REGS];
+    if (trace_file != NULL) {
+        machine->trace = TraceWriter_new(trace_file);
+        TraceWriter_header(machine->trace, machine);
+    }
+
+    if (profile != NULL) {
+        machine->calls = ProfileStack_new(profile, machine, start);
+    }
+
+    machine->pc_index = start;
+    machine->pc = machine->instructions[machine->pc_index];
+    while (machine->pc != NULL) {
         if (print_trace) {
             printf("\n");
             ILOCMachine_print(machine, stdout);
@@ -990,121 +2192,187 @@ long run_simulator (InsnList* program, bool print_trace)
             printf("\n");
         }
 
-        /* verify that current instruction is valid */
-        assert_valid_insn(machine->pc);
+        int index = machine->pc_index;
+        InsnForm form = machine->pc->form;
+        if (machine->trace != NULL) {
+            /* register and memory writes are recorded as they happen, but
+             * special and physical registers are compared afterwards */
+            TraceWriter_varint(machine->trace, index);
+            memcpy(fixed_regs, machine->fixed_regs, sizeof(fixed_regs));
+        }
+        machine->pc_index = ILOCMachine_step(machine);
+        machine->pc = machine->instructions[machine->pc_index];
+        if (machine->trace != NULL) {
+            for (int i = 0; i < NUM_FIXED_REGS; i++) {
+                if (machine->fixed_regs[i] != fixed_regs[i]) {
+                    TraceWriter_delta(machine->trace, TRACE_FIXED_REG, i, machine->fixed_regs[i]);
+                }
+            }
+            TraceWriter_event(machine->trace, TRACE_END, 0);
+        }
 
-        /* handle current instruction */
-        switch (machine->pc->form)
-        {
-            case LOAD_I:   SET_REG(OP1, IMMOP0);                               break;
-            case LOAD:     SET_REG(OP1, GET_MEM(GET_REG(OP0)));                break;
-            case LOAD_AI:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + IMMOP1));       break;
-            case LOAD_AO:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + GET_REG(OP1))); break;
-            case STORE:    SET_MEM(GET_REG(OP1),                GET_REG(OP0)); break;
-            case STORE_AI: SET_MEM(GET_REG(OP1) + IMMOP2,       GET_REG(OP0)); break;
-            case STORE_AO: SET_MEM(GET_REG(OP1) + GET_REG(OP2), GET_REG(OP0)); break;
-
-            case ADD:    SET_REG(OP2, GET_REG(OP0) +  GET_REG(OP1)); break;
-            case SUB:    SET_REG(OP2, GET_REG(OP0) -  GET_REG(OP1)); break;
-            case MULT:   SET_REG(OP2, GET_REG(OP0) *  GET_REG(OP1)); break;
-            case DIV:    SET_REG(OP2, GET_REG(OP0) /  GET_REG(OP1)); break;
-            case AND:    SET_REG(OP2, GET_REG(OP0) &  GET_REG(OP1)); break;
-            case OR:     SET_REG(OP2, GET_REG(OP0) |  GET_REG(OP1)); break;
-            case CMP_LT: SET_REG(OP2, GET_REG(OP0) <  GET_REG(OP1)); break;
-            case CMP_LE: SET_REG(OP2, GET_REG(OP0) <= GET_REG(OP1)); break;
-            case CMP_EQ: SET_REG(OP2, GET_REG(OP0) == GET_REG(OP1)); break;
-            case CMP_NE: SET_REG(OP2, GET_REG(OP0) != GET_REG(OP1)); break;
-            case CMP_GE: SET_REG(OP2, GET_REG(OP0) >= GET_REG(OP1)); break;
-            case CMP_GT: SET_REG(OP2, GET_REG(OP0) >  GET_REG(OP1)); break;
-
-            case ADD_I:  SET_REG(OP2, GET_REG(OP0) + IMMOP1); break;
-            case MULT_I: SET_REG(OP2, GET_REG(OP0) * IMMOP1); break;
-
-            case I2I:    SET_REG(OP1,    GET_REG(OP0) );    break;
-            case NOT:    SET_REG(OP1, ((~GET_REG(OP0))&1)); break;
-            case NEG:    SET_REG(OP1,  -(GET_REG(OP0)));    break;
-
-            case PUSH:
-                PUSH(GET_REG(OP0));
-                break;
+        if (profile != NULL) {
+            ProfileStack_step(machine->calls, profile, index, form, machine->pc_index);
+        }
 
-            case POP:
-            {
-                word_t tmp;
-                POP(&tmp);
-                SET_REG(OP0, tmp);
-                break;
-            }
+        if (pipeline != NULL) {
+            PipelineModel_issue(pipeline, machine->instructions[index]);
+        }
+        if (machine->memory != NULL && machine->mem_size - machine->sp > machine->memory->max_stack_depth) {
+            machine->memory->max_stack_depth = machine->mem_size - machine->sp;
+        }
 
-            case JUMP:
-                next_insn = machine->jump_targets[OP0.id]->next;
-                break;
+        /* check timeout */
+        machine->steps++;
+        if (machine->steps > machine->max_steps) {
+            timeout(machine);
+        }
+    }
 
-            case CBR:
-                if ((bool)GET_REG(OP0)) {
-                    next_insn = machine->jump_targets[OP1.id]->next;
-                } else {
-                    next_insn = machine->jump_targets[OP2.id]->next;
-                }
-                break;
+}
 
-            case CALL:
-            {
-                /* calculate index of next instruction */
-                int idx = 0;
-                for (next_insn = program->head;
-                     next_insn != NULL && next_insn != machine->pc->next;
-                     next_insn = next_insn->next) {
-                    idx++;
-                }
-                PUSH((word_t)idx);
-                next_insn = CallTargetList_find(machine->call_targets, STROP0)->next;
-                break;
+long run_simulator (InsnList* program, bool print_trace)
+{
+    SimulatorConfig config = { .mode = SIM_CHECKED, .print_trace = print_trace };
+    return run_simulator_with_config(program, &config);
+}
+
+long run_simulator_with_config (InsnList* program, SimulatorConfig* config)
+{
+    SimulatorResult result = simulate_program(program, config);
+    if (result.status == SIM_FAULT) {
+        if (result.fault == FAULT_TIMEOUT) {
+            fprintf(stderr, "TIMEOUT: %s", result.message);
+        } else {
+            printf("ERROR: %s\n", result.message);
+        }
+        exit(EXIT_FAILURE);
+    }
+    return result.return_value;
+}
+
+SimulatorResult simulate_program (InsnList* program, SimulatorConfig* config)
+{
+    /* memory size (rounded up to whole pages so that the guard regions start
+     * exactly at the end of the address space) */
+    long page_size = sysconf(_SC_PAGESIZE);
+    long mem_size = (config->mem_size > 0 ? config->mem_size : MEM_SIZE);
+    mem_size = (mem_size + page_size - 1) / page_size * page_size;
+    if (mem_size > MAX_MEM_SIZE || mem_size <= STATIC_VAR_OFFSET) {
+        SimulatorResult result = { .status = SIM_FAULT, .fault = FAULT_INVALID_CONFIG };
+        snprintf(result.message, MAX_FAULT_LEN, "Invalid memory size (%ld)", mem_size);
+        return result;
+    }
+    if (config->memory != NULL) {
+        for (int l = 0; l < config->memory->num_levels; l++) {
+            if (!CacheConfig_is_valid(&config->memory->levels[l].config)) {
+                SimulatorResult result = { .status = SIM_FAULT, .fault = FAULT_INVALID_CONFIG };
+                snprintf(result.message, MAX_FAULT_LEN, "Invalid L%d cache geometry", l + 1);
+                return result;
             }
+        }
+    }
 
-            case RETURN:
-            {
-                if (machine->sp == MEM_SIZE) {
-                    /* stack is empty, so this must be the return from main() */
-                    next_insn = NULL;
-                    break;
+    /* initialize machine */
+    ILOCMachine* machine = ILOCMachine_new(mem_size);
+    machine->sp = mem_size;
+    if (config->stack_size > 0 && mem_size - config->stack_size > machine->stack_limit) {
+        machine->stack_limit = mem_size - config->stack_size;
+    }
+    if (config->max_instructions_executed > 0) {
+        machine->max_steps = config->max_instructions_executed;
+    }
+
+    /* program output goes to standard output unless redirected */
+    OutputSink standard_output = { .stream = stdout };
+    machine->output = (config->output != NULL ? config->output : &standard_output);
+
+    /* faults jump back here (everything they need to clean up is reachable
+     * from the machine) */
+    if (setjmp(machine->fault_exit) == 0) {
+
+        /* assign instruction indices and resolve jump and call targets */
+        ILOCMachine_link(machine, program);
+
+        /* size the register file for a few levels of calls to the largest
+         * function unless requested otherwise (it grows on demand) */
+        int register_file_size = config->register_file_size;
+        if (register_file_size <= 0) {
+            FOR_EACH (CallTarget*, function, machine->call_targets) {
+                if (function->num_virtual_regs * 8 > register_file_size) {
+                    register_file_size = function->num_virtual_regs * 8;
                 }
-                word_t tmp;
-                POP(&tmp);
-                next_insn = machine->instructions[tmp];
-                break;
             }
+        }
+        ILOCMachine_reserve_registers(machine, register_file_size);
 
-            case PRINT:
-                if (OP0.type == STR_CONST) {
-                    printf("%s", STROP0);
-                } else {  /* virtual register */
-                    printf(PRIW, GET_REG(OP0));
-                }
-                break;
+        /* search for main and begin there */
+        CallTarget* main_target = ILOCMachine_call_target(machine, "main");
+        ILOCMachine_push_window(machine, main_target->num_virtual_regs);
 
-            case LABEL:
-            case NOP:
-            case PHI:
-                /* nothing to do */
-                break;
+        if (config->memory != NULL) {
+            MemoryHierarchy_init(config->memory, machine);
+            machine->memory = config->memory;
         }
 
-        /* update pc */
-        machine->pc = next_insn;
+        if (config->pipeline != NULL) {
+            PipelineModel_reset(config->pipeline);
+        }
 
-        /* check timeout */
-        num_instructions_executed++;
-        if (num_instructions_executed > TIMEOUT_NUM_INSTRUCTIONS) {
-            fprintf(stderr, "TIMEOUT: Program executed too many instructions (probably an infinite loop)");
-            exit(EXIT_FAILURE);
+        if (config->print_trace || config->trace_file != NULL || config->profile != NULL ||
+                config->memory != NULL || config->pipeline != NULL) {
+
+            /* checked program loop */
+            run_stepped(machine, main_target->index + 1, config->print_trace,
+                    config->trace_file, config->profile, config->pipeline);
+
+        } else if (config->mode == SIM_JIT) {
+
+            /* validate and decode as in fast mode, then run as native code */
+            machine->ops = decode_program(machine, SIM_FAST);
+            run_jit(machine, machine->ops, main_target->index + 1);
+
+        } else {
+
+            /* decode once, then run the threaded interpreter */
+            machine->ops = decode_program(machine, config->mode);
+            run_decoded(machine, machine->ops, main_target->index + 1, config->mode);
         }
+        machine->result.return_value = (long)machine->ret;
     }
+    machine->result.instructions_executed = machine->steps;
 
-    /* clean up */
-    word_t return_value = machine->ret;
-    CallTargetList_free(machine->call_targets);
-    free(machine);
+    /* clean up (the fast interpreter may have been interrupted) */
+    fault_recovery = NULL;
+    if (machine->trace != NULL) {
+        TraceWriter_free(machine->trace);
+    }
+    if (machine->calls != NULL) {
+        ProfileStack_finish(machine->calls, config->profile);
+    }
+    free(machine->ops);
+    JitCode_free(machine->jit);
+    SimulatorResult result = machine->result;
+    ILOCMachine_free(machine);
 
-    return (long)return_value;
+    return result;
 }
+
+const char* SimulatorFault_name (SimulatorFault fault)
+{
+    static const char* names[] = {
+        [FAULT_NONE]             = "none",
+        [FAULT_INVALID_INSN]     = "invalid_insn",
+        [FAULT_INVALID_REGISTER] = "invalid_register",
+        [FAULT_INVALID_ADDRESS]  = "invalid_address",
+        [FAULT_STACK_OVERFLOW]   = "stack_overflow",
+        [FAULT_STACK_UNDERFLOW]  = "stack_underflow",
+        [FAULT_UNDEFINED_LABEL]  = "undefined_label",
+        [FAULT_INVALID_RETURN]   = "invalid_return",
+        [FAULT_INVALID_DIVISION] = "invalid_division",
+        [FAULT_TIMEOUT]          = "timeout",
+        [FAULT_INVALID_CONFIG]   = "invalid_config"
+    };
+    return names[fault];
+}
+
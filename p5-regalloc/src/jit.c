@@ -0,0 +1,837 @@
+#define _DEFAULT_SOURCE     /* mmap() flags */
+
+#include "jit.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+/*
+ * Native code generation (JIT mode)
+ *
+ * The JIT mode translates the decoded program into x86-64 machine code in an
+ * mmap'd buffer (written first, then made executable). SP, BP, RET, and the
+ * first physical registers live in host registers; the other physical
+ * registers stay in ILOCMachine.fixed_regs, and loads and stores index the
+ * address space directly after an explicit range check. PRINT calls back
+ * into the output sink.
+ *
+ * Compiled code can be entered at "leaders" (branch and call targets, return
+ * points, and instructions after a branch or an unsupported instruction).
+ * Each leader adds its block's length to the instruction counter up front,
+ * or exits first if that would exceed the limit. Anything else the compiled
+ * code cannot do (an instruction it does not support, a failed range or
+ * stack check, a return to a non-leader, the last few instructions before a
+ * timeout) exits back to run_jit with the instruction counter adjusted to
+ * the instruction that could not run, and the interpreter executes that
+ * instruction with full checking, so faults are reported exactly as in the
+ * other modes.
+ *
+ * Only x86-64 Linux hosts get native code (define ILOC_NO_JIT to disable it
+ * there as well); elsewhere JIT mode runs the fast interpreter.
+ */
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(ILOC_NO_JIT)
+#define USE_JIT 1
+#else
+#define USE_JIT 0
+#endif
+
+/**
+ * @brief x86-64 register numbers (as encoded in instructions)
+ */
+enum {
+    X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8,  X86_R9,  X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15
+};
+
+/* register conventions of compiled code: RAX, RCX, and RDX are scratch, RBP
+ * points to the machine, R14 holds the instruction counter, and R15 holds
+ * the address space base */
+#define JIT_SP          X86_R13
+#define JIT_BP          X86_R12
+#define JIT_RET         X86_RBX
+#define JIT_MACHINE     X86_RBP
+#define JIT_STEPS       X86_R14
+#define JIT_MEM         X86_R15
+
+/**
+ * @brief Number of physical registers kept in host registers
+ */
+#define JIT_HOST_PRS    6
+
+/**
+ * @brief Host registers of the first physical registers (all caller-saved,
+ * so they are saved around calls into C)
+ */
+static const int jit_pr_hosts[JIT_HOST_PRS] = { X86_R8, X86_R9, X86_R10, X86_R11, X86_RSI, X86_RDI };
+
+/**
+ * @brief Upper bound on the code emitted for one instruction (including its
+ * block prologue and out-of-line exits)
+ */
+#define JIT_MAX_INSN_BYTES 256
+
+/**
+ * @brief Kind of a branch that is patched once all code has been emitted
+ */
+typedef enum JitFixupKind
+{
+    JIT_TO_INSN,    /**< @brief Branch to the entry of an instruction index */
+    JIT_TO_EXIT     /**< @brief Branch to an exit back to the interpreter */
+} JitFixupKind;
+
+/**
+ * @brief Branch displacement to patch
+ */
+typedef struct JitFixup
+{
+    size_t offset;      /**< @brief Location of the 32-bit displacement */
+    JitFixupKind kind;  /**< @brief What the branch goes to */
+    int index;          /**< @brief Target instruction index (or the one that exits) */
+    int adjust;         /**< @brief Instructions to take back off the counter when exiting */
+} JitFixup;
+
+/**
+ * @brief Signature of compiled code: run from a native entry address until
+ * something needs the interpreter
+ * 
+ * @returns Index of the instruction for the interpreter (the instruction
+ * count when the program has finished)
+ */
+typedef int (*JitEntry)(ILOCMachine* machine, void* entry);
+
+struct JitCode
+{
+    byte_t* code;           /**< @brief Code buffer (mmap'd) */
+    size_t capacity;        /**< @brief Size of @ref code in bytes */
+    size_t length;          /**< @brief Number of bytes emitted */
+    size_t exit;            /**< @brief Offset of the shared exit sequence */
+    size_t* offsets;        /**< @brief Offset of each instruction's entry (one per index, plus the end) */
+    void** entries;         /**< @brief Native entry of each instruction index (used by RETURN) */
+    bool* leaders;          /**< @brief Can compiled code be entered at each instruction index? */
+    JitFixup* fixups;       /**< @brief Branches to patch */
+    int num_fixups;         /**< @brief Number of entries in @ref fixups */
+    int max_fixups;         /**< @brief Number of entries allocated in @ref fixups */
+    JitEntry run;           /**< @brief Compiled code (valid once finished) */
+};
+
+void JitCode_free (JitCode* jit)
+{
+    if (jit == NULL) {
+        return;
+    }
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->capacity);
+    }
+    free(jit->offsets);
+    free(jit->entries);
+    free(jit->leaders);
+    free(jit->fixups);
+    free(jit);
+}
+
+#if USE_JIT
+
+void jit_byte (JitCode* jit, int byte)
+{
+    jit->code[jit->length++] = (byte_t)byte;
+}
+
+void jit_int32 (JitCode* jit, int32_t value)
+{
+    memcpy(jit->code + jit->length, &value, sizeof(value));
+    jit->length += sizeof(value);
+}
+
+void jit_int64 (JitCode* jit, int64_t value)
+{
+    memcpy(jit->code + jit->length, &value, sizeof(value));
+    jit->length += sizeof(value);
+}
+
+/**
+ * @brief Emit a one- or two-byte opcode (0x0Fxx for two bytes)
+ */
+void jit_opcode (JitCode* jit, int opcode)
+{
+    if (opcode > 0xFF) {
+        jit_byte(jit, opcode >> 8);
+    }
+    jit_byte(jit, opcode & 0xFF);
+}
+
+/**
+ * @brief Emit a REX prefix for a 64-bit operation
+ */
+void jit_rex (JitCode* jit, int reg, int index, int base)
+{
+    jit_byte(jit, 0x48 | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3));
+}
+
+/**
+ * @brief Emit a 64-bit instruction with two register operands (ModRM reg and rm)
+ */
+void jit_rr (JitCode* jit, int opcode, int reg, int rm)
+{
+    jit_rex(jit, reg, 0, rm);
+    jit_opcode(jit, opcode);
+    jit_byte(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/**
+ * @brief Emit a 64-bit instruction with a register and a [base + disp32] operand
+ */
+void jit_rm (JitCode* jit, int opcode, int reg, int base, int32_t disp)
+{
+    jit_rex(jit, reg, 0, base);
+    jit_opcode(jit, opcode);
+    jit_byte(jit, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == X86_RSP) {
+        jit_byte(jit, 0x24);
+    }
+    jit_int32(jit, disp);
+}
+
+/**
+ * @brief Emit a 64-bit instruction with a register and an address space
+ * operand ([R15 + index])
+ */
+void jit_mem (JitCode* jit, int opcode, int reg, int index)
+{
+    jit_rex(jit, reg, index, JIT_MEM);
+    jit_opcode(jit, opcode);
+    jit_byte(jit, 0x04 | (reg & 7) << 3);
+    jit_byte(jit, (index & 7) << 3 | (JIT_MEM & 7));
+}
+
+/**
+ * @brief Emit a group-1 ALU operation with a 32-bit immediate (e.g., ext 0
+ * for add, 5 for sub, 7 for cmp)
+ */
+void jit_ri (JitCode* jit, int ext, int rm, int32_t imm)
+{
+    jit_rex(jit, 0, 0, rm);
+    jit_byte(jit, 0x81);
+    jit_byte(jit, 0xC0 | ext << 3 | (rm & 7));
+    jit_int32(jit, imm);
+}
+
+/**
+ * @brief Load a 64-bit constant into a register
+ */
+void jit_mov_imm (JitCode* jit, int reg, int64_t imm)
+{
+    if (imm == (int32_t)imm) {
+        jit_rex(jit, 0, 0, reg);
+        jit_byte(jit, 0xC7);
+        jit_byte(jit, 0xC0 | (reg & 7));
+        jit_int32(jit, (int32_t)imm);
+    } else {
+        jit_rex(jit, 0, 0, reg);
+        jit_byte(jit, 0xB8 | (reg & 7));
+        jit_int64(jit, imm);
+    }
+}
+
+void jit_push (JitCode* jit, int reg)
+{
+    if (reg & 8) {
+        jit_byte(jit, 0x41);
+    }
+    jit_byte(jit, 0x50 | (reg & 7));
+}
+
+void jit_pop (JitCode* jit, int reg)
+{
+    if (reg & 8) {
+        jit_byte(jit, 0x41);
+    }
+    jit_byte(jit, 0x58 | (reg & 7));
+}
+
+/**
+ * @brief Emit a jump (@c cc < 0) or conditional jump (x86 condition code
+ * @c cc) whose target is patched later
+ */
+void jit_branch (JitCode* jit, int cc, JitFixupKind kind, int index, int adjust)
+{
+    if (cc < 0) {
+        jit_byte(jit, 0xE9);
+    } else {
+        jit_byte(jit, 0x0F);
+        jit_byte(jit, 0x80 | cc);
+    }
+    if (jit->num_fixups == jit->max_fixups) {
+        jit->max_fixups = (jit->max_fixups > 0 ? jit->max_fixups * 2 : 256);
+        jit->fixups = (JitFixup*)realloc(jit->fixups, jit->max_fixups * sizeof(JitFixup));
+        CHECK_MALLOC_PTR(jit->fixups);
+    }
+    jit->fixups[jit->num_fixups++] = (JitFixup){ .offset = jit->length, .kind = kind,
+        .index = index, .adjust = adjust };
+    jit_int32(jit, 0);
+}
+
+void jit_patch (JitCode* jit, size_t offset, size_t target)
+{
+    int32_t displacement = (int32_t)((long)target - (long)(offset + 4));
+    memcpy(jit->code + offset, &displacement, sizeof(displacement));
+}
+
+/**
+ * @brief Emit a return to the interpreter at instruction @c index
+ */
+void jit_exit (JitCode* jit, int index)
+{
+    jit_byte(jit, 0xB8);                            /* mov eax, index */
+    jit_int32(jit, index);
+    jit_byte(jit, 0xE9);
+    jit_int32(jit, 0);
+    jit_patch(jit, jit->length - 4, jit->exit);
+}
+
+/* x86 condition codes */
+#define X86_CC_E    0x4
+#define X86_CC_NE   0x5
+#define X86_CC_BE   0x6
+#define X86_CC_A    0x7
+#define X86_CC_L    0xC
+#define X86_CC_GE   0xD
+#define X86_CC_LE   0xE
+#define X86_CC_G    0xF
+
+/* opcodes (reg, r/m forms) */
+#define X86_ADD     0x01
+#define X86_OR      0x09
+#define X86_AND     0x21
+#define X86_SUB     0x29
+#define X86_CMP     0x39
+#define X86_TEST    0x85
+#define X86_STORE   0x89    /* mov r/m, reg */
+#define X86_LOAD    0x8B    /* mov reg, r/m */
+#define X86_LEA     0x8D
+#define X86_IMUL    0x0FAF
+
+/**
+ * @brief Host register of a special or physical register (-1 if it is kept
+ * in the machine)
+ */
+int jit_host_reg (int fixed)
+{
+    switch (fixed) {
+        case FIXED_SP:  return JIT_SP;
+        case FIXED_BP:  return JIT_BP;
+        case FIXED_RET: return JIT_RET;
+        default:
+            return (fixed - FIXED_PR < JIT_HOST_PRS ? jit_pr_hosts[fixed - FIXED_PR] : -1);
+    }
+}
+
+int32_t jit_reg_disp (int fixed)
+{
+    return (int32_t)(offsetof(ILOCMachine, fixed_regs) + fixed * sizeof(word_t));
+}
+
+/**
+ * @brief Copy a decoded (bank 0) register into a host register
+ */
+void jit_get (JitCode* jit, int dst, DecodedReg* reg)
+{
+    int host = jit_host_reg(reg->index);
+    if (host >= 0) {
+        jit_rr(jit, X86_STORE, host, dst);
+    } else {
+        jit_rm(jit, X86_LOAD, dst, JIT_MACHINE, jit_reg_disp(reg->index));
+    }
+}
+
+/**
+ * @brief Copy a host register into a decoded (bank 0) register
+ */
+void jit_set (JitCode* jit, DecodedReg* reg, int src)
+{
+    int host = jit_host_reg(reg->index);
+    if (host >= 0) {
+        jit_rr(jit, X86_STORE, src, host);
+    } else {
+        jit_rm(jit, X86_STORE, src, JIT_MACHINE, jit_reg_disp(reg->index));
+    }
+}
+
+/**
+ * @brief Copy the registers kept in host registers into the machine (@c save)
+ * or back out of it
+ */
+void jit_sync (JitCode* jit, bool save)
+{
+    for (int fixed = 0; fixed < FIXED_PR + JIT_HOST_PRS; fixed++) {
+        jit_rm(jit, (save ? X86_STORE : X86_LOAD), jit_host_reg(fixed), JIT_MACHINE, jit_reg_disp(fixed));
+    }
+    jit_rm(jit, (save ? X86_STORE : X86_LOAD), JIT_STEPS, JIT_MACHINE, (int32_t)offsetof(ILOCMachine, steps));
+}
+
+/**
+ * @brief Emit a range check of the address in RAX (exiting to the
+ * interpreter at instruction @c index if it is outside of the address space)
+ */
+void jit_check_address (JitCode* jit, ILOCMachine* machine, int index, int adjust)
+{
+    jit_ri(jit, 7, X86_RAX, (int32_t)(machine->mem_size - WORD_SIZE));
+    jit_branch(jit, X86_CC_A, JIT_TO_EXIT, index, adjust);
+}
+
+/**
+ * @brief Emit a push of RCX onto the ILOC stack (with the stack checks)
+ */
+void jit_push_rcx (JitCode* jit, ILOCMachine* machine, int index, int adjust)
+{
+    jit_rm(jit, X86_LEA, X86_RAX, JIT_SP, -WORD_SIZE);
+    jit_ri(jit, 7, X86_RAX, (int32_t)machine->stack_limit);
+    jit_branch(jit, X86_CC_LE, JIT_TO_EXIT, index, adjust);
+    jit_check_address(jit, machine, index, adjust);
+    jit_mem(jit, X86_STORE, X86_RCX, X86_RAX);
+    jit_rr(jit, X86_STORE, X86_RAX, JIT_SP);
+}
+
+/**
+ * @brief Emit a call into C with up to three arguments already in RDI, RSI,
+ * and RDX (the caller-saved physical registers were pushed by the caller)
+ */
+void jit_call (JitCode* jit, void (*function)(void))
+{
+    jit_mov_imm(jit, X86_RAX, (int64_t)(uintptr_t)function);
+    jit_byte(jit, 0xFF);
+    jit_byte(jit, 0xD0);
+}
+
+/**
+ * @brief PRINT of a register from compiled code
+ */
+void jit_print_int (ILOCMachine* machine, word_t value)
+{
+    OutputSink_write_int(machine->output, value);
+}
+
+/**
+ * @brief PRINT of a string constant from compiled code
+ */
+void jit_print_str (ILOCMachine* machine, const char* text, size_t length)
+{
+    OutputSink_write(machine->output, text, length);
+}
+
+/**
+ * @brief Check whether compiled code can execute a decoded op
+ * 
+ * @param op Decoded op
+ * @param windows Does the program use register windows (i.e., does any
+ * function have virtual registers)?
+ */
+bool jit_supports (DecodedOp* op, bool windows)
+{
+    if (op->opcode == OP_CHECKED) {
+        return false;
+    }
+    for (int j = 0; j < 3; j++) {
+        if (op->reg[j].bank != 0) {
+            return false;   /* virtual register */
+        }
+    }
+    InsnForm form = op->insn->form;
+    return !((form == CALL || form == RETURN) && windows);
+}
+
+/**
+ * @brief Emit the code for one instruction
+ * 
+ * @param jit Code being generated
+ * @param machine Linked machine
+ * @param ops Decoded program
+ * @param index Instruction index
+ * @param adjust Instructions from this one to the end of its block
+ */
+void jit_insn (JitCode* jit, ILOCMachine* machine, DecodedOp* ops, int index, int adjust)
+{
+    DecodedOp* op = &ops[index];
+    DecodedReg* reg = op->reg;
+    int cc = -1;
+    int alu = 0;
+    switch (op->insn->form) {
+        case LOAD_I:
+            jit_mov_imm(jit, X86_RAX, op->imm);
+            jit_set(jit, &reg[1], X86_RAX);
+            break;
+
+        case LOAD:
+        case LOAD_AI:
+        case LOAD_AO:
+            jit_get(jit, X86_RAX, &reg[0]);
+            if (op->insn->form == LOAD_AI) {
+                jit_mov_imm(jit, X86_RCX, op->imm);
+                jit_rr(jit, X86_ADD, X86_RCX, X86_RAX);
+            } else if (op->insn->form == LOAD_AO) {
+                jit_get(jit, X86_RCX, &reg[1]);
+                jit_rr(jit, X86_ADD, X86_RCX, X86_RAX);
+            }
+            jit_check_address(jit, machine, index, adjust);
+            jit_mem(jit, X86_LOAD, X86_RCX, X86_RAX);
+            jit_set(jit, &reg[op->insn->form == LOAD ? 1 : 2], X86_RCX);
+            break;
+
+        case STORE:
+        case STORE_AI:
+        case STORE_AO:
+            jit_get(jit, X86_RAX, &reg[1]);
+            if (op->insn->form == STORE_AI) {
+                jit_mov_imm(jit, X86_RCX, op->imm);
+                jit_rr(jit, X86_ADD, X86_RCX, X86_RAX);
+            } else if (op->insn->form == STORE_AO) {
+                jit_get(jit, X86_RCX, &reg[2]);
+                jit_rr(jit, X86_ADD, X86_RCX, X86_RAX);
+            }
+            jit_check_address(jit, machine, index, adjust);
+            jit_get(jit, X86_RCX, &reg[0]);
+            jit_mem(jit, X86_STORE, X86_RCX, X86_RAX);
+            break;
+
+        case ADD:   alu = X86_ADD;  break;
+        case SUB:   alu = X86_SUB;  break;
+        case AND:   alu = X86_AND;  break;
+        case OR:    alu = X86_OR;   break;
+        case MULT:  alu = X86_IMUL; break;
+
+        case DIV:
+            /* divisors 0 and -1 (which may trap) go to the interpreter */
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_get(jit, X86_RCX, &reg[1]);
+            jit_rm(jit, X86_LEA, X86_RDX, X86_RCX, 1);
+            jit_ri(jit, 7, X86_RDX, 1);
+            jit_branch(jit, X86_CC_BE, JIT_TO_EXIT, index, adjust);
+            jit_byte(jit, 0x48);                    /* cqo */
+            jit_byte(jit, 0x99);
+            jit_rr(jit, 0xF7, 7, X86_RCX);          /* idiv rcx */
+            jit_set(jit, &reg[2], X86_RAX);
+            break;
+
+        case CMP_LT: cc = X86_CC_L;  break;
+        case CMP_LE: cc = X86_CC_LE; break;
+        case CMP_EQ: cc = X86_CC_E;  break;
+        case CMP_NE: cc = X86_CC_NE; break;
+        case CMP_GE: cc = X86_CC_GE; break;
+        case CMP_GT: cc = X86_CC_G;  break;
+
+        case ADD_I:
+        case MULT_I:
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_mov_imm(jit, X86_RCX, op->imm);
+            if (op->insn->form == ADD_I) {
+                jit_rr(jit, X86_ADD, X86_RCX, X86_RAX);
+            } else {
+                jit_rr(jit, X86_IMUL, X86_RAX, X86_RCX);
+            }
+            jit_set(jit, &reg[2], X86_RAX);
+            break;
+
+        case I2I:
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_set(jit, &reg[1], X86_RAX);
+            break;
+
+        case NOT:
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_rr(jit, 0xF7, 2, X86_RAX);          /* not rax */
+            jit_ri(jit, 4, X86_RAX, 1);             /* and rax, 1 */
+            jit_set(jit, &reg[1], X86_RAX);
+            break;
+
+        case NEG:
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_rr(jit, 0xF7, 3, X86_RAX);          /* neg rax */
+            jit_set(jit, &reg[1], X86_RAX);
+            break;
+
+        case PUSH:
+            jit_get(jit, X86_RCX, &reg[0]);
+            jit_push_rcx(jit, machine, index, adjust);
+            break;
+
+        case POP:
+            jit_rr(jit, X86_STORE, JIT_SP, X86_RAX);
+            jit_check_address(jit, machine, index, adjust);
+            jit_mem(jit, X86_LOAD, X86_RCX, X86_RAX);
+            jit_ri(jit, 0, JIT_SP, WORD_SIZE);
+            jit_set(jit, &reg[0], X86_RCX);
+            break;
+
+        case JUMP:
+            jit_branch(jit, -1, JIT_TO_INSN, op->target[0], 0);
+            break;
+
+        case CBR:
+            jit_get(jit, X86_RAX, &reg[0]);
+            jit_rr(jit, X86_TEST, X86_RAX, X86_RAX);
+            jit_branch(jit, X86_CC_NE, JIT_TO_INSN, op->target[0], 0);
+            jit_branch(jit, -1, JIT_TO_INSN, op->target[1], 0);
+            break;
+
+        case CALL:
+            /* the return address is the index of the next instruction, as in
+             * the interpreter */
+            jit_mov_imm(jit, X86_RCX, index + 1);
+            jit_push_rcx(jit, machine, index, adjust);
+            jit_branch(jit, -1, JIT_TO_INSN, op->target[0], 0);
+            break;
+
+        case RETURN:
+            /* an empty stack means that main() is returning */
+            jit_ri(jit, 7, JIT_SP, (int32_t)machine->mem_size);
+            jit_branch(jit, X86_CC_E, JIT_TO_INSN, machine->num_instructions, 0);
+            jit_rr(jit, X86_STORE, JIT_SP, X86_RAX);
+            jit_check_address(jit, machine, index, adjust);
+            jit_mem(jit, X86_LOAD, X86_RAX, X86_RAX);
+            jit_ri(jit, 7, X86_RAX, machine->num_instructions);
+            jit_branch(jit, X86_CC_A, JIT_TO_EXIT, index, adjust);
+            jit_ri(jit, 0, JIT_SP, WORD_SIZE);
+            jit_mov_imm(jit, X86_RCX, (int64_t)(uintptr_t)jit->entries);
+            jit_byte(jit, 0xFF);                    /* jmp [rcx + rax*8] */
+            jit_byte(jit, 0x24);
+            jit_byte(jit, 0xC1);
+            break;
+
+        case PRINT:
+            for (int i = 0; i < JIT_HOST_PRS; i++) {
+                jit_push(jit, jit_pr_hosts[i]);
+            }
+            if (op->insn->op[0].type == STR_CONST) {
+                jit_mov_imm(jit, X86_RSI, (int64_t)(uintptr_t)op->insn->op[0].str);
+                jit_mov_imm(jit, X86_RDX, op->imm);
+            } else {
+                jit_get(jit, X86_RAX, &reg[0]);
+                jit_rr(jit, X86_STORE, X86_RAX, X86_RSI);
+            }
+            jit_rr(jit, X86_STORE, JIT_MACHINE, X86_RDI);
+            jit_call(jit, (op->insn->op[0].type == STR_CONST ?
+                        (void (*)(void))jit_print_str : (void (*)(void))jit_print_int));
+            for (int i = JIT_HOST_PRS - 1; i >= 0; i--) {
+                jit_pop(jit, jit_pr_hosts[i]);
+            }
+            break;
+
+        case LABEL:
+        case NOP:
+        case PHI:
+            break;
+    }
+
+    if (alu != 0) {
+        jit_get(jit, X86_RAX, &reg[0]);
+        jit_get(jit, X86_RCX, &reg[1]);
+        if (alu == X86_IMUL) {
+            jit_rr(jit, X86_IMUL, X86_RAX, X86_RCX);
+        } else {
+            jit_rr(jit, alu, X86_RCX, X86_RAX);
+        }
+        jit_set(jit, &reg[2], X86_RAX);
+    } else if (cc >= 0) {
+        jit_get(jit, X86_RAX, &reg[0]);
+        jit_get(jit, X86_RCX, &reg[1]);
+        jit_rr(jit, X86_CMP, X86_RCX, X86_RAX);
+        jit_byte(jit, 0x0F);                        /* setcc al */
+        jit_byte(jit, 0x90 | cc);
+        jit_byte(jit, 0xC0);
+        jit_byte(jit, 0x0F);                        /* movzx eax, al */
+        jit_byte(jit, 0xB6);
+        jit_byte(jit, 0xC0);
+        jit_set(jit, &reg[2], X86_RAX);
+    }
+}
+
+/**
+ * @brief Translate a decoded program into native code
+ * 
+ * @param machine Linked machine (the address space size and limits are
+ * compiled in)
+ * @param ops Program decoded in fast mode
+ * @param start Index of the first instruction of main()
+ * @returns Newly-allocated code (or NULL if executable memory is not available)
+ */
+JitCode* JitCode_new (ILOCMachine* machine, DecodedOp* ops, int start)
+{
+    /* addresses are compared with 32-bit immediates */
+    if (machine->mem_size > INT32_MAX) {
+        return NULL;
+    }
+
+    int num_insns = machine->num_instructions;
+    JitCode* jit = (JitCode*)calloc(1, sizeof(JitCode));
+    CHECK_MALLOC_PTR(jit);
+    jit->offsets = (size_t*)calloc(num_insns + 1, sizeof(size_t));
+    jit->entries = (void**)calloc(num_insns + 1, sizeof(void*));
+    jit->leaders = (bool*)calloc(num_insns + 1, sizeof(bool));
+    int* block_ends = (int*)malloc((num_insns + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(jit->offsets);
+    CHECK_MALLOC_PTR(jit->entries);
+    CHECK_MALLOC_PTR(jit->leaders);
+    CHECK_MALLOC_PTR(block_ends);
+
+    jit->capacity = (size_t)(num_insns + 1) * JIT_MAX_INSN_BYTES + 4096;
+    jit->code = (byte_t*)mmap(NULL, jit->capacity, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        jit->code = NULL;
+        free(block_ends);
+        JitCode_free(jit);
+        return NULL;
+    }
+
+    /* find the leaders and the end of each block */
+    bool windows = false;
+    FOR_EACH (CallTarget*, function, machine->call_targets) {
+        windows = windows || function->num_virtual_regs > 0;
+    }
+    jit->leaders[start] = true;
+    for (int i = 0; i < num_insns; i++) {
+        InsnForm form = ops[i].insn->form;
+        bool supported = jit_supports(&ops[i], windows);
+        if (supported && (form == JUMP || form == CBR || form == CALL)) {
+            jit->leaders[ops[i].target[0]] = true;
+        }
+        if (supported && form == CBR) {
+            jit->leaders[ops[i].target[1]] = true;
+        }
+        if (!supported || form == JUMP || form == CBR || form == CALL || form == RETURN) {
+            jit->leaders[i + 1] = true;
+        }
+    }
+    jit->leaders[num_insns] = false;
+    int next_leader = num_insns;
+    for (int i = num_insns - 1; i >= 0; i--) {
+        block_ends[i] = next_leader;
+        if (jit->leaders[i]) {
+            next_leader = i;
+        }
+    }
+
+    /* entry: save the callee-saved registers (keeping the stack aligned),
+     * load the machine state, and jump to the entry address (passed in RSI,
+     * which holds a physical register once the state is loaded) */
+    static const int saved[] = { X86_RBX, X86_RBP, X86_R12, X86_R13, X86_R14, X86_R15 };
+    for (int i = 0; i < 6; i++) {
+        jit_push(jit, saved[i]);
+    }
+    jit_ri(jit, 5, X86_RSP, WORD_SIZE);
+    jit_rr(jit, X86_STORE, X86_RDI, JIT_MACHINE);
+    jit_rr(jit, X86_STORE, X86_RSI, X86_RAX);
+    jit_rm(jit, X86_LOAD, JIT_MEM, JIT_MACHINE, (int32_t)offsetof(ILOCMachine, mem));
+    jit_sync(jit, false);
+    jit_byte(jit, 0xFF);                            /* jmp rax */
+    jit_byte(jit, 0xE0);
+
+    /* exit (with the instruction index in EAX): store the machine state and
+     * return to run_jit */
+    jit->exit = jit->length;
+    jit_sync(jit, true);
+    jit_ri(jit, 0, X86_RSP, WORD_SIZE);
+    for (int i = 5; i >= 0; i--) {
+        jit_pop(jit, saved[i]);
+    }
+    jit_byte(jit, 0xC3);
+
+    /* instructions (in program order, so fall-through needs no code) */
+    for (int i = 0; i < num_insns; i++) {
+        int adjust = block_ends[i] - i;
+        if (jit->leaders[i]) {
+            /* count the whole block, unless that would time out */
+            jit->offsets[i] = jit->length;
+            jit_rm(jit, X86_LEA, X86_RAX, JIT_STEPS, block_ends[i] - i);
+            if (machine->max_steps == (int32_t)machine->max_steps) {
+                jit_ri(jit, 7, X86_RAX, (int32_t)machine->max_steps);
+            } else {
+                jit_mov_imm(jit, X86_RCX, machine->max_steps);
+                jit_rr(jit, X86_CMP, X86_RCX, X86_RAX);
+            }
+            jit_branch(jit, X86_CC_G, JIT_TO_EXIT, i, 0);
+            jit_rr(jit, X86_STORE, X86_RAX, JIT_STEPS);
+        }
+        if (jit_supports(&ops[i], windows)) {
+            jit_insn(jit, machine, ops, i, adjust);
+        } else {
+            jit_branch(jit, -1, JIT_TO_EXIT, i, adjust);
+        }
+    }
+
+    /* exits back to the interpreter */
+    for (int f = 0; f < jit->num_fixups; f++) {
+        JitFixup* fixup = &jit->fixups[f];
+        if (fixup->kind != JIT_TO_EXIT) {
+            continue;
+        }
+        jit_patch(jit, fixup->offset, jit->length);
+        if (fixup->adjust > 0) {
+            jit_ri(jit, 5, JIT_STEPS, fixup->adjust);
+        }
+        jit_exit(jit, fixup->index);
+    }
+
+    /* instructions that cannot be entered exit right away (returns may go
+     * anywhere, and the end of the program exits as well) */
+    for (int i = 0; i <= num_insns; i++) {
+        if (!jit->leaders[i]) {
+            jit->offsets[i] = jit->length;
+            jit_exit(jit, i);
+        }
+        jit->entries[i] = jit->code + jit->offsets[i];
+    }
+    for (int f = 0; f < jit->num_fixups; f++) {
+        if (jit->fixups[f].kind == JIT_TO_INSN) {
+            jit_patch(jit, jit->fixups[f].offset, jit->offsets[jit->fixups[f].index]);
+        }
+    }
+    free(block_ends);
+
+    /* write, then execute */
+    if (mprotect(jit->code, jit->capacity, PROT_READ | PROT_EXEC) != 0) {
+        JitCode_free(jit);
+        return NULL;
+    }
+    void* code = jit->code;
+    memcpy(&jit->run, &code, sizeof(code));    /* object to function pointer */
+    return jit;
+}
+
+#else
+
+JitCode* JitCode_new (ILOCMachine* machine, DecodedOp* ops, int start)
+{
+    return NULL;
+}
+
+#endif
+
+void run_jit (ILOCMachine* machine, DecodedOp* ops, int start)
+{
+    machine->jit = JitCode_new(machine, ops, start);
+    if (machine->jit == NULL) {
+        run_decoded(machine, ops, start, SIM_FAST);
+        return;
+    }
+
+    int index = start;
+    bool native = true;
+    while (index < machine->num_instructions) {
+        if (native && machine->jit->leaders[index]) {
+            index = machine->jit->run(machine, machine->jit->entries[index]);
+            native = false;
+            continue;
+        }
+
+        /* the compiled code could not run this instruction */
+        machine->pc_index = index;
+        machine->pc = machine->instructions[index];
+        index = ILOCMachine_step(machine);
+        machine->steps++;
+        if (machine->steps > machine->max_steps) {
+            timeout(machine);
+        }
+        native = true;
+    }
+}
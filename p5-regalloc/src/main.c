@@ -3,23 +3,34 @@
  * @brief Compiler driver
  */
 
+#define _DEFAULT_SOURCE     /* clock_gettime(), mkdtemp(), open_memstream(), popen(), and sysconf() */
+
 #include "p1-lexer.h"
 #include "p2-parser.h"
 #include "p3-analysis.h"
 #include "p4-codegen.h"
 #include "p5-regalloc.h"
 
+#include "batch.h"
+#include "c-emit.h"
+#include "memory-model.h"
+#include "profile.h"
+#include "x86-64.h"
 #include "y86.h"
 
+#include <time.h>
+#include <unistd.h>
+
 /**
- * @brief Error message buffer
+ * @brief Error message buffer (one per thread, since batch workers compile
+ * programs concurrently)
  */
-char decaf_error_msg[MAX_ERROR_LEN];
+_Thread_local char decaf_error_msg[MAX_ERROR_LEN];
 
 /**
  * @brief Data structure used by @c setjmp / @c longjmp for exception handling
  */
-jmp_buf decaf_error;
+_Thread_local jmp_buf decaf_error;
 
 /**
  * @brief Throw an exception with an error message using printf syntax
@@ -65,29 +76,103 @@ bool read_file (const char* filename, char* text)
 }
 
 /**
- * @brief Compiler entry point
+ * @brief Parse a cache hierarchy description
  *
- * @param argc Number of command-line arguments
- * @param argv Array of command-line argument strings
- * @returns @c EXIT_SUCCESS if the compilation succeeds and @c EXIT_FAILURE
- * otherwise
+ * Each level is written as <tt>size:line:ways</tt> (in bytes, bytes, and
+ * lines per set), with levels separated by commas (L1 first), e.g.,
+ * "4096:64:4,32768:64:8".
+ *
+ * @param description Text to parse
+ * @param levels Array of at least @ref MAX_CACHE_LEVELS levels to fill in
+ * @returns Number of levels (0 if the description is malformed)
  */
-int main(int argc, char** argv)
+int parse_cache_levels (const char* description, CacheConfig* levels)
 {
-    /* check for filename */
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <decaf-filename>\n", argv[0]);
-        return EXIT_FAILURE;
+    int num_levels = 0;
+    const char* p = description;
+    while (num_levels < MAX_CACHE_LEVELS) {
+        CacheConfig* level = &levels[num_levels++];
+        int length = 0;
+        if (sscanf(p, "%ld:%d:%d%n", &level->size, &level->line_size,
+                    &level->associativity, &length) != 3) {
+            return 0;
+        }
+        p += length;
+        if (*p == '\0') {
+            return num_levels;
+        } else if (*p != ',') {
+            return 0;
+        }
+        p++;
     }
-    char* filename = argv[argc-1];
+    return 0;
+}
 
-    /* read file */
-    char text[MAX_FILE_SIZE];
-    if (!read_file(filename, text)) {
-        fprintf(stderr, "Could not read file: %s", filename);
-        exit(EXIT_FAILURE);
+/**
+ * @brief Parse pipeline timing settings
+ *
+ * Settings are comma-separated <tt>name=value</tt> pairs applied on top of
+ * the current timing: "width" (issue width), "branch" (branch penalty),
+ * "load" (latency of all loads and pops), "mult" (mult and multI), or the
+ * mnemonic of any instruction form (e.g., "loadAI=4"). The single setting
+ * "default" changes nothing.
+ *
+ * @param settings Text to parse
+ * @param config Timing to update
+ * @returns True if every setting was valid
+ */
+bool parse_pipeline_settings (const char* settings, PipelineConfig* config)
+{
+    if (strcmp(settings, "default") == 0) {
+        return true;
     }
+    char text[MAX_LINE_LEN];
+    snprintf(text, MAX_LINE_LEN, "%s", settings);
+    for (char* setting = strtok(text, ","); setting != NULL; setting = strtok(NULL, ",")) {
+        char* value_text = strchr(setting, '=');
+        if (value_text == NULL) {
+            return false;
+        }
+        *value_text++ = '\0';
+        char* end = NULL;
+        long value = strtol(value_text, &end, 10);
+        if (*value_text == '\0' || *end != '\0' || value < 0 || value > 1000) {
+            return false;
+        }
+
+        if (strcmp(setting, "width") == 0 && value > 0) {
+            config->issue_width = (int)value;
+        } else if (strcmp(setting, "branch") == 0) {
+            config->branch_penalty = (int)value;
+        } else if (strcmp(setting, "load") == 0) {
+            config->latency[LOAD] = config->latency[LOAD_AI] = config->latency[LOAD_AO] = (int)value;
+            config->latency[POP] = (int)value;
+        } else if (strcmp(setting, "mult") == 0) {
+            config->latency[MULT] = config->latency[MULT_I] = (int)value;
+        } else {
+            int form = 0;
+            while (form < NUM_INSN_FORMS && strcmp(setting, InsnForm_name(form)) != 0) {
+                form++;
+            }
+            if (form == NUM_INSN_FORMS) {
+                return false;
+            }
+            config->latency[form] = (int)value;
+        }
+    }
+    return true;
+}
 
+/**
+ * @brief Compile a Decaf program to ILOC (without register allocation)
+ *
+ * @param text Decaf source code
+ * @param syntax_errors File stream for a lexer or parser error message
+ * @param analysis_errors File stream for analysis error messages (one per line)
+ * @returns ILOC program or @c NULL if there were errors
+ */
+InsnList* compile (char* text, FILE* syntax_errors, FILE* analysis_errors)
+{
     /* FRONT END */
 
     TokenQueue* tokens = NULL;
@@ -109,10 +194,10 @@ int main(int argc, char** argv)
     } else {
 
         /* handle fatal error: print message and clean up */
-        fprintf(stderr, "%s", decaf_error_msg);
+        fprintf(syntax_errors, "%s", decaf_error_msg);
         if (tokens   != NULL) TokenQueue_free(tokens);
         if (tree     != NULL) ASTNode_free(tree);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     /* set up parent links and calculate node depths */
@@ -129,14 +214,14 @@ int main(int argc, char** argv)
 
     /* print analysis errors */
     FOR_EACH(AnalysisError*, err, errors) {
-        printf("%s\n", err->message);
+        fprintf(analysis_errors, "%s\n", err->message);
     }
 
     /* abort if analysis has reported errors */
     if (!ErrorList_is_empty(errors)) {
         ASTNode_free(tree);
         ErrorList_free(errors);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     /* clean up error list */
@@ -155,15 +240,610 @@ int main(int argc, char** argv)
     ASTNode_free(tree);
     tree = NULL;
 
-    /* PROJECT 5: register allocation */
-    allocate_registers(iloc, 4);
+    return iloc;
+}
+
+/**
+ * @brief Read, compile, and allocate a Decaf program for a batch job (see
+ * @ref BatchBuildFunction)
+ *
+ * @param arg Name of the Decaf file
+ * @param errors File stream for error messages
+ * @returns ILOC program or @c NULL if there were errors
+ */
+InsnList* build_batch_program (void* arg, FILE* errors)
+{
+    const char* filename = (const char*)arg;
+    char* text = (char*)malloc(MAX_FILE_SIZE);
+    CHECK_MALLOC_PTR(text);
+    InsnList* program = NULL;
+    if (!read_file(filename, text)) {
+        fprintf(errors, "Could not read file: %s", filename);
+    } else {
+        program = compile(text, errors, errors);
+    }
+    free(text);
+    if (program != NULL) {
+        allocate_registers(program, 4);
+    }
+    return program;
+}
+
+/**
+ * @brief Compile and run every Decaf program listed in a file on a pool of
+ * worker threads
+ *
+ * The list file names one Decaf file per line (blank lines are ignored).
+ * Each worker compiles the programs that it runs; the results file gets one
+ * line of JSON per program, in list order, with its status, return value,
+ * instruction count, wall time, and output (or the compiler's error
+ * messages).
+ *
+ * @param list_filename File with the names of the programs to run
+ * @param results_filename File to write the results to
+ * @param num_workers Number of worker threads
+ * @param config Simulator settings for every run
+ * @returns @c EXIT_SUCCESS if every listed program was run (even if some
+ * of them faulted) and @c EXIT_FAILURE otherwise
+ */
+int run_batch (const char* list_filename, const char* results_filename, int num_workers,
+        SimulatorConfig* config)
+{
+    FILE* list = fopen(list_filename, "r");
+    if (list == NULL) {
+        fprintf(stderr, "Could not read file: %s\n", list_filename);
+        return EXIT_FAILURE;
+    }
+    FILE* results = fopen(results_filename, "w");
+    if (results == NULL) {
+        fprintf(stderr, "Could not write file: %s\n", results_filename);
+        fclose(list);
+        return EXIT_FAILURE;
+    }
+
+    /* queue programs as they are listed */
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BatchPool* pool = BatchPool_new(num_workers, config);
+    if (pool == NULL) {
+        fprintf(stderr, "Could not start worker threads\n");
+        fclose(list);
+        fclose(results);
+        return EXIT_FAILURE;
+    }
+    int num_programs = 0;
+    int capacity = 64;
+    char** names = (char**)malloc(capacity * sizeof(char*));
+    BatchJob** jobs = (BatchJob**)malloc(capacity * sizeof(BatchJob*));
+    CHECK_MALLOC_PTR(names);
+    CHECK_MALLOC_PTR(jobs);
+    char filename[MAX_LINE_LEN];
+    while (fgets(filename, MAX_LINE_LEN, list) != NULL) {
+        filename[strcspn(filename, "\r\n")] = '\0';
+        if (filename[0] == '\0') {
+            continue;
+        }
+        if (num_programs == capacity) {
+            capacity *= 2;
+            names = (char**)realloc(names, capacity * sizeof(char*));
+            jobs = (BatchJob**)realloc(jobs, capacity * sizeof(BatchJob*));
+            CHECK_MALLOC_PTR(names);
+            CHECK_MALLOC_PTR(jobs);
+        }
+        int i = num_programs++;
+        names[i] = strdup(filename);
+        CHECK_MALLOC_PTR(names[i]);
+        jobs[i] = BatchJob_new_build(build_batch_program, names[i]);
+        BatchPool_submit(pool, jobs[i]);
+    }
+    fclose(list);
+    BatchPool_free(pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* write results in list order */
+    int num_faults = 0;
+    int num_compile_errors = 0;
+    for (int i = 0; i < num_programs; i++) {
+        BatchJob_print_json(jobs[i], names[i], results);
+        if (jobs[i]->program == NULL) {
+            num_compile_errors++;
+        } else if (jobs[i]->result.status != SIM_SUCCESS) {
+            num_faults++;
+        }
+        BatchJob_free(jobs[i]);
+        free(names[i]);
+    }
+    fclose(results);
+    free(names);
+    free(jobs);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("Ran %d programs (%d faulted, %d did not compile) on %d worker%s in %.3f seconds\n",
+            num_programs - num_compile_errors, num_faults, num_compile_errors,
+            num_workers, (num_workers == 1 ? "" : "s"), elapsed);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Order two doubles (for @c qsort)
+ */
+int compare_doubles (const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Time a compiled program in every simulator mode
+ *
+ * Runs the program the given number of times each in checked (untraced),
+ * fast, and JIT mode with its output captured, checks that all modes agree
+ * on the output, outcome, return value, and instruction count, and prints
+ * the median time of each mode along with its speed relative to checked
+ * mode.
+ *
+ * @param program Allocated ILOC program
+ * @param runs Number of runs per mode
+ * @returns @c EXIT_SUCCESS if all modes agreed and @c EXIT_FAILURE otherwise
+ */
+int run_benchmark (InsnList* program, int runs)
+{
+    static const SimulatorMode modes[] = { SIM_CHECKED, SIM_FAST, SIM_JIT };
+    static const char* names[] = { "checked", "fast", "jit" };
+    const int num_modes = sizeof(modes) / sizeof(modes[0]);
+    double medians[num_modes];
+    SimulatorResult results[num_modes];
+    OutputSink* outputs[num_modes];
+    double* times = (double*)malloc(runs * sizeof(double));
+    CHECK_MALLOC_PTR(times);
+
+    for (int m = 0; m < num_modes; m++) {
+        outputs[m] = OutputSink_new_capture();
+        for (int r = 0; r < runs; r++) {
+            OutputSink_clear(outputs[m]);
+            SimulatorConfig config = { .mode = modes[m], .output = outputs[m] };
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            results[m] = simulate_program(program, &config);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            times[r] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        }
+        qsort(times, runs, sizeof(double), compare_doubles);
+        medians[m] = times[runs / 2];
+    }
+    free(times);
+
+    bool agree = true;
+    for (int m = 1; m < num_modes; m++) {
+        if (strcmp(OutputSink_text(outputs[m]), OutputSink_text(outputs[0])) != 0 ||
+                results[m].status != results[0].status ||
+                strcmp(results[m].message, results[0].message) != 0 ||
+                results[m].return_value != results[0].return_value ||
+                results[m].instructions_executed != results[0].instructions_executed) {
+            printf("MISMATCH: %s mode does not match checked mode\n", names[m]);
+            agree = false;
+        }
+    }
+
+    printf("Benchmark: %d run%s per mode, %ld instructions per run%s\n", runs,
+            (runs == 1 ? "" : "s"), results[0].instructions_executed,
+            (results[0].status == SIM_SUCCESS ? "" : " (faulted)"));
+    printf("%-8s %12s %10s %8s\n", "mode", "median (s)", "MIPS", "speedup");
+    for (int m = 0; m < num_modes; m++) {
+        printf("%-8s %12.6f %10.1f %7.2fx\n", names[m], medians[m],
+                results[m].instructions_executed / medians[m] * 1e-6, medians[0] / medians[m]);
+        OutputSink_free(outputs[m]);
+    }
+    return (agree ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @brief Check a program's native translation against the simulator
+ *
+ * Translates the program with the given emitter (e.g., @ref emit_c or
+ * @ref emit_x86_64) in a temporary directory, compiles it with gcc and the
+ * given flags, runs it, and compares its output to that of a checked-mode
+ * simulator run (program output followed by the "RETURN VALUE" or "ERROR"
+ * line that the driver prints). Programs that time out in the simulator are
+ * skipped because native code has no instruction limit.
+ *
+ * @param program Allocated ILOC program
+ * @param emit Translation function
+ * @param source_name Filename for the translation (its extension tells gcc
+ * what kind of source it is)
+ * @param gcc_flags Flags for gcc
+ * @param description Name of the translation for messages (e.g., "C")
+ * @returns @c EXIT_SUCCESS if the outputs match (or the program was
+ * skipped) and @c EXIT_FAILURE otherwise
+ */
+int run_native_check (InsnList* program, void (*emit)(InsnList*, FILE*),
+        const char* source_name, const char* gcc_flags, const char* description)
+{
+    /* expected output (checked mode is the reference semantics) */
+    OutputSink* sink = OutputSink_new_capture();
+    SimulatorConfig config = { .mode = SIM_CHECKED, .output = sink };
+    SimulatorResult result = simulate_program(program, &config);
+    if (result.fault == FAULT_TIMEOUT) {
+        printf("SKIPPED: the program times out in the simulator\n");
+        OutputSink_free(sink);
+        return EXIT_SUCCESS;
+    }
+    char* expected = NULL;
+    size_t expected_length = 0;
+    FILE* stream = open_memstream(&expected, &expected_length);
+    CHECK_MALLOC_PTR(stream);
+    fputs(OutputSink_text(sink), stream);
+    if (result.status == SIM_SUCCESS) {
+        fprintf(stream, "RETURN VALUE = %d\n", (int)result.return_value);
+    } else {
+        fprintf(stream, "ERROR: %s\n", result.message);
+    }
+    fclose(stream);
+    OutputSink_free(sink);
+
+    /* translate, compile, and run */
+    char dir[] = "/tmp/decaf-native-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Could not create a temporary directory\n");
+        free(expected);
+        return EXIT_FAILURE;
+    }
+    char source[MAX_LINE_LEN];
+    char executable[MAX_LINE_LEN];
+    char command[3 * MAX_LINE_LEN];
+    snprintf(source, MAX_LINE_LEN, "%s/%s", dir, source_name);
+    snprintf(executable, MAX_LINE_LEN, "%s/program", dir);
+    FILE* source_file = fopen(source, "w");
+    if (source_file == NULL) {
+        fprintf(stderr, "Could not write file: %s\n", source);
+        free(expected);
+        rmdir(dir);
+        return EXIT_FAILURE;
+    }
+    emit(program, source_file);
+    fclose(source_file);
+
+    char* actual = NULL;
+    size_t actual_length = 0;
+    snprintf(command, sizeof(command), "gcc %s -o %s %s", gcc_flags, executable, source);
+    bool compiled = (system(command) == 0);
+    if (compiled) {
+        FILE* native = popen(executable, "r");
+        stream = open_memstream(&actual, &actual_length);
+        CHECK_MALLOC_PTR(stream);
+        char buffer[MAX_LINE_LEN];
+        size_t length;
+        while (native != NULL && (length = fread(buffer, 1, MAX_LINE_LEN, native)) > 0) {
+            fwrite(buffer, 1, length, stream);
+        }
+        fclose(stream);
+        if (native != NULL) {
+            pclose(native);
+        }
+    }
+    remove(executable);
+    remove(source);
+    rmdir(dir);
+
+    /* compare */
+    int status = EXIT_SUCCESS;
+    if (!compiled) {
+        printf("FAILED: the %s translation did not compile\n", description);
+        status = EXIT_FAILURE;
+    } else if (strcmp(actual, expected) != 0) {
+        printf("MISMATCH\n--- simulator\n%s--- native\n%s", expected, actual);
+        status = EXIT_FAILURE;
+    } else {
+        printf("%s translation matches the simulator\n", description);
+    }
+    free(expected);
+    free(actual);
+    return status;
+}
 
-    /* print ILOC */
-    InsnList_print(iloc, stdout);
+/**
+ * @brief Compiler entry point
+ *
+ * Usage: decaf [options] <decaf-filename>
+ *
+ * Options:
+ *   --alloc-stats        print register allocation statistics instead of
+ *                        printing and running the program
+ *   --alloc-stats-json   same as above, but as JSON
+ *   --fast               run the program in the simulator's fast mode (no
+ *                        trace or per-step diagnostics)
+ *   --jit                run the program as native x86-64 code (like --fast,
+ *                        but translated to machine code first)
+ *   --benchmark <runs>   run the program the given number of times in each
+ *                        of the checked, fast, and JIT modes (output
+ *                        captured) and print the median times instead of
+ *                        running it once
+ *   --emit-c <file>      write the program as a self-contained C file
+ *                        instead of running it
+ *   --check-c            compile the program's C translation with gcc -O2,
+ *                        run it, and compare its output to the simulator's
+ *   --emit-x86 <file>    allocate registers for x86-64 and write the program
+ *                        as a GNU assembler file instead of running it
+ *   --check-x86          allocate registers for x86-64, build the program's
+ *                        assembly into a static executable, run it, and
+ *                        compare its output to the simulator's
+ *   --profile            run the program without a trace and print an
+ *                        execution profile (flat profile, call graph, and
+ *                        block and instruction counts) after it finishes
+ *   --profile-json       same as above, but as JSON
+ *   --profile-source     run the program without a trace and print the
+ *                        Decaf source annotated with per-line instruction
+ *                        and memory operation counts
+ *   --cache <levels>     run the program without a trace and print cache hit
+ *                        rates, memory traffic by region and function, and
+ *                        the stack high-water mark after it finishes (levels
+ *                        are size:line:ways, comma-separated, L1 first; e.g.,
+ *                        4096:64:4,32768:64:8)
+ *   --pipeline <timing>  run the program without a trace and print the
+ *                        cycles estimated by an in-order pipeline model
+ *                        after it finishes (timing is "default" or
+ *                        comma-separated settings such as
+ *                        width=2,load=3,mult=3,div=20,branch=1)
+ *   --schedule <when>    list-schedule each basic block for the pipeline
+ *                        model "before" or "after" register allocation (or
+ *                        "both")
+ *   --trace <file>       write a binary trace to the given file instead of
+ *                        printing the machine state before every step (decode
+ *                        it with iloc-trace)
+ *   --batch <file>       treat the filename as a list of Decaf files (one per
+ *                        line), compile and run all of them without tracing,
+ *                        and write one line of JSON per program with its
+ *                        results to the given file
+ *   --jobs <n>           number of worker threads for --batch (default: one
+ *                        per online processor)
+ *
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line argument strings
+ * @returns @c EXIT_SUCCESS if the compilation succeeds and @c EXIT_FAILURE
+ * otherwise
+ */
+int main(int argc, char** argv)
+{
+    /* check for options and filename */
+    bool alloc_stats = false;
+    bool alloc_stats_json = false;
+    bool fast = false;
+    bool jit = false;
+    int benchmark_runs = 0;
+    char* c_filename = NULL;
+    bool check_c = false;
+    char* x86_filename = NULL;
+    bool check_x86 = false;
+    bool profile = false;
+    bool profile_json = false;
+    bool profile_source = false;
+    char* trace_filename = NULL;
+    char* batch_filename = NULL;
+    int num_jobs = 0;
+    CacheConfig cache_levels[MAX_CACHE_LEVELS];
+    int num_cache_levels = 0;
+    PipelineConfig pipeline_config;
+    PipelineConfig_init(&pipeline_config);
+    bool pipeline = false;
+    bool schedule_before = false;
+    bool schedule_after = false;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--alloc-stats") == 0) {
+            alloc_stats = true;
+        } else if (strcmp(argv[i], "--alloc-stats-json") == 0) {
+            alloc_stats_json = true;
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc - 1) {
+            benchmark_runs = atoi(argv[++i]);
+            if (benchmark_runs <= 0) {
+                argc = 0;   /* malformed run count */
+            }
+        } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc - 1) {
+            c_filename = argv[++i];
+        } else if (strcmp(argv[i], "--check-c") == 0) {
+            check_c = true;
+        } else if (strcmp(argv[i], "--emit-x86") == 0 && i + 1 < argc - 1) {
+            x86_filename = argv[++i];
+        } else if (strcmp(argv[i], "--check-x86") == 0) {
+            check_x86 = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[i], "--profile-json") == 0) {
+            profile_json = true;
+        } else if (strcmp(argv[i], "--profile-source") == 0) {
+            profile_source = true;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc - 1) {
+            num_cache_levels = parse_cache_levels(argv[++i], cache_levels);
+            if (num_cache_levels == 0) {
+                argc = 0;   /* malformed cache levels */
+            }
+        } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc - 1) {
+            pipeline = true;
+            if (!parse_pipeline_settings(argv[++i], &pipeline_config)) {
+                argc = 0;   /* malformed pipeline timing */
+            }
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc - 1) {
+            i++;
+            schedule_before = (strcmp(argv[i], "before") == 0 || strcmp(argv[i], "both") == 0);
+            schedule_after = (strcmp(argv[i], "after") == 0 || strcmp(argv[i], "both") == 0);
+            if (!schedule_before && !schedule_after) {
+                argc = 0;   /* unknown scheduling point */
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc - 1) {
+            trace_filename = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc - 1) {
+            batch_filename = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc - 1) {
+            num_jobs = atoi(argv[++i]);
+        } else {
+            argc = 0;   /* unknown option */
+        }
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [--alloc-stats | --alloc-stats-json] [--fast | --jit] [--benchmark <runs>] [--emit-c <file> | --check-c | --emit-x86 <file> | --check-x86] [--profile | --profile-json | --profile-source] [--cache <levels>] [--pipeline <timing>] [--schedule <when>] [--trace <file>] [--batch <results-file> [--jobs <n>]] <decaf-filename>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char* filename = argv[argc-1];
+
+    /* run a whole list of programs */
+    if (batch_filename != NULL) {
+        SimulatorConfig config = { .mode = (jit ? SIM_JIT : (fast ? SIM_FAST : SIM_CHECKED)) };
+        if (num_jobs <= 0) {
+            num_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        return run_batch(filename, batch_filename, (num_jobs > 0 ? num_jobs : 1), &config);
+    }
+
+    /* use a large buffer for standard output (traces and program output can
+     * be long) */
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    /* read file */
+    char text[MAX_FILE_SIZE];
+    if (!read_file(filename, text)) {
+        fprintf(stderr, "Could not read file: %s", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    /* FRONT END, MIDDLE END, and code generation */
+    InsnList* iloc = compile(text, stderr, stdout);
+    if (iloc == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* PROJECT 5: register allocation (with optional instruction scheduling);
+     * x86-64 has more registers than the simulator's usual target */
+    int num_physical_regs = (x86_filename != NULL || check_x86 ? X86_64_NUM_REGS : 4);
+    if (schedule_before) {
+        schedule_instructions(iloc, &pipeline_config);
+    }
+    if (alloc_stats || alloc_stats_json) {
+        AllocStats* stats = allocate_registers_with_stats(iloc, num_physical_regs);
+        if (alloc_stats_json) {
+            AllocStats_print_json(stats, stdout);
+        } else {
+            AllocStats_print(stats, stdout);
+        }
+        AllocStats_free(stats);
+        InsnList_free(iloc);
+        return EXIT_SUCCESS;
+    }
+    allocate_registers(iloc, num_physical_regs);
+    if (schedule_after) {
+        schedule_instructions(iloc, &pipeline_config);
+    }
+
+    /* translate the program to C or x86-64 (and optionally check the
+     * translation) */
+    if (c_filename != NULL) {
+        FILE* c_file = fopen(c_filename, "w");
+        if (c_file == NULL) {
+            fprintf(stderr, "Could not write file: %s\n", c_filename);
+            exit(EXIT_FAILURE);
+        }
+        emit_c(iloc, c_file);
+        fclose(c_file);
+        InsnList_free(iloc);
+        return EXIT_SUCCESS;
+    }
+    if (x86_filename != NULL) {
+        FILE* x86_file = fopen(x86_filename, "w");
+        if (x86_file == NULL) {
+            fprintf(stderr, "Could not write file: %s\n", x86_filename);
+            exit(EXIT_FAILURE);
+        }
+        emit_x86_64(iloc, x86_file);
+        fclose(x86_file);
+        InsnList_free(iloc);
+        return EXIT_SUCCESS;
+    }
+    if (check_c || check_x86) {
+        int status = (check_c
+                ? run_native_check(iloc, emit_c, "program.c", "-O2", "C")
+                : run_native_check(iloc, emit_x86_64, "program.s", "-static -no-pie", "x86-64"));
+        InsnList_free(iloc);
+        return status;
+    }
+
+    /* time the program instead of running it once */
+    if (benchmark_runs > 0) {
+        int status = run_benchmark(iloc, benchmark_runs);
+        InsnList_free(iloc);
+        return status;
+    }
+
+    /* print ILOC (except before a JSON profile) */
+    if (!profile_json) {
+        InsnList_print(iloc, stdout);
+    }
 
     /* run program (change 'true' to 'false' to disable trace output) */
-    int return_value = run_simulator(iloc, true);
+    SimulatorConfig config = { .mode = SIM_CHECKED, .print_trace = true };
+    if (fast) {
+        config.mode = SIM_FAST;
+        config.print_trace = false;
+    }
+    if (jit) {
+        config.mode = SIM_JIT;
+        config.print_trace = false;
+    }
+    if (profile || profile_json || profile_source) {
+        config.print_trace = false;
+        config.profile = ILOCProfile_new();
+    }
+    if (num_cache_levels > 0) {
+        config.print_trace = false;
+        config.memory = MemoryHierarchy_new(cache_levels, num_cache_levels);
+    }
+    if (pipeline) {
+        config.print_trace = false;
+        config.pipeline = PipelineModel_new(&pipeline_config);
+    }
+    if (trace_filename != NULL) {
+        config.print_trace = false;
+        config.trace_file = fopen(trace_filename, "wb");
+        if (config.trace_file == NULL) {
+            fprintf(stderr, "Could not write file: %s\n", trace_filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    int return_value = run_simulator_with_config(iloc, &config);
     printf("RETURN VALUE = %d\n", return_value);
+    if (config.trace_file != NULL) {
+        fclose(config.trace_file);
+    }
+
+    /* print execution profile */
+    if (config.profile != NULL) {
+        if (profile_json) {
+            ILOCProfile_print_json(config.profile, stdout);
+        } else if (profile_source) {
+            printf("\n");
+            ILOCProfile_print_source(config.profile, text, stdout);
+        } else {
+            printf("\n");
+            ILOCProfile_print(config.profile, stdout);
+        }
+        ILOCProfile_free(config.profile);
+    }
+
+    /* print cache and memory traffic statistics */
+    if (config.memory != NULL) {
+        printf("\n");
+        MemoryHierarchy_print(config.memory, stdout);
+        MemoryHierarchy_free(config.memory);
+    }
+
+    /* print estimated cycles */
+    if (config.pipeline != NULL) {
+        printf("\n");
+        PipelineModel_print(config.pipeline, stdout);
+        PipelineModel_free(config.pipeline);
+    }
 
     /* enable this to generate Y86 (requires a functional P5 solution first) */
     /*
@@ -0,0 +1,244 @@
+#include "memory-model.h"
+#include "iloc-machine.h"
+
+bool CacheConfig_is_valid (CacheConfig* config)
+{
+    if (config->line_size < WORD_SIZE || (config->line_size & (config->line_size - 1)) != 0) {
+        return false;
+    }
+    if (config->associativity < 1 || config->size < (long)config->line_size * config->associativity) {
+        return false;
+    }
+    return config->size % ((long)config->line_size * config->associativity) == 0;
+}
+
+MemoryHierarchy* MemoryHierarchy_new (CacheConfig* levels, int num_levels)
+{
+    MemoryHierarchy* memory = (MemoryHierarchy*)calloc(1, sizeof(MemoryHierarchy));
+    CHECK_MALLOC_PTR(memory);
+    memory->num_levels = (num_levels < MAX_CACHE_LEVELS ? num_levels : MAX_CACHE_LEVELS);
+    for (int l = 0; l < memory->num_levels; l++) {
+        memory->levels[l].config = levels[l];
+    }
+    return memory;
+}
+
+/**
+ * @brief Deallocate the cache contents and tables of a memory model and
+ * reset its statistics (keeping the cache geometry)
+ */
+void MemoryHierarchy_clear (MemoryHierarchy* memory)
+{
+    for (int l = 0; l < memory->num_levels; l++) {
+        CacheLevel* level = &memory->levels[l];
+        free(level->tags);
+        free(level->last_used);
+        free(level->dirty);
+        CacheConfig config = level->config;
+        memset(level, 0, sizeof(CacheLevel));
+        level->config = config;
+    }
+    free(memory->functions);
+    free(memory->function_of);
+    memory->functions = NULL;
+    memory->function_of = NULL;
+    memory->num_functions = 0;
+    memory->clock = 0;
+    memset(&memory->total, 0, sizeof(MemoryTraffic));
+    memset(&memory->stack, 0, sizeof(MemoryTraffic));
+    memset(&memory->statics, 0, sizeof(MemoryTraffic));
+    memory->max_stack_depth = 0;
+}
+
+void MemoryHierarchy_free (MemoryHierarchy* memory)
+{
+    MemoryHierarchy_clear(memory);
+    free(memory);
+}
+
+/**
+ * @brief Look up a line in a single cache level, filling it on a miss
+ *
+ * @param level Cache level
+ * @param address Address in the line
+ * @param write Mark the line as dirty
+ * @param clock Current time (for LRU replacement)
+ * @param victim Set to the address of a dirty line evicted to make room (-1 if none)
+ * @returns True if the line was already in the cache
+ */
+bool CacheLevel_access (CacheLevel* level, long address, bool write, long clock, long* victim)
+{
+    int ways = level->config.associativity;
+    long line = address / level->config.line_size;
+    int first = (int)(line % level->num_sets) * ways;
+    level->accesses++;
+    *victim = -1;
+
+    /* empty ways are never used, so they are replaced first */
+    int lru = first;
+    for (int w = first; w < first + ways; w++) {
+        if (level->tags[w] == line) {
+            level->hits++;
+            level->last_used[w] = clock;
+            level->dirty[w] |= write;
+            return true;
+        }
+        if (level->last_used[w] < level->last_used[lru]) {
+            lru = w;
+        }
+    }
+
+    level->misses++;
+    if (level->tags[lru] >= 0 && level->dirty[lru]) {
+        level->writebacks++;
+        *victim = level->tags[lru] * level->config.line_size;
+    }
+    level->tags[lru] = line;
+    level->last_used[lru] = clock;
+    level->dirty[lru] = write;
+    return false;
+}
+
+/**
+ * @brief Access an address starting at the given cache level, filling the
+ * line in every level that misses and writing evicted dirty lines back
+ *
+ * @returns Index of the level that had the line (the number of levels if
+ * it came from memory)
+ */
+int MemoryHierarchy_lookup (MemoryHierarchy* memory, int first_level, long address, bool write)
+{
+    int l;
+    for (l = first_level; l < memory->num_levels; l++) {
+        long victim;
+        bool hit = CacheLevel_access(&memory->levels[l], address, write && l == first_level,
+                memory->clock, &victim);
+        if (victim >= 0) {
+            MemoryHierarchy_lookup(memory, l + 1, victim, true);
+        }
+        if (hit) {
+            break;
+        }
+    }
+    return l;
+}
+
+/**
+ * @brief Count a memory operation
+ */
+void MemoryTraffic_add (MemoryTraffic* traffic, bool write, int missed_levels)
+{
+    if (write) {
+        traffic->writes++;
+    } else {
+        traffic->reads++;
+    }
+    for (int l = 0; l < missed_levels; l++) {
+        traffic->misses[l]++;
+    }
+}
+
+void MemoryHierarchy_access (MemoryHierarchy* memory, long address, bool write, bool stack, int function)
+{
+    memory->clock++;
+    int missed_levels = MemoryHierarchy_lookup(memory, 0, address, write);
+    MemoryTraffic_add(&memory->total, write, missed_levels);
+    MemoryTraffic_add(stack ? &memory->stack : &memory->statics, write, missed_levels);
+    MemoryTraffic_add(&memory->functions[function].traffic, write, missed_levels);
+}
+
+/**
+ * @brief Print one row of memory operation counts
+ */
+void MemoryTraffic_print (MemoryHierarchy* memory, MemoryTraffic* traffic, FILE* output)
+{
+    fprintf(output, "%11ld %11ld", traffic->reads, traffic->writes);
+    for (int l = 0; l < memory->num_levels; l++) {
+        fprintf(output, " %11ld", traffic->misses[l]);
+    }
+}
+
+void MemoryHierarchy_print (MemoryHierarchy* memory, FILE* output)
+{
+    long operations = memory->total.reads + memory->total.writes;
+    fprintf(output, "Memory hierarchy (%ld memory operations):\n\n", operations);
+    fprintf(output, "%-6s %9s %6s %6s %11s %11s %11s %9s %11s\n", "level", "size", "line", "ways",
+            "accesses", "hits", "misses", "hit rate", "writebacks");
+    for (int l = 0; l < memory->num_levels; l++) {
+        CacheLevel* level = &memory->levels[l];
+        char name[16];
+        snprintf(name, sizeof(name), "L%d", l + 1);
+        fprintf(output, "%-6s %9ld %6d %6d %11ld %11ld %11ld %8.2f%% %11ld\n", name,
+                level->config.size, level->config.line_size, level->config.associativity,
+                level->accesses, level->hits, level->misses,
+                100.0 * level->hits / (level->accesses > 0 ? level->accesses : 1),
+                level->writebacks);
+    }
+
+    /* lines filled from and written back to memory */
+    if (memory->num_levels > 0) {
+        CacheLevel* last = &memory->levels[memory->num_levels - 1];
+        fprintf(output, "\nMemory traffic: %ld bytes read, %ld bytes written\n",
+                last->misses * last->config.line_size, last->writebacks * last->config.line_size);
+    }
+
+    /* column headings for operation counts */
+    char headings[64 + 12 * MAX_CACHE_LEVELS];
+    int length = snprintf(headings, sizeof(headings), "%11s %11s", "reads", "writes");
+    for (int l = 0; l < memory->num_levels; l++) {
+        char heading[24];
+        snprintf(heading, sizeof(heading), "L%d misses", l + 1);
+        length += snprintf(headings + length, sizeof(headings) - length, " %11s", heading);
+    }
+
+    fprintf(output, "\nRegions:\n\n%-8s %s\n", "region", headings);
+    fprintf(output, "%-8s ", "stack");
+    MemoryTraffic_print(memory, &memory->stack, output);
+    fprintf(output, "\n%-8s ", "static");
+    MemoryTraffic_print(memory, &memory->statics, output);
+    fprintf(output, "\n%-8s ", "total");
+    MemoryTraffic_print(memory, &memory->total, output);
+    fprintf(output, "\n");
+
+    /* functions in program order (skipping those without memory operations) */
+    fprintf(output, "\nFunctions:\n\n%s  %s\n", headings, "function");
+    for (int f = 0; f < memory->num_functions; f++) {
+        MemoryFunction* function = &memory->functions[f];
+        if (function->traffic.reads + function->traffic.writes == 0) {
+            continue;
+        }
+        MemoryTraffic_print(memory, &function->traffic, output);
+        fprintf(output, "  %s\n", (function->name[0] != '\0' ? function->name : "(top)"));
+    }
+
+    fprintf(output, "\nStack high-water mark: %ld bytes\n", memory->max_stack_depth);
+}
+
+void MemoryHierarchy_init (MemoryHierarchy* memory, ILOCMachine* machine)
+{
+    MemoryHierarchy_clear(memory);
+    for (int l = 0; l < memory->num_levels; l++) {
+        CacheLevel* level = &memory->levels[l];
+        long num_lines = level->config.size / level->config.line_size;
+        level->num_sets = (int)(num_lines / level->config.associativity);
+        level->tags = (long*)malloc(num_lines * sizeof(long));
+        level->last_used = (long*)calloc(num_lines, sizeof(long));
+        level->dirty = (bool*)calloc(num_lines, sizeof(bool));
+        CHECK_MALLOC_PTR(level->tags);
+        CHECK_MALLOC_PTR(level->last_used);
+        CHECK_MALLOC_PTR(level->dirty);
+        for (long i = 0; i < num_lines; i++) {
+            level->tags[i] = -1;
+        }
+    }
+
+    memory->function_of = number_functions(machine, &memory->num_functions);
+    memory->functions = (MemoryFunction*)calloc(memory->num_functions + 1, sizeof(MemoryFunction));
+    CHECK_MALLOC_PTR(memory->functions);
+    for (int i = 0; i < machine->num_instructions; i++) {
+        if (is_call_label(machine->instructions[i])) {
+            snprintf(memory->functions[memory->function_of[i]].name, MAX_TOKEN_LEN, "%s",
+                    machine->instructions[i]->op[0].str);
+        }
+    }
+}
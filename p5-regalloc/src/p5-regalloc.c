@@ -12,11 +12,73 @@
 #define INVALID_VR      -1
 #define INVALID_OFFSET  -1
 #define INF_DIST        INT_MAX
+#define LOOP_WEIGHT     10  // estimated iterations per loop when weighting spill costs
+#define SCHEDULE_WINDOW 256 // most instructions list-scheduled together (longer blocks are split)
 
-int ensure(int vr, int* physical_regs, int* spill_offsets, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator);
-int allocate(int vr, int* physical_regs, int* spill_offsets, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator);
-int spill(int pr, int* physical_regs, int* spill_offsets, ILOCInsn* prev_insn, ILOCInsn* local_allocator);
+/**
+ * @brief Loop structure of a function, recovered from back edges in the ILOC
+ * 
+ * A jump label is a loop header if a later branch in the same function
+ * targets it; the textually last such branch closes the loop.
+ */
+typedef struct LoopInfo
+{
+    /**
+     * @brief Header label instruction for each jump label id (NULL if the label is not a loop header)
+     */
+    ILOCInsn** headers;
+
+    /**
+     * @brief Last back edge branch for each loop, indexed by header label id
+     */
+    ILOCInsn** ends;
+
+    /**
+     * @brief For each loop (indexed by header label id), the distance from the
+     * header to the first read of each virtual register (@ref INF_DIST if it
+     * is written first or never read)
+     * 
+     * These are measured before any registers of the function are replaced,
+     * since by the time the allocator reaches a back edge the loop body
+     * mentions only physical registers.
+     */
+    int** header_distances;
+
+    /**
+     * @brief For each loop the allocator is inside of, the virtual register in
+     * each physical register when it reached the header (NULL for other loops)
+     */
+    int** entry_regs;
+
+    /**
+     * @brief For each loop in @ref entry_regs, the instruction just before the header
+     */
+    ILOCInsn** preheaders;
+
+    /**
+     * @brief For each loop in @ref entry_regs, the order in which the allocator
+     * reached it (outer loops are reached first)
+     */
+    int* entry_order;
+
+    /**
+     * @brief Number of jump label ids (size of the arrays above)
+     */
+    int num_labels;
+
+} LoopInfo;
+
+int ensure(int vr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator, FunctionAllocStats* stats);
+int allocate(int vr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator, FunctionAllocStats* stats);
+int spill(int pr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, ILOCInsn* prev_insn, ILOCInsn* local_allocator, FunctionAllocStats* stats);
 int distance(int vr, ILOCInsn* insn);
+int weighted_distance(int vr, ILOCInsn* insn, LoopInfo* loops);
+bool live_after(int vr, ILOCInsn* insn, LoopInfo* loops);
+bool is_function_label(ILOCInsn* insn);
+void find_loops(LoopInfo* loops, ILOCInsn* label, ILOCInsn* end, int num_virtual_regs);
+LoopInfo* LoopInfo_new(InsnList* list);
+void LoopInfo_free(LoopInfo* loops);
+void reload_at_headers(int vr, int pr, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, ILOCInsn* local_allocator, FunctionAllocStats* stats);
 
 /**
  * @brief Replace a virtual register id with a physical register id
@@ -38,6 +100,23 @@ void replace_register(int vr, int pr, ILOCInsn* insn)
     }
 }
 
+/**
+ * @brief Insert an allocator-generated instruction into the code
+ * 
+ * The new instruction is attributed to the source line of the instruction
+ * it precedes (the one that needed it).
+ * 
+ * @param new_insn Instruction to insert
+ * @param prev_insn Reference to an instruction; the new instruction will be
+ * inserted directly after this one
+ */
+void insert_after(ILOCInsn* new_insn, ILOCInsn* prev_insn)
+{
+    new_insn->next = prev_insn->next;
+    prev_insn->next = new_insn;
+    new_insn->source_line = (new_insn->next != NULL ? new_insn->next : prev_insn)->source_line;
+}
+
 /**
  * @brief Insert a store instruction to spill a register to the stack
  * 
@@ -64,8 +143,7 @@ int insert_spill(int pr, ILOCInsn* prev_insn, ILOCInsn* local_allocator)
             physical_register(pr), base_register(), int_const(bp_offset));
 
     /* insert into code */
-    new_insn->next = prev_insn->next;
-    prev_insn->next = new_insn;
+    insert_after(new_insn, prev_insn);
 
     return bp_offset;
 }
@@ -85,31 +163,575 @@ void insert_load(int bp_offset, int pr, ILOCInsn* prev_insn)
             base_register(), int_const(bp_offset), physical_register(pr));
 
     /* insert into code */
-    new_insn->next = prev_insn->next;
-    prev_insn->next = new_insn;
+    insert_after(new_insn, prev_insn);
+}
+
+/**
+ * @brief Insert a loadI instruction to rematerialize a spilled constant
+ * 
+ * @param value Constant value that the spilled register held
+ * @param pr Physical register where the value should be regenerated
+ * @param prev_insn Reference to an instruction; the new instruction will be
+ * inserted directly after this one
+ */
+void insert_remat(long value, int pr, ILOCInsn* prev_insn)
+{
+    /* create loadI instruction */
+    ILOCInsn* new_insn = ILOCInsn_new_2op(LOAD_I, int_const(value), physical_register(pr));
+
+    /* insert into code */
+    insert_after(new_insn, prev_insn);
 }
 
-int num_virtual_registers(InsnList* list)
+/**
+ * @brief Find the last instruction inserted so far in front of an instruction
+ * 
+ * Allocator-generated code for one instruction must execute in the order it
+ * was generated (e.g., a spill store before the reload that reuses its
+ * register), so each new instruction goes after the ones already inserted.
+ * 
+ * @param prev_insn Original predecessor of @c insn
+ * @param insn Instruction being allocated
+ * @returns Instruction directly before @c insn
+ */
+ILOCInsn* last_inserted(ILOCInsn* prev_insn, ILOCInsn* insn)
 {
-    int max_vr = -1;
-    FOR_EACH(ILOCInsn*, insn, list) {
+    while (prev_insn->next != insn) {
+        prev_insn = prev_insn->next;
+    }
+    return prev_insn;
+}
+
+/**
+ * @brief Find virtual registers that can be rematerialized instead of spilled
+ * 
+ * A virtual register is rematerializable if its only definition is a loadI
+ * (e.g., literals and static variable base addresses). Spilling such a
+ * register does not need a store, and reloading it only needs another loadI.
+ * 
+ * @param label First instruction of the function to scan (before any registers are replaced)
+ * @param end First instruction after the function
+ * @param num_virtual_regs Number of virtual register ids in the function
+ * @returns Newly-allocated array mapping each virtual register to its defining
+ * loadI instruction (or NULL if it is not rematerializable)
+ */
+ILOCInsn** find_remat_defs(ILOCInsn* label, ILOCInsn* end, int num_virtual_regs)
+{
+    ILOCInsn** remat_defs = calloc(num_virtual_regs, sizeof(ILOCInsn*));
+    bool* defined = calloc(num_virtual_regs, sizeof(bool));
+    CHECK_MALLOC_PTR(remat_defs);
+    CHECK_MALLOC_PTR(defined);
+    for (ILOCInsn* insn = label; insn != end; insn = insn->next) {
+        Operand write_reg = ILOCInsn_get_write_register(insn);
+        if (write_reg.type != VIRTUAL_REG) {
+            continue;
+        }
+        if (!defined[write_reg.id] && insn->form == LOAD_I) {
+            remat_defs[write_reg.id] = insn;
+        } else {
+            remat_defs[write_reg.id] = NULL; // multiple definitions
+        }
+        defined[write_reg.id] = true;
+    }
+    free(defined);
+    return remat_defs;
+}
+
+/**
+ * @brief Check whether a read operand duplicates an earlier one
+ * 
+ * @param read_regs Fake instruction returned by @ref ILOCInsn_get_read_registers
+ * @param i Index of the operand to check
+ * @returns True if the same virtual register appears before index @c i
+ */
+bool read_earlier(ILOCInsn* read_regs, int i)
+{
+    for (int j = 0; j < i; j++) {
+        if (read_regs->op[j].type == VIRTUAL_REG && read_regs->op[j].id == read_regs->op[i].id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Count the instructions in a range
+ */
+int count_insns(ILOCInsn* label, ILOCInsn* end)
+{
+    int count = 0;
+    for (ILOCInsn* insn = label; insn != end; insn = insn->next) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Find the largest number of virtual registers live at once in a function
+ * 
+ * Each register is treated as live from its first appearance to its last.
+ * Temporaries from the code generator never live across basic blocks, so
+ * this matches real liveness for unallocated code.
+ * 
+ * @param label First instruction of the function (before allocation)
+ * @param end First instruction after the function
+ * @param num_virtual_regs Number of virtual register ids in the function
+ * @returns Peak register pressure
+ */
+int peak_pressure(ILOCInsn* label, ILOCInsn* end, int num_virtual_regs)
+{
+    int num_insns = count_insns(label, end);
+    int* first = calloc(num_virtual_regs, sizeof(int));
+    int* last = calloc(num_virtual_regs, sizeof(int));
+    int* delta = calloc(num_insns + 2, sizeof(int));
+    CHECK_MALLOC_PTR(first);
+    CHECK_MALLOC_PTR(last);
+    CHECK_MALLOC_PTR(delta);
+    for (int i = 0; i < num_virtual_regs; i++) {
+        first[i] = -1;
+    }
+
+    int pos = 0;
+    for (ILOCInsn* insn = label; insn != end; insn = insn->next, pos++) {
         for (int i = 0; i < 3; i++) {
             if (insn->op[i].type == VIRTUAL_REG) {
-                if (insn->op[i].id > max_vr) {
-                    max_vr = insn->op[i].id;
+                if (first[insn->op[i].id] < 0) {
+                    first[insn->op[i].id] = pos;
                 }
+                last[insn->op[i].id] = pos;
             }
         }
     }
-    return max_vr + 1;
+
+    /* live over [first, last), or just its own instruction if never read */
+    for (int i = 0; i < num_virtual_regs; i++) {
+        if (first[i] >= 0) {
+            delta[first[i]]++;
+            delta[last[i] > first[i] ? last[i] : first[i] + 1]--;
+        }
+    }
+    int live = 0, peak = 0;
+    for (int i = 0; i <= num_insns; i++) {
+        live += delta[i];
+        if (live > peak) {
+            peak = live;
+        }
+    }
+
+    free(first);
+    free(last);
+    free(delta);
+    return peak;
 }
-    
-void allocate_registers (InsnList* list, int num_physical_registers)
+
+/**
+ * @brief Summary information about one function in an ILOC program
+ * 
+ * Functions are contiguous runs of instructions that begin with a call label.
+ * The allocator processes them one at a time in bottom-up call graph order so
+ * that the registers clobbered by each callee are known at its call sites.
+ */
+typedef struct FunctionInfo
+{
+    /**
+     * @brief Call label instruction that begins the function
+     */
+    ILOCInsn* label;
+
+    /**
+     * @brief First instruction after the function (or NULL at the end of the program)
+     */
+    ILOCInsn* end;
+
+    /**
+     * @brief Number of virtual register ids used by the function (ids are
+     * numbered per function; see @ref renumber_virtual_registers)
+     */
+    int num_virtual_regs;
+
+    /**
+     * @brief Allocation statistics for this function
+     */
+    FunctionAllocStats* stats;
+
+    /**
+     * @brief Indices of functions called directly by this one (-1 if the callee is unknown)
+     */
+    int* callees;
+
+    /**
+     * @brief Number of entries in @ref callees
+     */
+    int num_callees;
+
+    /**
+     * @brief Physical registers written by this function or any of its callees
+     */
+    bool* clobbers;
+
+    /**
+     * @brief Strongly-connected component id in the call graph
+     */
+    int scc;
+
+    /* bookkeeping for Tarjan's SCC algorithm */
+    int index;      /**< @brief DFS discovery index (-1 if unvisited) */
+    int low_link;   /**< @brief Smallest index reachable from this function */
+    bool on_stack;  /**< @brief Currently on the SCC stack? */
+
+} FunctionInfo;
+
+/**
+ * @brief Check whether an instruction begins a new function
+ */
+bool is_function_label(ILOCInsn* insn)
+{
+    return insn->form == LABEL && insn->op[0].type == CALL_LABEL;
+}
+
+/**
+ * @brief Split an ILOC program into functions and find their direct callees
+ * 
+ * @param list ILOC program
+ * @param num_physical_registers Number of physical registers (sizes clobber sets)
+ * @param num_functions Output parameter for the number of functions found
+ * @returns Newly-allocated array of function summaries
+ */
+FunctionInfo* find_functions(InsnList* list, int num_physical_registers, int* num_functions)
+{
+    /* count function labels (code before the first label is its own function) */
+    int count = 0;
+    FOR_EACH(ILOCInsn*, insn, list) {
+        if (is_function_label(insn) || insn == list->head) {
+            count++;
+        }
+    }
+    FunctionInfo* functions = calloc(count, sizeof(FunctionInfo));
+    CHECK_MALLOC_PTR(functions);
+
+    /* record function boundaries */
+    int f = -1;
+    FOR_EACH(ILOCInsn*, insn, list) {
+        if (is_function_label(insn) || insn == list->head) {
+            if (f >= 0) {
+                functions[f].end = insn;
+            }
+            f++;
+            functions[f].label = insn;
+            functions[f].end = NULL;
+            functions[f].clobbers = calloc(num_physical_registers, sizeof(bool));
+            CHECK_MALLOC_PTR(functions[f].clobbers);
+            functions[f].scc = -1;
+            functions[f].index = -1;
+        }
+    }
+
+    /* record register counts and direct callees */
+    for (f = 0; f < count; f++) {
+        for (ILOCInsn* insn = functions[f].label; insn != functions[f].end; insn = insn->next) {
+            for (int i = 0; i < 3; i++) {
+                if (insn->op[i].type == VIRTUAL_REG && insn->op[i].id >= functions[f].num_virtual_regs) {
+                    functions[f].num_virtual_regs = insn->op[i].id + 1;
+                }
+            }
+            if (insn->form != CALL) {
+                continue;
+            }
+            int callee = -1;
+            for (int g = 0; g < count; g++) {
+                if (is_function_label(functions[g].label) &&
+                        token_str_eq(functions[g].label->op[0].str, insn->op[0].str)) {
+                    callee = g;
+                }
+            }
+            functions[f].callees = realloc(functions[f].callees, (functions[f].num_callees + 1) * sizeof(int));
+            CHECK_MALLOC_PTR(functions[f].callees);
+            functions[f].callees[functions[f].num_callees++] = callee;
+        }
+    }
+
+    *num_functions = count;
+    return functions;
+}
+
+/**
+ * @brief Visit a function using Tarjan's strongly-connected components algorithm
+ * 
+ * Components are appended to @c order as they are completed, which yields a
+ * bottom-up (callees first) ordering of the call graph.
+ */
+void find_sccs(FunctionInfo* functions, int f, int* next_index, int* next_scc,
+        int* stack, int* stack_size, int* order, int* order_size)
+{
+    FunctionInfo* fn = &functions[f];
+    fn->index = fn->low_link = (*next_index)++;
+    stack[(*stack_size)++] = f;
+    fn->on_stack = true;
+
+    for (int i = 0; i < fn->num_callees; i++) {
+        int g = fn->callees[i];
+        if (g < 0) {
+            continue;
+        }
+        if (functions[g].index < 0) {
+            find_sccs(functions, g, next_index, next_scc, stack, stack_size, order, order_size);
+            if (functions[g].low_link < fn->low_link) {
+                fn->low_link = functions[g].low_link;
+            }
+        } else if (functions[g].on_stack && functions[g].index < fn->low_link) {
+            fn->low_link = functions[g].index;
+        }
+    }
+
+    /* root of a component: pop it off the stack */
+    if (fn->low_link == fn->index) {
+        int g;
+        do {
+            g = stack[--(*stack_size)];
+            functions[g].on_stack = false;
+            functions[g].scc = *next_scc;
+            order[(*order_size)++] = g;
+        } while (g != f);
+        (*next_scc)++;
+    }
+}
+
+/**
+ * @brief Allocate loop information tables large enough for every jump label in a program
+ */
+LoopInfo* LoopInfo_new(InsnList* list)
+{
+    LoopInfo* loops = calloc(1, sizeof(LoopInfo));
+    CHECK_MALLOC_PTR(loops);
+    FOR_EACH(ILOCInsn*, insn, list) {
+        for (int i = 0; i < 3; i++) {
+            if (insn->op[i].type == JUMP_LABEL && insn->op[i].id >= loops->num_labels) {
+                loops->num_labels = insn->op[i].id + 1;
+            }
+        }
+    }
+    loops->headers = calloc(loops->num_labels + 1, sizeof(ILOCInsn*));
+    loops->ends = calloc(loops->num_labels + 1, sizeof(ILOCInsn*));
+    loops->header_distances = calloc(loops->num_labels + 1, sizeof(int*));
+    loops->entry_regs = calloc(loops->num_labels + 1, sizeof(int*));
+    loops->preheaders = calloc(loops->num_labels + 1, sizeof(ILOCInsn*));
+    loops->entry_order = calloc(loops->num_labels + 1, sizeof(int));
+    CHECK_MALLOC_PTR(loops->headers);
+    CHECK_MALLOC_PTR(loops->ends);
+    CHECK_MALLOC_PTR(loops->header_distances);
+    CHECK_MALLOC_PTR(loops->entry_regs);
+    CHECK_MALLOC_PTR(loops->preheaders);
+    CHECK_MALLOC_PTR(loops->entry_order);
+    return loops;
+}
+
+void LoopInfo_free(LoopInfo* loops)
+{
+    for (int i = 0; i < loops->num_labels; i++) {
+        free(loops->header_distances[i]);
+        free(loops->entry_regs[i]);
+    }
+    free(loops->headers);
+    free(loops->ends);
+    free(loops->header_distances);
+    free(loops->entry_regs);
+    free(loops->preheaders);
+    free(loops->entry_order);
+    free(loops);
+}
+
+/**
+ * @brief Recover the loops of one function from its back edges
+ * 
+ * A branch to a label that appears earlier in the function is a back edge
+ * (codegen emits while loops as "header: cond; cbr; body; jump header").
+ * 
+ * @param loops Loop tables to fill in (any previous contents are discarded)
+ * @param label First instruction of the function
+ * @param end First instruction after the function
+ * @param num_virtual_regs Number of virtual register ids in the function
+ */
+void find_loops(LoopInfo* loops, ILOCInsn* label, ILOCInsn* end, int num_virtual_regs)
+{
+    ILOCInsn** seen = calloc(loops->num_labels + 1, sizeof(ILOCInsn*));
+    CHECK_MALLOC_PTR(seen);
+    for (int i = 0; i < loops->num_labels; i++) {
+        loops->headers[i] = loops->ends[i] = NULL;
+        free(loops->header_distances[i]);
+        free(loops->entry_regs[i]);
+        loops->header_distances[i] = NULL;
+        loops->entry_regs[i] = NULL;
+    }
+    for (ILOCInsn* insn = label; insn != end; insn = insn->next) {
+        if (insn->form == LABEL && insn->op[0].type == JUMP_LABEL) {
+            seen[insn->op[0].id] = insn;
+        } else if (insn->form == JUMP || insn->form == CBR) {
+            for (int i = 0; i < 3; i++) {
+                if (insn->op[i].type == JUMP_LABEL && seen[insn->op[i].id] != NULL) {
+                    loops->headers[insn->op[i].id] = seen[insn->op[i].id];
+                    loops->ends[insn->op[i].id] = insn;
+                }
+            }
+        }
+    }
+    free(seen);
+
+    /* same scan as distance(), for every register at once */
+    for (int l = 0; l < loops->num_labels; l++) {
+        if (loops->headers[l] == NULL) {
+            continue;
+        }
+        int* distances = malloc((num_virtual_regs + 1) * sizeof(int));
+        CHECK_MALLOC_PTR(distances);
+        for (int vr = 0; vr < num_virtual_regs; vr++) {
+            distances[vr] = -1;     // not seen yet
+        }
+        int dist = 0;
+        for (ILOCInsn* insn = loops->headers[l]->next; insn != end; insn = insn->next, dist++) {
+            ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+            for (int i = 0; i < 3; i++) {
+                if (read_regs->op[i].type == VIRTUAL_REG && distances[read_regs->op[i].id] < 0) {
+                    distances[read_regs->op[i].id] = dist;
+                }
+            }
+            ILOCInsn_free(read_regs);
+            Operand write_reg = ILOCInsn_get_write_register(insn);
+            if (write_reg.type == VIRTUAL_REG && distances[write_reg.id] < 0) {
+                distances[write_reg.id] = INF_DIST;
+            }
+        }
+        for (int vr = 0; vr < num_virtual_regs; vr++) {
+            if (distances[vr] < 0) {
+                distances[vr] = INF_DIST;
+            }
+        }
+        loops->header_distances[l] = distances;
+    }
+}
+
+/**
+ * @brief Record where values live when the allocator reaches a loop header
+ * 
+ * Only loops entered by falling into the header are tracked (as in
+ * @ref split_loop_slots), since the entry code is inserted right before it.
+ */
+void enter_loop(LoopInfo* loops, int l, int* physical_regs, int num_physical_registers, ILOCInsn* prev_insn, int order)
 {
-    if(list == NULL) {
+    if (prev_insn == NULL || prev_insn->form == JUMP || prev_insn->form == CBR || prev_insn->form == RETURN) {
         return;
     }
-    int num_virtual_regs = num_virtual_registers(list);
+    loops->entry_regs[l] = malloc(num_physical_registers * sizeof(int));
+    CHECK_MALLOC_PTR(loops->entry_regs[l]);
+    for (int pr = 0; pr < num_physical_registers; pr++) {
+        loops->entry_regs[l][pr] = physical_regs[pr];
+    }
+    loops->preheaders[l] = prev_insn;
+    loops->entry_order[l] = order;
+}
+
+/**
+ * @brief Stop tracking the loops whose last back edge is an instruction
+ */
+void leave_loops(LoopInfo* loops, ILOCInsn* insn)
+{
+    for (int i = 0; i < 3 && (insn->form == JUMP || insn->form == CBR); i++) {
+        if (insn->op[i].type == JUMP_LABEL && loops->ends[insn->op[i].id] == insn) {
+            free(loops->entry_regs[insn->op[i].id]);
+            loops->entry_regs[insn->op[i].id] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Restore a loop-carried value at the headers of the loops it is evicted in
+ * 
+ * The code from a loop header down to the eviction has already been
+ * allocated and expects the value in the register it held on entry, which
+ * the rest of the body may now reuse. For every enclosing loop where that is
+ * the case, the value is saved once before the outermost such header and
+ * reloaded (or regenerated) into the register right after each header, so
+ * every iteration finds it where the header code expects it.
+ */
+void reload_at_headers(int vr, int pr, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, ILOCInsn* local_allocator, FunctionAllocStats* stats)
+{
+    while (true) {
+        int outer = -1;
+        for (int l = 0; l < loops->num_labels; l++) {
+            if (loops->entry_regs[l] != NULL && loops->entry_regs[l][pr] == vr &&
+                    loops->header_distances[l][vr] != INF_DIST &&
+                    (outer < 0 || loops->entry_order[l] < loops->entry_order[outer])) {
+                outer = l;
+            }
+        }
+        if (outer < 0) {
+            return;
+        }
+        if (remat_defs[vr] != NULL) {
+            insert_remat(remat_defs[vr]->op[0].imm, pr, loops->headers[outer]);
+            stats->remats++;
+        } else {
+            if (spill_offsets[vr] == INVALID_OFFSET) {
+                spill_offsets[vr] = insert_spill(pr, loops->preheaders[outer], local_allocator);
+                stats->spills++;
+                stats->frame_bytes += WORD_SIZE;
+            }
+            insert_load(spill_offsets[vr], pr, loops->headers[outer]);
+            stats->reloads++;
+        }
+        loops->entry_regs[outer][pr] = INVALID_VR;
+    }
+}
+
+/**
+ * @brief Pick a free register that survives the next call a value is live across
+ * 
+ * If the newly-defined virtual register is still needed after the next call
+ * in the function, prefer a free physical register that the callee does not
+ * clobber so that no caller-save spill is needed at the call.
+ * 
+ * @returns Physical register that was assigned to @c vr, or @c INVALID_VR if
+ * there is no such preference (the caller should use @ref allocate instead)
+ */
+int preferred_register(FunctionInfo* functions, int f, int call_index, int vr, int* physical_regs, int num_physical_registers, ILOCInsn* insn)
+{
+    ILOCInsn* call = insn->next;
+    while(call != functions[f].end && call->form != CALL){
+        call = call->next;
+    }
+    if(call == functions[f].end || distance(vr, call) == INF_DIST){
+        return INVALID_VR; // not live across a call
+    }
+    int callee = functions[f].callees[call_index];
+    if(callee < 0 || functions[callee].scc == functions[f].scc){
+        return INVALID_VR; // callee clobbers everything
+    }
+    for(int i = 0; i < num_physical_registers; i++){
+        if(physical_regs[i] == INVALID_VR && !functions[callee].clobbers[i]){
+            physical_regs[i] = vr;
+            return i;
+        }
+    }
+    return INVALID_VR;
+}
+
+/**
+ * @brief Allocate registers for a single function
+ * 
+ * @param functions Function summaries for the whole program
+ * @param f Index of the function to allocate
+ * @param num_physical_registers Maximum number of physical registers to be used
+ * @param loops Loop information (recomputed for this function)
+ */
+void allocate_function(FunctionInfo* functions, int f, int num_physical_registers, LoopInfo* loops)
+{
+    find_loops(loops, functions[f].label, functions[f].end, functions[f].num_virtual_regs);
+
+    // per-function tables are indexed by the function's own (dense) register ids
+    int num_virtual_regs = functions[f].num_virtual_regs;
+    ILOCInsn** remat_defs = find_remat_defs(functions[f].label, functions[f].end, num_virtual_regs);
+    FunctionAllocStats* stats = functions[f].stats;
+    stats->peak_pressure = peak_pressure(functions[f].label, functions[f].end, num_virtual_regs);
+
     int* physical_regs = calloc(num_physical_registers, sizeof(int));
     int* spill_offsets = calloc(num_virtual_regs, sizeof(int));
     CHECK_MALLOC_PTR(physical_regs);
@@ -120,10 +742,17 @@ void allocate_registers (InsnList* list, int num_physical_registers)
     }
     ILOCInsn* local_allocator = NULL;
     ILOCInsn* prev_insn = NULL;
-    FOR_EACH(ILOCInsn*, insn, list) {
+    int call_index = 0;
+    int loops_entered = 0;
+    for (ILOCInsn* insn = functions[f].label; insn != functions[f].end; insn = insn->next) {
         
+        // remember where values live on entry to each loop (see reload_at_headers())
+        if(insn->form == LABEL && insn->op[0].type == JUMP_LABEL && loops->headers[insn->op[0].id] == insn){
+            enter_loop(loops, insn->op[0].id, physical_regs, num_physical_registers, prev_insn, loops_entered++);
+        }
+
         //save reference to stack allocator instruction if i is a call label
-        if(insn->op->type == CALL_LABEL){
+        if(is_function_label(insn)){
             ILOCInsn* potential_allocator = insn->next->next->next; //assumes standard function prologue
             if(potential_allocator != NULL &&
                potential_allocator->form == ADD_I &&
@@ -137,13 +766,23 @@ void allocate_registers (InsnList* list, int num_physical_registers)
         // allocate registers for read operands
         ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
         for(int i = 0; i < 3; i++){
-            if(read_regs->op[i].type == VIRTUAL_REG){
+            if(read_regs->op[i].type == VIRTUAL_REG && !read_earlier(read_regs, i)){
                 int virtual_reg = read_regs->op[i].id;
-                int physical_reg = ensure(virtual_reg, physical_regs, spill_offsets, num_physical_registers, prev_insn, insn, local_allocator);
+                int physical_reg = ensure(virtual_reg, physical_regs, spill_offsets, remat_defs, loops, num_physical_registers, prev_insn, insn, local_allocator, stats);
                 replace_register(virtual_reg, physical_reg, insn);
+                prev_insn = last_inserted(prev_insn, insn);
+            }
+        }
 
-                if(distance(virtual_reg, insn) == INF_DIST){ //INFINITY
-                    physical_regs[physical_reg] = INVALID_VR; //INVALID
+        // free registers whose values die here only once every operand has
+        // its register, so a later reload cannot clobber an earlier operand
+        for(int i = 0; i < 3; i++){
+            if(read_regs->op[i].type == VIRTUAL_REG && !read_earlier(read_regs, i) &&
+                    !live_after(read_regs->op[i].id, insn, loops)){
+                for(int pr = 0; pr < num_physical_registers; pr++){
+                    if(physical_regs[pr] == read_regs->op[i].id){
+                        physical_regs[pr] = INVALID_VR; //INVALID
+                    }
                 }
             }
         }
@@ -154,76 +793,1184 @@ void allocate_registers (InsnList* list, int num_physical_registers)
         if(write_reg.type == VIRTUAL_REG) {
             int virtual_reg = write_reg.id;
             
-            int physical_reg = allocate(virtual_reg, physical_regs, spill_offsets, num_physical_registers, prev_insn, insn, local_allocator);
+            int physical_reg = preferred_register(functions, f, call_index, virtual_reg, physical_regs, num_physical_registers, insn);
+            if(physical_reg == INVALID_VR){
+                physical_reg = allocate(virtual_reg, physical_regs, spill_offsets, remat_defs, loops, num_physical_registers, prev_insn, insn, local_allocator, stats);
+            }
             replace_register(virtual_reg, physical_reg, insn);
+            spill_offsets[virtual_reg] = INVALID_OFFSET; // any old spill slot is now stale
+
+            if(!live_after(virtual_reg, insn, loops)){ // dead definition
+                physical_regs[physical_reg] = INVALID_VR;
+            }
         }
         
-        // spill all registers before a call instruction
+        // save registers that are live across a call instruction and that the
+        // callee may overwrite; dead values are simply dropped, and live ones
+        // are reloaded lazily by ensure()
         if(insn->form == CALL){
+            int callee = functions[f].callees[call_index++];
+            bool* clobbers = NULL; // unknown callee or same SCC: assume all
+            if(callee >= 0 && functions[callee].scc != functions[f].scc){
+                clobbers = functions[callee].clobbers;
+            }
             for(int i = 0; i < num_physical_registers; i++){
-                if(physical_regs[i] != INVALID_VR){ //INVALID
-                    spill(i, physical_regs, spill_offsets, prev_insn, local_allocator);
+                if(physical_regs[i] == INVALID_VR){ //INVALID
+                    continue;
+                }
+                if(!live_after(physical_regs[i], insn, loops)){
+                    physical_regs[i] = INVALID_VR;
+                } else if(clobbers == NULL || clobbers[i]){
+                    spill(i, physical_regs, spill_offsets, remat_defs, loops, prev_insn, local_allocator, stats);
+                    stats->call_site_spills++;
                 }
             }
         }
         
+        leave_loops(loops, insn);
+
         // save reference to i to facilitate spilling before next instruction
         prev_insn = insn;
     }
     free(physical_regs);
     free(spill_offsets);
+    free(remat_defs);
 }
 
-int ensure(int vr, int* physical_regs, int* spill_offsets, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator)
+/**
+ * @brief Compute the set of physical registers a function may overwrite
+ * 
+ * Includes registers written directly by the (already allocated) function
+ * body and the summaries of its callees. Calls to unknown functions
+ * conservatively clobber every register.
+ */
+void summarize_clobbers(FunctionInfo* functions, int f, int num_physical_registers)
 {
-    // check if already allocated
-    for(int i = 0; i < num_physical_registers; i++){
-        if(physical_regs[i] == vr){
-            return i;
+    bool* clobbers = functions[f].clobbers;
+    for (ILOCInsn* insn = functions[f].label; insn != functions[f].end; insn = insn->next) {
+        Operand write_reg = ILOCInsn_get_write_register(insn);
+        if (write_reg.type == PHYSICAL_REG && write_reg.id < num_physical_registers) {
+            clobbers[write_reg.id] = true;
         }
     }
-    
-    // allocate new register
-    int pr = allocate(vr, physical_regs, spill_offsets, num_physical_registers, prev_insn, insn, local_allocator);
-    
-    // load from spill if necessary
-    if(spill_offsets[vr] != INVALID_OFFSET){ //SPILLED
-        insert_load(spill_offsets[vr], pr, prev_insn);
-        spill_offsets[vr] = INVALID_OFFSET;
+    for (int i = 0; i < functions[f].num_callees; i++) {
+        int callee = functions[f].callees[i];
+        for (int r = 0; r < num_physical_registers; r++) {
+            if (callee < 0 || functions[callee].clobbers[r]) {
+                clobbers[r] = true;
+            }
+        }
     }
-    return pr;
 }
 
-int allocate(int vr, int* physical_regs, int* spill_offsets, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator)
+
+/**
+ * @brief Stack slot accessed inside a loop (see @ref split_loop_slots)
+ */
+typedef struct SlotUse
 {
-    // check for free register
-    for(int i = 0; i < num_physical_registers; i++){
-        if(physical_regs[i] == INVALID_VR){ //INVALID
+    long offset;    /**< @brief BP-based offset of the slot */
+    int loads;      /**< @brief Number of loadAI instructions that read it */
+    int stores;     /**< @brief Number of storeAI instructions that write it */
+} SlotUse;
+
+/**
+ * @brief Check whether an instruction is "loadAI [BP+c] => r"
+ */
+bool is_frame_load(ILOCInsn* insn)
+{
+    return insn->form == LOAD_AI && insn->op[0].type == BASE_REG;
+}
+
+/**
+ * @brief Check whether an instruction is "storeAI r => [BP+c]"
+ */
+bool is_frame_store(ILOCInsn* insn)
+{
+    return insn->form == STORE_AI && insn->op[1].type == BASE_REG;
+}
+
+/**
+ * @brief Check whether an instruction reads or writes a physical register
+ */
+bool mentions_physical(ILOCInsn* insn, int pr)
+{
+    for (int i = 0; i < 3; i++) {
+        if (insn->op[i].type == PHYSICAL_REG && insn->op[i].id == pr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check whether a physical register may be read before it is
+ * overwritten, scanning straight-line code from @c start to @c end
+ */
+bool read_before_write(int pr, ILOCInsn* start, ILOCInsn* end)
+{
+    for (ILOCInsn* insn = start; insn != end; insn = insn->next) {
+        ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+        bool read = mentions_physical(read_regs, pr);
+        ILOCInsn_free(read_regs);
+        if (read) {
+            return true;
+        }
+        Operand write_reg = ILOCInsn_get_write_register(insn);
+        if (write_reg.type == PHYSICAL_REG && write_reg.id == pr) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check whether a branch target is a function epilogue
+ * 
+ * Return statements jump to "i2i BP => SP; pop BP; return", after which the
+ * frame's slots are dead and need not be written back.
+ */
+bool leaves_frame(ILOCInsn* label)
+{
+    for (ILOCInsn* insn = label->next; insn != NULL; insn = insn->next) {
+        if (insn->form == RETURN) {
+            return true;
+        }
+        if (insn->form != I2I && insn->form != POP && insn->form != LABEL) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Split the live ranges of stack slots around one loop
+ * 
+ * Local variables and parameters live in stack slots, and temporaries never
+ * cross basic blocks, so every iteration of a loop reloads its variables
+ * from memory. For slots used more than once inside an (allocated) loop,
+ * this keeps the value in a physical register that the loop does not
+ * otherwise touch:
+ *   * it is loaded on the entry edge (just before the header label),
+ *   * loads and stores in the loop become register copies, and
+ *   * it is stored on the exit edge (just after the exit label) if the loop
+ *     writes it. Return paths skip the store because the frame is popped.
+ * 
+ * Registers clobbered by calls inside the loop are never used. Loops with
+ * any other kind of BP access, or that are entered or exited other than
+ * through the header and the label after the back edge, are left alone.
+ * 
+ * @param functions Function summaries for the whole program
+ * @param f Index of the (already allocated) function
+ * @param header Loop header label
+ * @param back_edge Last back edge branch of the loop
+ * @param loops Loop information (used for the number of jump labels)
+ * @param num_physical_registers Number of physical registers available
+ * @returns Number of slots kept in registers
+ */
+int split_loop_slots(FunctionInfo* functions, int f, ILOCInsn* header, ILOCInsn* back_edge, LoopInfo* loops, int num_physical_registers)
+{
+    ILOCInsn* exit_label = back_edge->next;
+    if (exit_label == NULL || exit_label->form != LABEL || exit_label->op[0].type != JUMP_LABEL) {
+        return 0;
+    }
+
+    /* find the entry edge and the number of calls made before the loop */
+    ILOCInsn* preheader = NULL;
+    int call_index = 0;
+    for (ILOCInsn* insn = functions[f].label; insn != header; insn = insn->next) {
+        preheader = insn;
+        if (insn->form == CALL) {
+            call_index++;
+        }
+    }
+    if (preheader == NULL || preheader->form == JUMP || preheader->form == RETURN) {
+        return 0;
+    }
+
+    ILOCInsn** labels = calloc(loops->num_labels + 1, sizeof(ILOCInsn*));
+    bool* in_loop = calloc(loops->num_labels + 1, sizeof(bool));
+    bool* unavailable = calloc(num_physical_registers, sizeof(bool));
+    SlotUse* slots = calloc(count_insns(header, exit_label), sizeof(SlotUse));
+    CHECK_MALLOC_PTR(labels);
+    CHECK_MALLOC_PTR(in_loop);
+    CHECK_MALLOC_PTR(unavailable);
+    CHECK_MALLOC_PTR(slots);
+    int num_slots = 0;
+    bool ok = true;
+
+    /* scan the loop: registers it uses or its calls clobber, and the slots it accesses */
+    for (ILOCInsn* insn = functions[f].label; insn != functions[f].end; insn = insn->next) {
+        if (insn->form == LABEL && insn->op[0].type == JUMP_LABEL) {
+            labels[insn->op[0].id] = insn;
+        }
+    }
+    for (ILOCInsn* insn = header; insn != exit_label; insn = insn->next) {
+        if (insn->form == LABEL && insn->op[0].type == JUMP_LABEL) {
+            in_loop[insn->op[0].id] = true;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (insn->op[i].type == PHYSICAL_REG && insn->op[i].id < num_physical_registers) {
+                unavailable[insn->op[i].id] = true;
+            } else if (insn->op[i].type == BASE_REG &&
+                    !(is_frame_load(insn) && i == 0) && !(is_frame_store(insn) && i == 1)) {
+                ok = false;  // BP escapes; slots may be accessed indirectly
+            }
+        }
+        if (insn->form == CALL) {
+            int callee = functions[f].callees[call_index++];
+            for (int r = 0; r < num_physical_registers; r++) {
+                if (callee < 0 || functions[callee].scc == functions[f].scc || functions[callee].clobbers[r]) {
+                    unavailable[r] = true;
+                }
+            }
+        }
+        if (is_frame_load(insn) || is_frame_store(insn)) {
+            long offset = is_frame_load(insn) ? insn->op[1].imm : insn->op[2].imm;
+            int s = 0;
+            while (s < num_slots && slots[s].offset != offset) {
+                s++;
+            }
+            if (s == num_slots) {
+                slots[num_slots++].offset = offset;
+            }
+            if (is_frame_load(insn)) {
+                slots[s].loads++;
+            } else {
+                slots[s].stores++;
+            }
+        }
+    }
+
+    /* branches must stay inside the loop, go to its exit, or return */
+    bool inside = false;
+    for (ILOCInsn* insn = functions[f].label; ok && insn != functions[f].end; insn = insn->next) {
+        if (insn == header || insn == exit_label) {
+            inside = (insn == header);
+        }
+        if (insn->form != JUMP && insn->form != CBR) {
+            continue;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (insn->op[i].type != JUMP_LABEL) {
+                continue;
+            }
+            int target = insn->op[i].id;
+            bool to_loop = in_loop[target] || target == exit_label->op[0].id;
+            if (inside ? !to_loop && (labels[target] == NULL || !leaves_frame(labels[target]))
+                       : to_loop) {
+                ok = false;
+            }
+        }
+    }
+
+    /* assign free registers to the most heavily used slots */
+    int split = 0;
+    for (int r = 0; ok && r < num_physical_registers; r++) {
+        if (unavailable[r] || read_before_write(r, exit_label, functions[f].end)) {
+            continue;
+        }
+        int best = -1;
+        for (int s = 0; s < num_slots; s++) {
+            int uses = slots[s].loads + slots[s].stores;
+            if (uses > 1 && (best < 0 || uses > slots[best].loads + slots[best].stores)) {
+                best = s;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        long offset = slots[best].offset;
+        for (ILOCInsn* insn = header; insn != exit_label; insn = insn->next) {
+            if (is_frame_load(insn) && insn->op[1].imm == offset) {
+                insn->form = I2I;
+                insn->op[0] = physical_register(r);
+                insn->op[1] = insn->op[2];
+                insn->op[2] = empty_operand();
+            } else if (is_frame_store(insn) && insn->op[2].imm == offset) {
+                insn->form = I2I;
+                insn->op[1] = physical_register(r);
+                insn->op[2] = empty_operand();
+            }
+        }
+        insert_load(offset, r, preheader);
+        if (slots[best].stores > 0) {
+            ILOCInsn* store = ILOCInsn_new_3op(STORE_AI,
+                    physical_register(r), base_register(), int_const(offset));
+            insert_after(store, exit_label);
+        }
+        slots[best].loads = slots[best].stores = 0;
+        split++;
+    }
+
+    free(labels);
+    free(in_loop);
+    free(unavailable);
+    free(slots);
+    return split;
+}
+
+/**
+ * @brief Split stack slot live ranges around every loop in a function
+ * 
+ * Inner loops are handled first so that an outer loop can in turn keep the
+ * same slot in a register across the inner loop's entry and exit moves.
+ * 
+ * @returns Number of (loop, slot) pairs kept in registers
+ */
+int split_live_ranges(FunctionInfo* functions, int f, LoopInfo* loops, int num_physical_registers)
+{
+    int split = 0;
+    bool* done = calloc(loops->num_labels + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(done);
+    while (true) {
+        int inner = -1;
+        int inner_size = INT_MAX;
+        for (int i = 0; i < loops->num_labels; i++) {
+            if (loops->headers[i] != NULL && !done[i]) {
+                int size = count_insns(loops->headers[i], loops->ends[i]);
+                if (size < inner_size) {
+                    inner = i;
+                    inner_size = size;
+                }
+            }
+        }
+        if (inner < 0) {
+            break;
+        }
+        done[inner] = true;
+        split += split_loop_slots(functions, f, loops->headers[inner], loops->ends[inner], loops, num_physical_registers);
+    }
+    free(done);
+    return split;
+}
+
+/**
+ * @brief Remove an instruction from a list and deallocate it
+ * 
+ * @param list List containing the instruction
+ * @param prev_insn Instruction directly before @c insn (or NULL if it is the head)
+ * @param insn Instruction to remove
+ */
+void remove_insn(InsnList* list, ILOCInsn* prev_insn, ILOCInsn* insn)
+{
+    if (prev_insn == NULL) {
+        list->head = insn->next;
+    } else {
+        prev_insn->next = insn->next;
+    }
+    if (list->tail == insn) {
+        list->tail = prev_insn;
+    }
+    list->size--;
+    ILOCInsn_free(insn);
+}
+
+/**
+ * @brief Check whether an instruction reads a virtual register
+ */
+bool reads_virtual(ILOCInsn* insn, int vr)
+{
+    bool found = false;
+    ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+    for (int i = 0; i < 3; i++) {
+        if (read_regs->op[i].type == VIRTUAL_REG && read_regs->op[i].id == vr) {
+            found = true;
+        }
+    }
+    ILOCInsn_free(read_regs);
+    return found;
+}
+
+/**
+ * @brief Check whether an instruction reads a physical register
+ */
+bool reads_physical(ILOCInsn* insn, int pr)
+{
+    bool found = false;
+    ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+    for (int i = 0; i < 3; i++) {
+        if (read_regs->op[i].type == PHYSICAL_REG && read_regs->op[i].id == pr) {
+            found = true;
+        }
+    }
+    ILOCInsn_free(read_regs);
+    return found;
+}
+
+/**
+ * @brief Check whether an instruction reads RET
+ */
+bool reads_ret(ILOCInsn* insn)
+{
+    bool found = false;
+    ILOCInsn* read_regs = ILOCInsn_get_read_registers(insn);
+    for (int i = 0; i < 3; i++) {
+        if (read_regs->op[i].type == RETURN_REG) {
+            found = true;
+        }
+    }
+    ILOCInsn_free(read_regs);
+    return found;
+}
+
+/**
+ * @brief Check whether an instruction (possibly) overwrites RET or ends a basic block
+ * 
+ * Values cannot be kept in RET across any of these instructions.
+ */
+bool changes_ret(ILOCInsn* insn)
+{
+    if (insn->form == LABEL || insn->form == JUMP || insn->form == CBR ||
+            insn->form == CALL || insn->form == RETURN) {
+        return true;
+    }
+    return ILOCInsn_get_write_register(insn).type == RETURN_REG;
+}
+
+/**
+ * @brief Replace every occurrence of a virtual register in an instruction
+ */
+void rename_virtual(ILOCInsn* insn, int vr, Operand reg)
+{
+    for (int i = 0; i < 3; i++) {
+        if (insn->op[i].type == VIRTUAL_REG && insn->op[i].id == vr) {
+            insn->op[i] = reg;
+        }
+    }
+}
+
+/**
+ * @brief Try to coalesce a single copy instruction
+ * 
+ * Three kinds of copies are handled (all within one function, and only when
+ * the registers involved have a single definition):
+ *   * @c "i2i rA => rB" where rA dies at the copy: uses of rB are renamed to rA
+ *   * @c "i2i RET => rB" where every use of rB comes before RET changes (or
+ *     the block ends): uses of rB read RET directly
+ *   * @c "i2i rA => RET" where rA is defined earlier in the same block and
+ *     only used by the copy: the definition writes RET directly
+ * 
+ * @param copy Copy (i2i) instruction
+ * @param end First instruction after the current function
+ * @param def_counts Number of definitions of each virtual register
+ * @param last_defs Most recent definition of each virtual register
+ * @returns True if the copy is now redundant and can be removed
+ */
+bool coalesce_copy(ILOCInsn* copy, ILOCInsn* end, int* def_counts, ILOCInsn** last_defs)
+{
+    Operand src = copy->op[0];
+    Operand dst = copy->op[1];
+
+    if (src.type == VIRTUAL_REG && dst.type == VIRTUAL_REG) {
+        if (def_counts[src.id] != 1 || def_counts[dst.id] != 1) {
+            return false;
+        }
+        for (ILOCInsn* insn = copy->next; insn != end; insn = insn->next) {
+            if (reads_virtual(insn, src.id)) {
+                return false; // source is still live; the two would interfere
+            }
+        }
+        for (ILOCInsn* insn = copy->next; insn != end; insn = insn->next) {
+            rename_virtual(insn, dst.id, src);
+        }
+        return true;
+    }
+
+    if (src.type == RETURN_REG && dst.type == VIRTUAL_REG) {
+        if (def_counts[dst.id] != 1) {
+            return false;
+        }
+        bool ret_changed = false;
+        for (ILOCInsn* insn = copy->next; insn != end; insn = insn->next) {
+            if (reads_virtual(insn, dst.id) && ret_changed) {
+                return false;
+            }
+            if (changes_ret(insn)) {
+                ret_changed = true;
+            }
+        }
+        for (ILOCInsn* insn = copy->next; insn != end; insn = insn->next) {
+            rename_virtual(insn, dst.id, return_register());
+        }
+        return true;
+    }
+
+    if (src.type == VIRTUAL_REG && dst.type == RETURN_REG) {
+        ILOCInsn* def = last_defs[src.id];
+        if (def_counts[src.id] != 1 || def == NULL) {
+            return false;
+        }
+        for (ILOCInsn* insn = def->next; insn != copy; insn = insn->next) {
+            if (reads_virtual(insn, src.id) || reads_ret(insn) || changes_ret(insn)) {
+                return false;
+            }
+        }
+        for (ILOCInsn* insn = copy->next; insn != end; insn = insn->next) {
+            if (reads_virtual(insn, src.id)) {
+                return false;
+            }
+        }
+        rename_virtual(def, src.id, return_register());
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Coalesce copies between registers in one function before allocation
+ * 
+ * See @ref coalesce_copy for the kinds of copies that are merged. The first
+ * instruction of the function is never removed.
+ * 
+ * @param list ILOC program (modified in place)
+ * @param label First instruction of the function
+ * @param end First instruction after the function
+ * @param num_virtual_regs Number of virtual register ids in the function
+ * @returns Number of copy instructions removed
+ */
+int coalesce_moves(InsnList* list, ILOCInsn* label, ILOCInsn* end, int num_virtual_regs)
+{
+    int* def_counts = calloc(num_virtual_regs, sizeof(int));
+    ILOCInsn** last_defs = calloc(num_virtual_regs, sizeof(ILOCInsn*));
+    CHECK_MALLOC_PTR(def_counts);
+    CHECK_MALLOC_PTR(last_defs);
+    for (ILOCInsn* insn = label; insn != end; insn = insn->next) {
+        Operand write_reg = ILOCInsn_get_write_register(insn);
+        if (write_reg.type == VIRTUAL_REG) {
+            def_counts[write_reg.id]++;
+        }
+    }
+
+    int removed = 0;
+    ILOCInsn* prev_insn = NULL;
+    ILOCInsn* insn = label;
+    while (insn != end) {
+        if (insn != label && insn->form == I2I && coalesce_copy(insn, end, def_counts, last_defs)) {
+            ILOCInsn* next = insn->next;
+            remove_insn(list, prev_insn, insn);
+            insn = next;
+            removed++;
+            continue;
+        }
+        Operand write_reg = ILOCInsn_get_write_register(insn);
+        if (write_reg.type == VIRTUAL_REG) {
+            last_defs[write_reg.id] = insn;
+        }
+        prev_insn = insn;
+        insn = insn->next;
+    }
+
+    free(def_counts);
+    free(last_defs);
+    return removed;
+}
+
+/**
+ * @brief Remove copies whose source and destination ended up in the same register
+ * 
+ * @param list Allocated ILOC program (modified in place)
+ * @returns Number of copy instructions removed
+ */
+int remove_self_moves(InsnList* list)
+{
+    int removed = 0;
+    ILOCInsn* prev_insn = NULL;
+    ILOCInsn* insn = list->head;
+    while (insn != NULL) {
+        ILOCInsn* next = insn->next;
+        if (insn->form == I2I && insn->op[0].type == insn->op[1].type &&
+                (insn->op[0].type != PHYSICAL_REG || insn->op[0].id == insn->op[1].id)) {
+            remove_insn(list, prev_insn, insn);
+            removed++;
+        } else {
+            prev_insn = insn;
+        }
+        insn = next;
+    }
+    return removed;
+}
+
+void allocate_registers (InsnList* list, int num_physical_registers)
+{
+    AllocStats_free(allocate_registers_with_stats(list, num_physical_registers));
+}
+
+AllocStats* allocate_registers_with_stats (InsnList* list, int num_physical_registers)
+{
+    AllocStats* stats = calloc(1, sizeof(AllocStats));
+    CHECK_MALLOC_PTR(stats);
+    stats->num_physical_registers = num_physical_registers;
+    if(list == NULL || list->head == NULL) {
+        return stats;
+    }
+    renumber_virtual_registers(list);
+
+    /* split into functions and coalesce copies within each one */
+    int num_functions = 0;
+    FunctionInfo* functions = find_functions(list, num_physical_registers, &num_functions);
+    stats->num_functions = num_functions;
+    stats->functions = calloc(num_functions, sizeof(FunctionAllocStats));
+    CHECK_MALLOC_PTR(stats->functions);
+    for (int f = 0; f < num_functions; f++) {
+        FunctionAllocStats* fstats = &stats->functions[f];
+        functions[f].stats = fstats;
+        if (is_function_label(functions[f].label)) {
+            snprintf(fstats->name, MAX_TOKEN_LEN, "%s", functions[f].label->op[0].str);
+        }
+        fstats->num_virtual_regs = functions[f].num_virtual_regs;
+        fstats->insns_before = count_insns(functions[f].label, functions[f].end);
+        fstats->coalesced_copies = coalesce_moves(list, functions[f].label, functions[f].end, functions[f].num_virtual_regs);
+        stats->coalesced_copies += fstats->coalesced_copies;
+    }
+    LoopInfo* loops = LoopInfo_new(list);
+
+    /* order functions bottom-up over the call graph (callees first) */
+    int* stack = calloc(num_functions, sizeof(int));
+    int* order = calloc(num_functions, sizeof(int));
+    CHECK_MALLOC_PTR(stack);
+    CHECK_MALLOC_PTR(order);
+    int next_index = 0, next_scc = 0, stack_size = 0, order_size = 0;
+    for (int f = 0; f < num_functions; f++) {
+        if (functions[f].index < 0) {
+            find_sccs(functions, f, &next_index, &next_scc, stack, &stack_size, order, &order_size);
+        }
+    }
+
+    /* allocate each SCC, then share a single clobber summary across its
+     * members (calls within an SCC were already treated conservatively) */
+    for (int start = 0; start < num_functions; ) {
+        int scc_end = start;
+        while (scc_end < num_functions && functions[order[scc_end]].scc == functions[order[start]].scc) {
+            allocate_function(functions, order[scc_end], num_physical_registers, loops);
+            functions[order[scc_end]].stats->split_slots =
+                split_live_ranges(functions, order[scc_end], loops, num_physical_registers);
+            summarize_clobbers(functions, order[scc_end], num_physical_registers);
+            scc_end++;
+        }
+        for (int i = start; i < scc_end; i++) {
+            for (int j = start; j < scc_end; j++) {
+                for (int r = 0; r < num_physical_registers; r++) {
+                    functions[order[i]].clobbers[r] |= functions[order[j]].clobbers[r];
+                }
+            }
+        }
+        start = scc_end;
+    }
+    stats->removed_self_moves = remove_self_moves(list);
+
+    for (int f = 0; f < num_functions; f++) {
+        stats->functions[f].insns_after = count_insns(functions[f].label, functions[f].end);
+        free(functions[f].callees);
+        free(functions[f].clobbers);
+    }
+    free(functions);
+    free(stack);
+    free(order);
+    LoopInfo_free(loops);
+    return stats;
+}
+
+void AllocStats_print (AllocStats* stats, FILE* output)
+{
+    fprintf(output, "Register allocation with %d physical registers: "
+            "%d copies coalesced, %d self-moves removed\n",
+            stats->num_physical_registers, stats->coalesced_copies, stats->removed_self_moves);
+    fprintf(output, "%-20s %6s %5s %7s %8s %7s %6s %11s %6s %7s %7s\n",
+            "function", "vregs", "peak", "spills", "reloads", "remats",
+            "frame", "call-spills", "split", "before", "after");
+    for (int f = 0; f < stats->num_functions; f++) {
+        FunctionAllocStats* fstats = &stats->functions[f];
+        fprintf(output, "%-20s %6d %5d %7d %8d %7d %6d %11d %6d %7d %7d\n",
+                fstats->name[0] != '\0' ? fstats->name : "(top)",
+                fstats->num_virtual_regs, fstats->peak_pressure,
+                fstats->spills, fstats->reloads, fstats->remats,
+                fstats->frame_bytes, fstats->call_site_spills, fstats->split_slots,
+                fstats->insns_before, fstats->insns_after);
+    }
+}
+
+void AllocStats_print_json (AllocStats* stats, FILE* output)
+{
+    fprintf(output, "{\"num_physical_registers\": %d, \"coalesced_copies\": %d, "
+            "\"removed_self_moves\": %d, \"functions\": [",
+            stats->num_physical_registers, stats->coalesced_copies, stats->removed_self_moves);
+    for (int f = 0; f < stats->num_functions; f++) {
+        FunctionAllocStats* fstats = &stats->functions[f];
+        fprintf(output, "%s\n  {\"name\": \"%s\", \"num_virtual_regs\": %d, "
+                "\"peak_pressure\": %d, \"spills\": %d, \"reloads\": %d, "
+                "\"remats\": %d, \"frame_bytes\": %d, \"call_site_spills\": %d, "
+                "\"coalesced_copies\": %d, \"split_slots\": %d, \"insns_before\": %d, \"insns_after\": %d}",
+                f > 0 ? "," : "", fstats->name, fstats->num_virtual_regs,
+                fstats->peak_pressure, fstats->spills, fstats->reloads,
+                fstats->remats, fstats->frame_bytes, fstats->call_site_spills,
+                fstats->coalesced_copies, fstats->split_slots, fstats->insns_before, fstats->insns_after);
+    }
+    fprintf(output, "\n]}\n");
+}
+
+void AllocStats_free (AllocStats* stats)
+{
+    free(stats->functions);
+    free(stats);
+}
+
+/**
+ * @brief Check whether an instruction must stay in place when scheduling
+ *
+ * Labels and control transfers delimit blocks and prints must stay in order.
+ * Instructions that adjust SP or BP make up the function prologue, epilogue,
+ * and call sequences, which register allocation recognizes by position.
+ */
+bool is_schedule_barrier(ILOCInsn* insn)
+{
+    switch (insn->form) {
+        case LABEL: case JUMP: case CBR: case CALL: case RETURN:
+        case PRINT: case PHI: case PUSH: case POP:
+            return true;
+        default:
+        {
+            Operand write = ILOCInsn_get_write_register(insn);
+            return write.type == STACK_REG || write.type == BASE_REG;
+        }
+    }
+}
+
+/**
+ * @brief Check whether an instruction reads or writes memory
+ *
+ * @param insn Instruction to examine
+ * @param is_store Set to true if the instruction writes memory
+ */
+bool is_memory_access(ILOCInsn* insn, bool* is_store)
+{
+    *is_store = (insn->form == STORE || insn->form == STORE_AI || insn->form == STORE_AO);
+    return *is_store || insn->form == LOAD || insn->form == LOAD_AI || insn->form == LOAD_AO;
+}
+
+/**
+ * @brief Find the base register key and constant offset of a memory access
+ *
+ * @returns False if the address is the sum of two registers
+ */
+bool memory_address(ILOCInsn* insn, int* base, long* offset)
+{
+    switch (insn->form) {
+        case LOAD:      *base = register_key(insn->op[0]); *offset = 0;               return true;
+        case LOAD_AI:   *base = register_key(insn->op[0]); *offset = insn->op[1].imm; return true;
+        case STORE:     *base = register_key(insn->op[1]); *offset = 0;               return true;
+        case STORE_AI:  *base = register_key(insn->op[1]); *offset = insn->op[2].imm; return true;
+        default:        return false;
+    }
+}
+
+/**
+ * @brief Check whether two memory accesses in a block might overlap
+ *
+ * Accesses relative to the same base register (which nothing in between
+ * writes) overlap only if their offsets are less than a word apart.
+ */
+bool may_alias(ILOCInsn** block, InsnRegisters* regs, int i, int j)
+{
+    int base_i, base_j;
+    long offset_i, offset_j;
+    if (!memory_address(block[i], &base_i, &offset_i) ||
+        !memory_address(block[j], &base_j, &offset_j) || base_i != base_j) {
+        return true;
+    }
+    for (int k = i; k < j; k++) {
+        for (int w = 0; w < regs[k].num_writes; w++) {
+            if (regs[k].writes[w] == base_i) {
+                return true;
+            }
+        }
+    }
+    return labs(offset_i - offset_j) < WORD_SIZE;
+}
+
+/**
+ * @brief Find the minimum issue distance from one instruction to a later one
+ * in the same block
+ *
+ * @returns Cycles until the later instruction may issue (0 if it only has to
+ * stay behind the earlier one, -1 if they are independent)
+ */
+int dependence_latency(ILOCInsn** block, InsnRegisters* regs, int i, int j, PipelineConfig* config)
+{
+    int latency = -1;
+    for (int w = 0; w < regs[i].num_writes; w++) {
+        for (int r = 0; r < regs[j].num_reads; r++) {
+            if (regs[i].writes[w] == regs[j].reads[r]) {    /* true dependence */
+                int result = PipelineConfig_latency(config, block[i]->form, regs[i].writes[w]);
+                latency = (result > latency ? result : latency);
+            }
+        }
+        for (int v = 0; v < regs[j].num_writes; v++) {
+            if (regs[i].writes[w] == regs[j].writes[v] && latency < 0) {    /* output dependence */
+                latency = 0;
+            }
+        }
+    }
+    for (int r = 0; r < regs[i].num_reads; r++) {
+        for (int v = 0; v < regs[j].num_writes; v++) {
+            if (regs[i].reads[r] == regs[j].writes[v] && latency < 0) {     /* anti-dependence */
+                latency = 0;
+            }
+        }
+    }
+    bool store_i, store_j;
+    if (latency < 0 && is_memory_access(block[i], &store_i) && is_memory_access(block[j], &store_j) &&
+            (store_i || store_j) && may_alias(block, regs, i, j)) {
+        latency = 0;
+    }
+    return latency;
+}
+
+/**
+ * @brief Estimate the cycles needed to run a block on an idle pipeline
+ */
+long estimate_cycles(ILOCInsn** block, int* order, int n, PipelineConfig* config)
+{
+    PipelineModel* model = PipelineModel_new(config);
+    for (int k = 0; k < n; k++) {
+        PipelineModel_issue(model, block[order[k]]);
+    }
+    long cycles = model->cycles;
+    PipelineModel_free(model);
+    return cycles;
+}
+
+/**
+ * @brief Find (or add) a register key in a list of distinct keys
+ */
+int key_index(int* keys, int* num_keys, int key)
+{
+    for (int k = 0; k < *num_keys; k++) {
+        if (keys[k] == key) {
+            return k;
+        }
+    }
+    keys[*num_keys] = key;
+    return (*num_keys)++;
+}
+
+/**
+ * @brief Compute the maximum number of virtual registers live in a block
+ *
+ * A value is live at a point if its next access after that point is a read,
+ * or if it was written in the block and never read afterwards (so it is
+ * assumed to be live on exit). Only virtual registers count, so this is zero after allocation.
+ *
+ * @param regs Registers accessed by each instruction (in original order)
+ * @param order Instruction order to evaluate
+ * @param n Number of instructions
+ * @returns Maximum number of simultaneously live virtual registers
+ */
+int block_pressure(InsnRegisters* regs, int* order, int n)
+{
+    int max_ops = MAX_INSN_READS + MAX_INSN_WRITES;
+    int* keys = malloc(n * max_ops * sizeof(int));
+    int* ids = malloc(n * max_ops * sizeof(int));
+    CHECK_MALLOC_PTR(keys);
+    CHECK_MALLOC_PTR(ids);
+
+    /* number the virtual registers (reads first, then writes, per insn) */
+    int num_keys = 0;
+    for (int i = 0; i < n; i++) {
+        for (int r = 0; r < max_ops; r++) {
+            int key = r < MAX_INSN_READS ?
+                (r < regs[i].num_reads ? regs[i].reads[r] : -1) :
+                (r - MAX_INSN_READS < regs[i].num_writes ? regs[i].writes[r - MAX_INSN_READS] : -1);
+            ids[i * max_ops + r] = key >= NUM_FIXED_REGISTER_KEYS ?
+                key_index(keys, &num_keys, key) : -1;
+        }
+    }
+
+    /* values whose last access is a write are assumed to be live on exit */
+    int* seen = malloc((num_keys + 1) * sizeof(int));
+    bool* written = calloc(num_keys + 1, sizeof(bool));
+    bool* live_out = calloc(num_keys + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(seen);
+    CHECK_MALLOC_PTR(written);
+    CHECK_MALLOC_PTR(live_out);
+    for (int k = 0; k < num_keys; k++) {
+        seen[k] = -1;
+    }
+    for (int i = 0; i < n * max_ops; i++) {
+        if (ids[i] >= 0) {
+            live_out[ids[i]] = i % max_ops >= MAX_INSN_READS;
+        }
+    }
+
+    int max = 0;
+    for (int p = 0; p < n; p++) {
+        for (int w = MAX_INSN_READS; w < max_ops; w++) {
+            if (ids[order[p] * max_ops + w] >= 0) {
+                written[ids[order[p] * max_ops + w]] = true;
+            }
+        }
+        int live = 0;
+        for (int q = p + 1; q < n; q++) {
+            for (int r = 0; r < max_ops; r++) {
+                int id = ids[order[q] * max_ops + r];
+                if (id >= 0 && seen[id] != p) {
+                    seen[id] = p;
+                    live += r < MAX_INSN_READS ? 1 : 0; /* next access is a read */
+                }
+            }
+        }
+        for (int k = 0; k < num_keys; k++) {
+            if (written[k] && live_out[k] && seen[k] != p) {
+                live++; /* live on exit */
+            }
+        }
+        if (live > max) {
+            max = live;
+        }
+    }
+
+    free(keys);
+    free(ids);
+    free(seen);
+    free(written);
+    free(live_out);
+    return max;
+}
+
+/**
+ * @brief List-schedule a block of straight-line code
+ *
+ * Instructions are issued cycle by cycle, picking the ready instruction with
+ * the longest latency-weighted path to the end of the block (program order
+ * breaks ties). The new order is only kept if the pipeline model says it is
+ * faster and it does not need more virtual registers at once.
+ *
+ * @param block Instructions in program order (reordered in place)
+ * @param n Number of instructions
+ * @param config Pipeline timing
+ * @returns True if the block was reordered
+ */
+bool schedule_block(ILOCInsn** block, int n, PipelineConfig* config)
+{
+    InsnRegisters* regs = calloc(n, sizeof(InsnRegisters));
+    int* latency = malloc(n * n * sizeof(int));
+    long* priority = calloc(n, sizeof(long));
+    int* num_preds = calloc(n, sizeof(int));
+    long* earliest = calloc(n, sizeof(long));
+    int* order = calloc(n, sizeof(int));
+    int* original = calloc(n, sizeof(int));
+    bool* scheduled = calloc(n, sizeof(bool));
+    CHECK_MALLOC_PTR(regs);
+    CHECK_MALLOC_PTR(latency);
+    CHECK_MALLOC_PTR(priority);
+    CHECK_MALLOC_PTR(num_preds);
+    CHECK_MALLOC_PTR(earliest);
+    CHECK_MALLOC_PTR(order);
+    CHECK_MALLOC_PTR(original);
+    CHECK_MALLOC_PTR(scheduled);
+
+    /* dependence graph (latency[i * n + j] for i < j) */
+    for (int i = 0; i < n; i++) {
+        ILOCInsn_get_registers(block[i], &regs[i]);
+        original[i] = i;
+    }
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < j; i++) {
+            latency[i * n + j] = dependence_latency(block, regs, i, j, config);
+            if (latency[i * n + j] >= 0) {
+                num_preds[j]++;
+            }
+        }
+    }
+
+    /* priority: longest path to the end of the block */
+    for (int i = n - 1; i >= 0; i--) {
+        priority[i] = 1;
+        for (int w = 0; w < regs[i].num_writes; w++) {
+            long result = PipelineConfig_latency(config, block[i]->form, regs[i].writes[w]);
+            priority[i] = (result > priority[i] ? result : priority[i]);
+        }
+        for (int j = i + 1; j < n; j++) {
+            if (latency[i * n + j] >= 0 && latency[i * n + j] + priority[j] > priority[i]) {
+                priority[i] = latency[i * n + j] + priority[j];
+            }
+        }
+    }
+
+    /* issue cycle by cycle */
+    long cycle = 0;
+    int issued = 0;
+    for (int count = 0; count < n; ) {
+        int best = -1;
+        if (issued < config->issue_width) {
+            for (int i = 0; i < n; i++) {
+                if (!scheduled[i] && num_preds[i] == 0 && earliest[i] <= cycle &&
+                        (best < 0 || priority[i] > priority[best])) {
+                    best = i;
+                }
+            }
+        }
+        if (best < 0) {
+            cycle++;
+            issued = 0;
+            continue;
+        }
+        scheduled[best] = true;
+        order[count++] = best;
+        issued++;
+        for (int j = best + 1; j < n; j++) {
+            if (latency[best * n + j] >= 0) {
+                num_preds[j]--;
+                if (cycle + latency[best * n + j] > earliest[j]) {
+                    earliest[j] = cycle + latency[best * n + j];
+                }
+            }
+        }
+    }
+
+    /* keep the new order only if it helps without adding register pressure
+     * (which would cost spill code when scheduling before allocation) */
+    bool reordered = estimate_cycles(block, order, n, config) < estimate_cycles(block, original, n, config) &&
+        block_pressure(regs, order, n) <= block_pressure(regs, original, n);
+    if (reordered) {
+        ILOCInsn** copy = malloc(n * sizeof(ILOCInsn*));
+        CHECK_MALLOC_PTR(copy);
+        for (int k = 0; k < n; k++) {
+            copy[k] = block[order[k]];
+        }
+        memcpy(block, copy, n * sizeof(ILOCInsn*));
+        free(copy);
+    }
+
+    free(regs);
+    free(latency);
+    free(priority);
+    free(num_preds);
+    free(earliest);
+    free(order);
+    free(original);
+    free(scheduled);
+    return reordered;
+}
+
+int schedule_instructions (InsnList* list, PipelineConfig* config)
+{
+    int reordered = 0;
+    ILOCInsn* block[SCHEDULE_WINDOW];
+    ILOCInsn* prev_insn = NULL;
+    ILOCInsn* insn = list->head;
+    while (insn != NULL) {
+
+        /* gather straight-line code up to the next barrier */
+        int n = 0;
+        while (insn != NULL && n < SCHEDULE_WINDOW && !is_schedule_barrier(insn)) {
+            block[n++] = insn;
+            insn = insn->next;
+        }
+        if (n > 1 && schedule_block(block, n, config)) {
+            reordered++;
+            if (prev_insn == NULL) {
+                list->head = block[0];
+            } else {
+                prev_insn->next = block[0];
+            }
+            for (int k = 0; k < n - 1; k++) {
+                block[k]->next = block[k + 1];
+            }
+            block[n - 1]->next = insn;
+            if (insn == NULL) {
+                list->tail = block[n - 1];
+            }
+        }
+        if (n > 0) {
+            prev_insn = block[n - 1];
+        }
+
+        /* barriers stay in place */
+        if (insn != NULL && is_schedule_barrier(insn)) {
+            prev_insn = insn;
+            insn = insn->next;
+        }
+    }
+    return reordered;
+}
+
+int ensure(int vr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator, FunctionAllocStats* stats)
+{
+    // check if already allocated
+    for(int i = 0; i < num_physical_registers; i++){
+        if(physical_regs[i] == vr){
+            return i;
+        }
+    }
+    
+    // allocate new register
+    int pr = allocate(vr, physical_regs, spill_offsets, remat_defs, loops, num_physical_registers, prev_insn, insn, local_allocator, stats);
+    prev_insn = last_inserted(prev_insn, insn);
+    
+    // regenerate constant or load from spill if necessary (the spill slot
+    // keeps its value, so spilling this register again needs no store)
+    if(remat_defs[vr] != NULL){ // evicted constant (never has a stack slot)
+        insert_remat(remat_defs[vr]->op[0].imm, pr, prev_insn);
+        stats->remats++;
+    } else if(spill_offsets[vr] != INVALID_OFFSET){ //SPILLED
+        insert_load(spill_offsets[vr], pr, prev_insn);
+        stats->reloads++;
+    }
+    return pr;
+}
+
+int allocate(int vr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, int num_physical_registers, ILOCInsn* prev_insn, ILOCInsn* insn, ILOCInsn* local_allocator, FunctionAllocStats* stats)
+{
+    // check for free register
+    for(int i = 0; i < num_physical_registers; i++){
+        if(physical_regs[i] == INVALID_VR){ //INVALID
             physical_regs[i] = vr;
             return i;
         }
     }
     
-    // need to spill a register
+    // need to spill a register (the one whose next use is farthest away,
+    // counting uses inside loops as closer than they look); when reloading an
+    // operand, registers holding the instruction's other operands are only
+    // evicted if nothing else is left
+    bool reloading = reads_virtual(insn, vr);
     int fartherst_pr = -1;
     int fartherst_distance = INT_MIN;
-    for(int i = 0; i < num_physical_registers; i++){
-        int dist = distance(physical_regs[i], insn);
-        if(dist > fartherst_distance){
-            fartherst_distance = dist;
-            fartherst_pr = i;
+    for(int pass = 0; pass < 2 && fartherst_pr < 0; pass++){
+        for(int i = 0; i < num_physical_registers; i++){
+            if(pass == 0 && reloading && reads_physical(insn, i)){
+                continue; // holds another operand of insn
+            }
+            int dist = weighted_distance(physical_regs[i], insn, loops);
+            if(dist > fartherst_distance){
+                fartherst_distance = dist;
+                fartherst_pr = i;
+            }
         }
     }
-    spill(fartherst_pr, physical_regs, spill_offsets, prev_insn, local_allocator);
+    spill(fartherst_pr, physical_regs, spill_offsets, remat_defs, loops, prev_insn, local_allocator, stats);
     physical_regs[fartherst_pr] = vr;
     return fartherst_pr;
 }
 
-int spill(int pr, int* physical_regs, int* spill_offsets, ILOCInsn* prev_insn, ILOCInsn* local_allocator)
+int spill(int pr, int* physical_regs, int* spill_offsets, ILOCInsn** remat_defs, LoopInfo* loops, ILOCInsn* prev_insn, ILOCInsn* local_allocator, FunctionAllocStats* stats)
 {
     int vr = physical_regs[pr];
+    reload_at_headers(vr, pr, spill_offsets, remat_defs, loops, local_allocator, stats);
+    if(remat_defs[vr] != NULL){ // constant; regenerated by ensure() instead of stored
+        physical_regs[pr] = INVALID_VR;
+        return INVALID_OFFSET;
+    }
+    if(spill_offsets[vr] != INVALID_OFFSET){ // value is already in memory
+        physical_regs[pr] = INVALID_VR;
+        return spill_offsets[vr];
+    }
     int bp_offset = insert_spill(pr, prev_insn, local_allocator);
     spill_offsets[vr] = bp_offset;
+    stats->spills++;
+    stats->frame_bytes += WORD_SIZE;
     physical_regs[pr] = INVALID_VR; //INVALID
     return bp_offset;
 }
@@ -247,6 +1994,74 @@ int distance(int vr, ILOCInsn* insn)
         }
         current = current->next;
         dist++;
+        if(current != NULL && is_function_label(current)){
+            break; // end of function
+        }
     }
     return INF_DIST; //INFINITY
 }
+
+/**
+ * @brief Scale a distance by the loop nesting depth of the use
+ * 
+ * Each level of nesting makes a use @ref LOOP_WEIGHT times "closer"; each
+ * loop exited before the use makes it that much farther away.
+ */
+int scale_distance(int dist, int depth)
+{
+    long scaled = dist;
+    for (; depth > 0; depth--) {
+        scaled /= LOOP_WEIGHT;
+    }
+    for (; depth < 0 && scaled < INF_DIST; depth++) {
+        scaled = (scaled + 1) * LOOP_WEIGHT;
+    }
+    return scaled < INF_DIST ? (int)scaled : INF_DIST - 1;
+}
+
+int weighted_distance(int vr, ILOCInsn* insn, LoopInfo* loops)
+{
+    int dist = 0;
+    int depth = 0; // loop depth relative to insn
+    for(ILOCInsn* current = insn->next; current != NULL && !is_function_label(current); current = current->next){
+        if(reads_virtual(current, vr)){
+            return scale_distance(dist, depth);
+        }
+        Operand write_reg = ILOCInsn_get_write_register(current);
+        if(write_reg.type == VIRTUAL_REG && write_reg.id == vr){
+            return INF_DIST;
+        }
+        if(current->form == LABEL && current->op[0].type == JUMP_LABEL &&
+                loops->headers[current->op[0].id] == current){
+            depth++; // entering a nested loop
+        }
+        for(int i = 0; i < 3 && (current->form == JUMP || current->form == CBR); i++){
+            if(current->op[i].type != JUMP_LABEL || loops->ends[current->op[i].id] != current){
+                continue;
+            }
+            depth--; // leaving a loop
+            if(depth < 0){
+                // the loop contains insn, so the value may be used again on
+                // the next iteration before execution gets back to insn
+                int wrap = (vr >= 0 ? loops->header_distances[current->op[i].id][vr] : INF_DIST);
+                if(wrap != INF_DIST){
+                    return scale_distance(dist + wrap, depth + 1);
+                }
+            }
+        }
+        dist++;
+    }
+    return INF_DIST;
+}
+
+/**
+ * @brief Check whether a virtual register may still be read after an instruction
+ * 
+ * Unlike @ref distance, this follows the back edges of the loops containing
+ * @c insn (as @ref weighted_distance does), so a value that is read again on
+ * the next iteration stays live past its last use in the loop body.
+ */
+bool live_after(int vr, ILOCInsn* insn, LoopInfo* loops)
+{
+    return weighted_distance(vr, insn, loops) != INF_DIST;
+}
@@ -0,0 +1,159 @@
+#include "pipeline.h"
+
+void PipelineConfig_init (PipelineConfig* config)
+{
+    config->issue_width = 2;
+    for (int form = 0; form < NUM_INSN_FORMS; form++) {
+        config->latency[form] = 1;
+    }
+    config->latency[LOAD] = config->latency[LOAD_AI] = config->latency[LOAD_AO] = 3;
+    config->latency[POP] = 3;
+    config->latency[MULT] = config->latency[MULT_I] = 3;
+    config->latency[DIV] = 20;
+    config->branch_penalty = 1;
+}
+
+int PipelineConfig_latency (PipelineConfig* config, InsnForm form, int key)
+{
+    if ((form == PUSH || form == POP) && key == SP_KEY) {
+        return 1;
+    }
+    return config->latency[form];
+}
+
+PipelineModel* PipelineModel_new (PipelineConfig* config)
+{
+    PipelineModel* model = (PipelineModel*)calloc(1, sizeof(PipelineModel));
+    CHECK_MALLOC_PTR(model);
+    model->config = *config;
+    if (model->config.issue_width < 1) {
+        model->config.issue_width = 1;
+    }
+    return model;
+}
+
+void PipelineModel_reset (PipelineModel* model)
+{
+    model->instructions = 0;
+    model->cycles = 0;
+    model->operand_stalls = 0;
+    model->branch_stalls = 0;
+    memset(model->stalls_by_form, 0, sizeof(model->stalls_by_form));
+    model->cycle = 0;
+    model->issued = 0;
+    model->next_issue = 0;
+    for (int k = 0; k < model->num_keys; k++) {
+        model->ready[k] = 0;
+    }
+}
+
+/**
+ * @brief Make room for a register key in the ready table of a pipeline model
+ */
+void PipelineModel_reserve (PipelineModel* model, int key)
+{
+    if (key < model->num_keys) {
+        return;
+    }
+    int num_keys = (model->num_keys > 0 ? model->num_keys : NUM_FIXED_REGISTER_KEYS + 64);
+    while (key >= num_keys) {
+        num_keys *= 2;
+    }
+    model->ready = (long*)realloc(model->ready, num_keys * sizeof(long));
+    model->producer = (InsnForm*)realloc(model->producer, num_keys * sizeof(InsnForm));
+    CHECK_MALLOC_PTR(model->ready);
+    CHECK_MALLOC_PTR(model->producer);
+    for (int k = model->num_keys; k < num_keys; k++) {
+        model->ready[k] = 0;
+        model->producer[k] = NOP;
+    }
+    model->num_keys = num_keys;
+}
+
+long PipelineModel_issue (PipelineModel* model, ILOCInsn* insn)
+{
+    if (insn->form == LABEL) {
+        return model->cycle;
+    }
+    InsnRegisters regs;
+    ILOCInsn_get_registers(insn, &regs);
+
+    /* next free issue slot (in order) */
+    long slot = model->cycle;
+    if (model->issued >= model->config.issue_width) {
+        slot++;
+    }
+    if (model->next_issue > slot) {
+        slot = model->next_issue;
+    }
+
+    /* wait for operands */
+    long issue = slot;
+    InsnForm waited_for = NOP;
+    for (int i = 0; i < regs.num_reads; i++) {
+        PipelineModel_reserve(model, regs.reads[i]);
+        if (model->ready[regs.reads[i]] > issue) {
+            issue = model->ready[regs.reads[i]];
+            waited_for = model->producer[regs.reads[i]];
+        }
+    }
+    if (issue > slot) {
+        model->operand_stalls += issue - slot;
+        model->stalls_by_form[waited_for] += issue - slot;
+    }
+
+    if (issue > model->cycle) {
+        model->cycle = issue;
+        model->issued = 0;
+    }
+    model->issued++;
+    model->instructions++;
+    if (issue + 1 > model->cycles) {
+        model->cycles = issue + 1;
+    }
+
+    /* results */
+    for (int i = 0; i < regs.num_writes; i++) {
+        PipelineModel_reserve(model, regs.writes[i]);
+        long ready = issue + PipelineConfig_latency(&model->config, insn->form, regs.writes[i]);
+        model->ready[regs.writes[i]] = ready;
+        model->producer[regs.writes[i]] = insn->form;
+        if (ready > model->cycles) {
+            model->cycles = ready;
+        }
+    }
+
+    /* control transfers end the issue group */
+    if (insn->form == JUMP || insn->form == CBR || insn->form == CALL || insn->form == RETURN) {
+        model->next_issue = issue + 1 + model->config.branch_penalty;
+        model->branch_stalls += model->config.branch_penalty;
+    }
+    return issue;
+}
+
+void PipelineModel_print (PipelineModel* model, FILE* output)
+{
+    fprintf(output, "Pipeline (issue width %d, branch penalty %d):\n\n",
+            model->config.issue_width, model->config.branch_penalty);
+    fprintf(output, "%-16s %11ld\n", "instructions", model->instructions);
+    fprintf(output, "%-16s %11ld\n", "cycles", model->cycles);
+    fprintf(output, "%-16s %11.2f\n", "IPC",
+            (double)model->instructions / (model->cycles > 0 ? model->cycles : 1));
+    fprintf(output, "%-16s %11ld\n", "operand stalls", model->operand_stalls);
+    fprintf(output, "%-16s %11ld\n", "branch stalls", model->branch_stalls);
+
+    fprintf(output, "\nOperand stalls by producer:\n\n%11s  %-8s %s\n", "cycles", "form", "latency");
+    for (int form = 0; form < NUM_INSN_FORMS; form++) {
+        if (model->stalls_by_form[form] > 0) {
+            fprintf(output, "%11ld  %-8s %7d\n", model->stalls_by_form[form],
+                    InsnForm_name(form), model->config.latency[form]);
+        }
+    }
+}
+
+void PipelineModel_free (PipelineModel* model)
+{
+    free(model->ready);
+    free(model->producer);
+    free(model);
+}
@@ -0,0 +1,508 @@
+#include "profile.h"
+#include "iloc-machine.h"
+
+ILOCProfile* ILOCProfile_new (void)
+{
+    ILOCProfile* profile = (ILOCProfile*)calloc(1, sizeof(ILOCProfile));
+    CHECK_MALLOC_PTR(profile);
+    return profile;
+}
+
+/**
+ * @brief Deallocate the tables of a profile (leaving it empty)
+ */
+void ILOCProfile_clear (ILOCProfile* profile)
+{
+    free(profile->insns);
+    free(profile->insn_counts);
+    free(profile->blocks);
+    free(profile->functions);
+    free(profile->edge_calls);
+    free(profile->edge_inclusive);
+    memset(profile, 0, sizeof(ILOCProfile));
+}
+
+void ILOCProfile_free (ILOCProfile* profile)
+{
+    ILOCProfile_clear(profile);
+    free(profile);
+}
+
+/**
+ * @brief Size a profile for a linked program and find its functions and blocks
+ * 
+ * @param profile Profile to (re)initialize
+ * @param machine Machine with a linked program
+ * @returns Newly-allocated array with the function index of each instruction
+ * (plus one extra entry for the end of the program)
+ */
+int* ILOCProfile_init (ILOCProfile* profile, ILOCMachine* machine)
+{
+    ILOCProfile_clear(profile);
+    int n = machine->num_instructions;
+    profile->num_insns = n;
+    profile->insns = (ILOCInsn**)malloc((n + 1) * sizeof(ILOCInsn*));
+    CHECK_MALLOC_PTR(profile->insns);
+    memcpy(profile->insns, machine->instructions, (n + 1) * sizeof(ILOCInsn*));
+    profile->insn_counts = (long*)calloc(n + 1, sizeof(long));
+    CHECK_MALLOC_PTR(profile->insn_counts);
+
+    /* code before the first label gets its own block */
+    int num_functions = 0;
+    int* function_of = number_functions(machine, &num_functions);
+    int num_blocks = (n > 0 && machine->instructions[0]->form != LABEL ? 1 : 0);
+    for (int i = 0; i < n; i++) {
+        if (machine->instructions[i]->form == LABEL) {
+            num_blocks++;
+        }
+    }
+    profile->functions = (ProfileFunction*)calloc(num_functions + 1, sizeof(ProfileFunction));
+    profile->blocks = (ProfileBlock*)calloc(num_blocks + 1, sizeof(ProfileBlock));
+    profile->edge_calls = (long*)calloc(num_functions * num_functions + 1, sizeof(long));
+    profile->edge_inclusive = (long*)calloc(num_functions * num_functions + 1, sizeof(long));
+    CHECK_MALLOC_PTR(profile->functions);
+    CHECK_MALLOC_PTR(profile->blocks);
+    CHECK_MALLOC_PTR(profile->edge_calls);
+    CHECK_MALLOC_PTR(profile->edge_inclusive);
+
+    /* split the program at labels */
+    int f = -1, b = -1;
+    for (int i = 0; i < n; i++) {
+        ILOCInsn* insn = machine->instructions[i];
+        if (function_of[i] != f) {
+            ProfileFunction* function = &profile->functions[++f];
+            if (is_call_label(insn)) {
+                snprintf(function->name, MAX_TOKEN_LEN, "%s", insn->op[0].str);
+            }
+            function->first_insn = i;
+        }
+        if (b < 0 || insn->form == LABEL) {
+            profile->blocks[++b].first_insn = i;
+            profile->blocks[b].function = f;
+        }
+        profile->functions[f].end_insn = i + 1;
+        profile->blocks[b].end_insn = i + 1;
+    }
+    profile->num_functions = num_functions;
+    profile->num_blocks = num_blocks;
+    return function_of;
+}
+
+/**
+ * @brief Activation of a function on the dynamic call stack of a profiled run
+ */
+typedef struct ProfileFrame
+{
+    int function;   /**< @brief Index of the called function */
+    long entry;     /**< @brief Total instruction count when the function was entered */
+
+} ProfileFrame;
+
+/**
+ * @brief Dynamic call stack of a profiled run
+ */
+struct ProfileStack
+{
+    ProfileFrame* frames;   /**< @brief Active calls (innermost last) */
+    int depth;              /**< @brief Number of active calls */
+    int capacity;           /**< @brief Allocated size of @ref frames */
+    int* active;            /**< @brief Number of active calls of each function */
+    int* function_of;       /**< @brief Function index of each instruction (see @ref ILOCProfile_init) */
+};
+
+/**
+ * @brief Deallocate a dynamic call stack
+ */
+void ProfileStack_free (ProfileStack* stack)
+{
+    free(stack->frames);
+    free(stack->active);
+    free(stack->function_of);
+    free(stack);
+}
+
+/**
+ * @brief Record a call on the dynamic call stack
+ */
+void ProfileStack_call (ProfileStack* stack, ILOCProfile* profile, int callee)
+{
+    if (stack->depth == stack->capacity) {
+        stack->capacity = (stack->capacity > 0 ? stack->capacity * 2 : 64);
+        stack->frames = (ProfileFrame*)realloc(stack->frames, stack->capacity * sizeof(ProfileFrame));
+        CHECK_MALLOC_PTR(stack->frames);
+    }
+    if (stack->depth > 0) {
+        int caller = stack->frames[stack->depth-1].function;
+        profile->edge_calls[caller * profile->num_functions + callee]++;
+    }
+    profile->functions[callee].calls++;
+    stack->frames[stack->depth].function = callee;
+    stack->frames[stack->depth].entry = profile->total;
+    stack->depth++;
+    stack->active[callee]++;
+}
+
+/**
+ * @brief Record a return on the dynamic call stack and attribute the
+ * instructions executed since the call (unless an outer activation of the
+ * same function is still active, so that recursion is not counted twice)
+ */
+void ProfileStack_return (ProfileStack* stack, ILOCProfile* profile)
+{
+    if (stack->depth == 0) {
+        return;
+    }
+    ProfileFrame* frame = &stack->frames[--stack->depth];
+    long elapsed = profile->total - frame->entry;
+    if (--stack->active[frame->function] == 0) {
+        profile->functions[frame->function].inclusive += elapsed;
+        if (stack->depth > 0) {
+            int caller = stack->frames[stack->depth-1].function;
+            profile->edge_inclusive[caller * profile->num_functions + frame->function] += elapsed;
+        }
+    }
+}
+
+/**
+ * @brief Compute the per-function and per-block counts from the instruction counts
+ */
+void ILOCProfile_summarize (ILOCProfile* profile)
+{
+    for (int b = 0; b < profile->num_blocks; b++) {
+        ProfileBlock* block = &profile->blocks[b];
+        block->count = 0;
+        for (int i = block->first_insn; i < block->end_insn; i++) {
+            block->count += profile->insn_counts[i];
+        }
+
+        /* jumps and calls skip the label itself, so count the instruction
+         * after it */
+        int entry = block->first_insn;
+        if (profile->insns[entry]->form == LABEL && entry + 1 < block->end_insn) {
+            entry++;
+        }
+        block->entries = profile->insn_counts[entry];
+    }
+    for (int f = 0; f < profile->num_functions; f++) {
+        ProfileFunction* function = &profile->functions[f];
+        function->self = 0;
+        for (int i = function->first_insn; i < function->end_insn; i++) {
+            function->self += profile->insn_counts[i];
+        }
+    }
+}
+
+ProfileStack* ProfileStack_new (ILOCProfile* profile, ILOCMachine* machine, int start)
+{
+    ProfileStack* stack = (ProfileStack*)calloc(1, sizeof(ProfileStack));
+    CHECK_MALLOC_PTR(stack);
+    stack->function_of = ILOCProfile_init(profile, machine);
+    stack->active = (int*)calloc(profile->num_functions + 1, sizeof(int));
+    CHECK_MALLOC_PTR(stack->active);
+    ProfileStack_call(stack, profile, stack->function_of[start]);
+    return stack;
+}
+
+void ProfileStack_step (ProfileStack* stack, ILOCProfile* profile, int index, InsnForm form, int next)
+{
+    profile->insn_counts[index]++;
+    profile->total++;
+    if (form == CALL) {
+        ProfileStack_call(stack, profile, stack->function_of[next]);
+    } else if (form == RETURN) {
+        ProfileStack_return(stack, profile);
+    }
+}
+
+void ProfileStack_finish (ProfileStack* stack, ILOCProfile* profile)
+{
+    while (stack->depth > 0) {
+        ProfileStack_return(stack, profile);
+    }
+    ILOCProfile_summarize(profile);
+    ProfileStack_free(stack);
+}
+
+/**
+ * @brief Sort key for profile reports
+ */
+typedef struct ProfileRank
+{
+    long count;     /**< @brief Count to sort by (descending) */
+    int index;      /**< @brief Index of the ranked item (ascending for ties) */
+
+} ProfileRank;
+
+int ProfileRank_compare (const void* a, const void* b)
+{
+    const ProfileRank* left = (const ProfileRank*)a;
+    const ProfileRank* right = (const ProfileRank*)b;
+    if (left->count != right->count) {
+        return (left->count > right->count ? -1 : 1);
+    }
+    return left->index - right->index;
+}
+
+/**
+ * @brief Rank items by count (highest first, program order for ties)
+ * 
+ * @returns Newly-allocated array of item indices
+ */
+int* rank_by_count (long* counts, size_t stride, int num_items)
+{
+    ProfileRank* ranks = (ProfileRank*)malloc((num_items + 1) * sizeof(ProfileRank));
+    int* order = (int*)malloc((num_items + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(ranks);
+    CHECK_MALLOC_PTR(order);
+    for (int i = 0; i < num_items; i++) {
+        ranks[i].count = *(long*)((char*)counts + i * stride);
+        ranks[i].index = i;
+    }
+    qsort(ranks, num_items, sizeof(ProfileRank), ProfileRank_compare);
+    for (int i = 0; i < num_items; i++) {
+        order[i] = ranks[i].index;
+    }
+    free(ranks);
+    return order;
+}
+
+/**
+ * @brief Name of a profiled function (for reports)
+ */
+const char* ProfileFunction_name (ILOCProfile* profile, int f)
+{
+    return (profile->functions[f].name[0] != '\0' ? profile->functions[f].name : "(top)");
+}
+
+/**
+ * @brief Format the label that starts a profiled block (for reports)
+ */
+void ProfileBlock_label (ILOCProfile* profile, ProfileBlock* block, char* label, size_t size)
+{
+    ILOCInsn* first = profile->insns[block->first_insn];
+    if (first->form == LABEL && first->op[0].type == JUMP_LABEL) {
+        snprintf(label, size, "l%d", first->op[0].id);
+    } else if (first->form == LABEL) {
+        snprintf(label, size, "%s", first->op[0].str);
+    } else {
+        snprintf(label, size, "%s", "");
+    }
+}
+
+/**
+ * @brief Number of instructions listed in the text report
+ */
+#define PROFILE_TOP_INSNS 10
+
+void ILOCProfile_print (ILOCProfile* profile, FILE* output)
+{
+    double total = (profile->total > 0 ? (double)profile->total : 1.0);
+
+    /* flat profile (by exclusive count) */
+    int* order = rank_by_count(&profile->functions[0].self, sizeof(ProfileFunction), profile->num_functions);
+    fprintf(output, "Flat profile (%ld instructions executed):\n\n", profile->total);
+    fprintf(output, "%7s %11s %11s %11s %8s  %s\n", "%self", "self", "%incl", "inclusive", "calls", "function");
+    for (int k = 0; k < profile->num_functions; k++) {
+        ProfileFunction* function = &profile->functions[order[k]];
+        if (function->self == 0 && function->calls == 0) {
+            continue;
+        }
+        fprintf(output, "%7.2f %11ld %11.2f %11ld %8ld  %s\n",
+                100.0 * function->self / total, function->self,
+                100.0 * function->inclusive / total, function->inclusive,
+                function->calls, ProfileFunction_name(profile, order[k]));
+    }
+    free(order);
+
+    /* call graph (by inclusive count), with callers listed above and
+     * callees below each function */
+    int nf = profile->num_functions;
+    order = rank_by_count(&profile->functions[0].inclusive, sizeof(ProfileFunction), nf);
+    int* rank = (int*)malloc((nf + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(rank);
+    for (int k = 0; k < nf; k++) {
+        rank[order[k]] = k + 1;
+    }
+    fprintf(output, "\nCall graph:\n\n");
+    fprintf(output, "%-6s %7s %11s %11s %13s  %s\n", "index", "%incl", "self", "inclusive", "calls", "function");
+    for (int k = 0; k < nf; k++) {
+        int f = order[k];
+        ProfileFunction* function = &profile->functions[f];
+        if (function->calls == 0) {
+            continue;
+        }
+        for (int caller = 0; caller < nf; caller++) {
+            long calls = profile->edge_calls[caller * nf + f];
+            if (calls > 0) {
+                fprintf(output, "%-6s %7s %11s %11ld %6ld/%-6ld      %s [%d]\n", "", "", "",
+                        profile->edge_inclusive[caller * nf + f], calls, function->calls,
+                        ProfileFunction_name(profile, caller), rank[caller]);
+            }
+        }
+        char index[16];
+        snprintf(index, sizeof(index), "[%d]", k + 1);
+        fprintf(output, "%-6s %7.2f %11ld %11ld %13ld  %s [%d]\n", index,
+                100.0 * function->inclusive / total, function->self,
+                function->inclusive, function->calls,
+                ProfileFunction_name(profile, f), k + 1);
+        for (int callee = 0; callee < nf; callee++) {
+            long calls = profile->edge_calls[f * nf + callee];
+            if (calls > 0) {
+                fprintf(output, "%-6s %7s %11s %11ld %6ld/%-6ld      %s [%d]\n", "", "", "",
+                        profile->edge_inclusive[f * nf + callee], calls,
+                        profile->functions[callee].calls,
+                        ProfileFunction_name(profile, callee), rank[callee]);
+            }
+        }
+        fprintf(output, "\n");
+    }
+    free(rank);
+    free(order);
+
+    /* basic blocks (by instructions executed) */
+    order = rank_by_count(&profile->blocks[0].count, sizeof(ProfileBlock), profile->num_blocks);
+    fprintf(output, "Basic blocks:\n\n");
+    fprintf(output, "%11s %11s  %-12s %s\n", "count", "entries", "block", "function");
+    for (int k = 0; k < profile->num_blocks; k++) {
+        ProfileBlock* block = &profile->blocks[order[k]];
+        if (block->count == 0) {
+            break;
+        }
+        char label[MAX_TOKEN_LEN];
+        ProfileBlock_label(profile, block, label, MAX_TOKEN_LEN);
+        fprintf(output, "%11ld %11ld  %-12s %s\n", block->count, block->entries,
+                label[0] != '\0' ? label : "(top)", ProfileFunction_name(profile, block->function));
+    }
+    free(order);
+
+    /* hottest instructions */
+    order = rank_by_count(profile->insn_counts, sizeof(long), profile->num_insns);
+    fprintf(output, "\nInstructions (%d most executed):\n\n", PROFILE_TOP_INSNS);
+    fprintf(output, "%11s %7s  %s\n", "count", "index", "instruction");
+    for (int k = 0; k < profile->num_insns && k < PROFILE_TOP_INSNS; k++) {
+        if (profile->insn_counts[order[k]] == 0) {
+            break;
+        }
+        fprintf(output, "%11ld %7d  ", profile->insn_counts[order[k]], order[k]);
+        ILOCInsn_print(profile->insns[order[k]], output);
+        fprintf(output, "\n");
+    }
+    free(order);
+}
+
+void ILOCProfile_print_json (ILOCProfile* profile, FILE* output)
+{
+    int nf = profile->num_functions;
+    fprintf(output, "{\"total\": %ld, \"functions\": [", profile->total);
+    for (int f = 0; f < nf; f++) {
+        ProfileFunction* function = &profile->functions[f];
+        fprintf(output, "%s\n  {\"name\": \"%s\", \"calls\": %ld, \"self\": %ld, \"inclusive\": %ld}",
+                f > 0 ? "," : "", function->name, function->calls, function->self, function->inclusive);
+    }
+    fprintf(output, "\n], \"call_graph\": [");
+    bool first = true;
+    for (int caller = 0; caller < nf; caller++) {
+        for (int callee = 0; callee < nf; callee++) {
+            long calls = profile->edge_calls[caller * nf + callee];
+            if (calls > 0) {
+                fprintf(output, "%s\n  {\"caller\": \"%s\", \"callee\": \"%s\", \"calls\": %ld, \"inclusive\": %ld}",
+                        first ? "" : ",", profile->functions[caller].name, profile->functions[callee].name,
+                        calls, profile->edge_inclusive[caller * nf + callee]);
+                first = false;
+            }
+        }
+    }
+    fprintf(output, "\n], \"blocks\": [");
+    for (int b = 0; b < profile->num_blocks; b++) {
+        ProfileBlock* block = &profile->blocks[b];
+        char label[MAX_TOKEN_LEN];
+        ProfileBlock_label(profile, block, label, MAX_TOKEN_LEN);
+        fprintf(output, "%s\n  {\"label\": \"%s\", \"function\": \"%s\", \"entries\": %ld, \"count\": %ld}",
+                b > 0 ? "," : "", label, profile->functions[block->function].name,
+                block->entries, block->count);
+    }
+
+    /* instructions print with their string constants already escaped */
+    fprintf(output, "\n], \"instructions\": [");
+    first = true;
+    for (int i = 0; i < profile->num_insns; i++) {
+        if (profile->insn_counts[i] > 0) {
+            fprintf(output, "%s\n  {\"index\": %d, \"count\": %ld, \"insn\": \"",
+                    first ? "" : ",", i, profile->insn_counts[i]);
+            ILOCInsn_print(profile->insns[i], output);
+            fprintf(output, "\"}");
+            first = false;
+        }
+    }
+    fprintf(output, "\n]}\n");
+}
+
+/**
+ * @brief Check whether an instruction accesses memory
+ */
+bool is_memory_op (ILOCInsn* insn)
+{
+    switch (insn->form) {
+        case LOAD: case LOAD_AI: case LOAD_AO:
+        case STORE: case STORE_AI: case STORE_AO:
+        case PUSH: case POP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void ILOCProfile_print_source (ILOCProfile* profile, const char* source, FILE* output)
+{
+    /* total the instruction counts by source line */
+    int num_lines = 0;
+    for (const char* c = source; *c != '\0'; c++) {
+        if (*c == '\n' || c[1] == '\0') {
+            num_lines++;
+        }
+    }
+    for (int i = 0; i < profile->num_insns; i++) {
+        if (profile->insns[i]->source_line > num_lines) {
+            num_lines = profile->insns[i]->source_line;
+        }
+    }
+    long* counts = (long*)calloc(num_lines + 1, sizeof(long));
+    long* mem_ops = (long*)calloc(num_lines + 1, sizeof(long));
+    bool* has_code = (bool*)calloc(num_lines + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(counts);
+    CHECK_MALLOC_PTR(mem_ops);
+    CHECK_MALLOC_PTR(has_code);
+    for (int i = 0; i < profile->num_insns; i++) {
+        int line = profile->insns[i]->source_line;
+        line = (line > 0 ? line : 0);
+        counts[line] += profile->insn_counts[i];
+        if (is_memory_op(profile->insns[i])) {
+            mem_ops[line] += profile->insn_counts[i];
+        }
+        has_code[line] = true;
+    }
+
+    /* print each line with its counts ("-" for lines without code) */
+    fprintf(output, "%11s %11s  %5s  %s\n", "insns", "mem ops", "line", "source");
+    const char* text = source;
+    for (int line = 1; line <= num_lines; line++) {
+        int length = 0;
+        while (text[length] != '\0' && text[length] != '\n') {
+            length++;
+        }
+        if (has_code[line]) {
+            fprintf(output, "%11ld %11ld", counts[line], mem_ops[line]);
+        } else {
+            fprintf(output, "%11s %11s", "-", "-");
+        }
+        fprintf(output, "  %5d  %.*s\n", line, length, text);
+        text += (text[length] == '\n' ? length + 1 : length);
+    }
+    if (counts[0] > 0) {
+        fprintf(output, "%11ld %11ld  %5s  (no source line)\n", counts[0], mem_ops[0], "");
+    }
+
+    free(counts);
+    free(mem_ops);
+    free(has_code);
+}
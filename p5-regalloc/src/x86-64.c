@@ -0,0 +1,462 @@
+#include "x86-64.h"
+
+static FILE* x86_out = NULL;
+
+#define SCRATCH "%rax"
+
+/* same as the simulator's initial register value */
+#define UNINIT_VALUE (-9999999)
+
+/*
+ * For reference:
+ *
+ * rax - scratch (and idiv)
+ * rbx - return register (RET)
+ * rsp - native stack (return addresses only)
+ * r13 - base pointer (BP, an offset into the address space)
+ * r14 - stack pointer (SP, an offset into the address space)
+ * rcx, rsi, rdi, r8, r9, r10, r11, r12, r15, rbp, rdx - R0 to R10
+ *
+ * Memory operands add the address space's (absolute) location to an
+ * offset, so addresses need no extra base register. Calls push the same
+ * return slot as the simulator onto the ILOC stack and also use the native
+ * call and ret instructions.
+ */
+static const char* x86_physical_regs[X86_64_NUM_REGS] = {
+    "%rcx", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11", "%r12", "%r15", "%rbp", "%rdx"
+};
+
+const char* x86_reg_name (Operand op)
+{
+    switch (op.type) {
+        case BASE_REG:      return "%r13";  // BP
+        case STACK_REG:     return "%r14";  // SP
+        case RETURN_REG:    return "%rbx";  // RET
+        case PHYSICAL_REG:
+            if (op.id < 0 || op.id >= X86_64_NUM_REGS) {
+                fprintf(stderr, "Invalid register: ");
+                Operand_print(op, stderr);
+                fprintf(stderr, " (must be R0-R%d for translation to x86-64)\n", X86_64_NUM_REGS - 1);
+                exit(EXIT_FAILURE);
+            }
+            return x86_physical_regs[op.id];
+        default:
+            fprintf(stderr, "Invalid register: ");
+            Operand_print(op, stderr);
+            fprintf(stderr, " (only allocated code can be translated to x86-64)\n");
+            exit(EXIT_FAILURE);
+    }
+}
+
+void x86_emit (const char* text)
+{
+    fprintf(x86_out, "    %s\n", text);
+}
+
+void x86_emitf (const char* format, ...)
+{
+    char buffer[MAX_LINE_LEN];
+
+    /* delegate to vsnprintf */
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, MAX_LINE_LEN, format, args);
+    va_end(args);
+
+    x86_emit(buffer);
+}
+
+bool x86_fits_int32 (long value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/**
+ * @brief Compute base + offset (an immediate) into the scratch register
+ */
+void x86_address_ai (const char* base, long offset)
+{
+    if (x86_fits_int32(offset)) {
+        x86_emitf("leaq %ld(%s), %s", offset, base, SCRATCH);
+    } else {
+        x86_emitf("movabsq $%ld, %s", offset, SCRATCH);
+        x86_emitf("addq %s, %s", base, SCRATCH);
+    }
+}
+
+/**
+ * @brief Check that the address in the scratch register is inside the
+ * address space
+ */
+void x86_check_address (void)
+{
+    x86_emitf("cmpq $%d, %s", MEM_SIZE - WORD_SIZE, SCRATCH);
+    x86_emit("ja decaf_invalid_address");
+}
+
+void x86_load (const char* dst)
+{
+    x86_check_address();
+    x86_emitf("movq decaf_mem(%s), %s", SCRATCH, dst);
+}
+
+void x86_store (const char* src)
+{
+    x86_check_address();
+    x86_emitf("movq %s, decaf_mem(%s)", src, SCRATCH);
+}
+
+/**
+ * @brief Push a register or immediate operand (in AT&T syntax) onto the
+ * ILOC stack
+ */
+void x86_push (const char* src)
+{
+    x86_emitf("leaq -%d(%%r14), %s", WORD_SIZE, SCRATCH);
+    x86_emitf("cmpq $%d, %s", STATIC_VAR_OFFSET, SCRATCH);
+    x86_emit("jle decaf_stack_overflow");
+    x86_store(src);
+    x86_emitf("movq %s, %%r14", SCRATCH);
+}
+
+/**
+ * @brief Pop the top of the ILOC stack into the scratch register
+ */
+void x86_pop (void)
+{
+    x86_emitf("cmpq $%d, %%r14", MEM_SIZE - WORD_SIZE);
+    x86_emit("jg decaf_stack_underflow");
+    x86_emitf("movq %%r14, %s", SCRATCH);
+    x86_load(SCRATCH);
+    x86_emitf("addq $%d, %%r14", WORD_SIZE);
+}
+
+void x86_bin_op (const char* opcode, bool commutative, const char* src0, const char* src1, const char* dst)
+{
+    if (strcmp(src0, dst) == 0) {
+        /* first operand is also the output; overwrite it */
+        x86_emitf("%s %s, %s", opcode, src1, dst);
+    } else if (strcmp(src1, dst) == 0 && commutative) {
+        /* second operand is also the output; overwrite it */
+        x86_emitf("%s %s, %s", opcode, src0, dst);
+    } else if (strcmp(src1, dst) != 0) {
+        /* no operands duplicated; use an extra move instruction */
+        x86_emitf("movq %s, %s", src0, dst);
+        x86_emitf("%s %s, %s", opcode, src1, dst);
+    } else {
+        /* non-commutative operation into its second operand */
+        x86_emitf("movq %s, %s", src0, SCRATCH);
+        x86_emitf("%s %s, %s", opcode, src1, SCRATCH);
+        x86_emitf("movq %s, %s", SCRATCH, dst);
+    }
+}
+
+void x86_cmp (const char* condition, const char* src0, const char* src1, const char* dst)
+{
+    x86_emitf("cmpq %s, %s", src1, src0);
+    x86_emitf("set%s %%al", condition);
+    x86_emitf("movzbq %%al, %s", dst);
+}
+
+/**
+ * @brief Emit the runtime (entry point, output, faults, and exit)
+ *
+ * Helpers take their argument in the scratch register, preserve every ILOC
+ * register, and align the native stack themselves (its alignment depends on
+ * the call depth).
+ */
+void x86_emit_runtime (void)
+{
+    fprintf(x86_out, "\n    .text\n    .globl main\nmain:\n");
+    x86_emit("pushq %rbx");
+    x86_emit("pushq %rbp");
+    x86_emit("pushq %r12");
+    x86_emit("pushq %r13");
+    x86_emit("pushq %r14");
+    x86_emit("pushq %r15");
+    x86_emitf("movq $%d, %%r14", MEM_SIZE);
+    x86_emitf("movq $%d, %%r13", UNINIT_VALUE);
+    x86_emitf("movq $%d, %%rbx", UNINIT_VALUE);
+    for (int i = 0; i < X86_64_NUM_REGS; i++) {
+        x86_emitf("movq $%d, %s", UNINIT_VALUE, x86_physical_regs[i]);
+    }
+    x86_emit("call fn_main");
+    x86_emit("jmp decaf_finish      # main's return normally gets there first");
+
+    /* output (saves the caller-saved registers that hold ILOC registers) */
+    const char* helpers[2][3] = {
+        { "decaf_print_int", "leaq .Lformat_int(%rip), %rdi", "movq %rax, %rsi" },
+        { "decaf_print_str", "movq %rax, %rdi", "movq stdout(%rip), %rsi" }
+    };
+    for (int h = 0; h < 2; h++) {
+        fprintf(x86_out, "\n%s:\n", helpers[h][0]);
+        const char* saved[] = { "%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11", "%rbp" };
+        for (int i = 0; i < 9; i++) {
+            x86_emitf("pushq %s", saved[i]);
+        }
+        x86_emit("movq %rsp, %rbp");
+        x86_emit("andq $-16, %rsp");
+        x86_emit(helpers[h][1]);
+        x86_emit(helpers[h][2]);
+        if (h == 0) {
+            x86_emit("xorl %eax, %eax");
+            x86_emit("call printf");
+        } else {
+            x86_emit("call fputs");
+        }
+        x86_emit("movq %rbp, %rsp");
+        for (int i = 8; i >= 0; i--) {
+            x86_emitf("popq %s", saved[i]);
+        }
+        x86_emit("ret");
+    }
+
+    /* program exit (the simulator's messages, printed by the driver) */
+    fprintf(x86_out, "\ndecaf_finish:\n");
+    x86_emit("andq $-16, %rsp");
+    x86_emit("leaq .Lformat_return(%rip), %rdi");
+    x86_emit("movl %ebx, %esi");
+    x86_emit("xorl %eax, %eax");
+    x86_emit("call printf");
+    x86_emit("xorl %edi, %edi");
+    x86_emit("call exit");
+
+    const char* faults[5][2] = {
+        { "decaf_invalid_address",  ".Lformat_address" },
+        { "decaf_stack_overflow",   ".Lformat_overflow" },
+        { "decaf_stack_underflow",  ".Lformat_underflow" },
+        { "decaf_divide_by_zero",   ".Lformat_divide_by_zero" },
+        { "decaf_divide_overflow",  ".Lformat_divide_overflow" }
+    };
+    for (int f = 0; f < 5; f++) {
+        fprintf(x86_out, "\n%s:\n", faults[f][0]);
+        x86_emit("andq $-16, %rsp");
+        x86_emitf("leaq %s(%%rip), %%rdi", faults[f][1]);
+        x86_emit("movq %rax, %rsi");
+        x86_emit("xorl %eax, %eax");
+        x86_emit("call printf");
+        x86_emitf("movl $%d, %%edi", EXIT_FAILURE);
+        x86_emit("call exit");
+    }
+
+    fprintf(x86_out, "\n    .section .rodata\n");
+    fprintf(x86_out, ".Lformat_int:\n    .string \"%%ld\"\n");
+    fprintf(x86_out, ".Lformat_return:\n    .string \"RETURN VALUE = %%d\\n\"\n");
+    fprintf(x86_out, ".Lformat_address:\n    .string \"ERROR: Address %%ld is invalid (out of range)\\n\"\n");
+    fprintf(x86_out, ".Lformat_overflow:\n    .string \"ERROR: Stack overflow\\n\"\n");
+    fprintf(x86_out, ".Lformat_underflow:\n    .string \"ERROR: Cannot pop from empty stack\\n\"\n");
+    fprintf(x86_out, ".Lformat_divide_by_zero:\n    .string \"ERROR: Division by zero\\n\"\n");
+    fprintf(x86_out, ".Lformat_divide_overflow:\n    .string \"ERROR: Division overflow (%%ld / -1)\\n\"\n");
+
+    /* zero-filled address space (static variables at the bottom, stack at the top) */
+    fprintf(x86_out, "\n    .bss\n    .align 16\ndecaf_mem:\n    .zero %d\n", MEM_SIZE);
+    fprintf(x86_out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+}
+
+#define OP0 (i->op[0])
+#define OP1 (i->op[1])
+#define OP2 (i->op[2])
+#define REG0 x86_reg_name(OP0)
+#define REG1 x86_reg_name(OP1)
+#define REG2 x86_reg_name(OP2)
+
+#define MAX_STRINGS 256
+
+void emit_x86_64 (InsnList* iloc, FILE* output)
+{
+    const char* strings[MAX_STRINGS];
+    int num_strings = 0;
+
+    x86_out = output;
+    fprintf(x86_out, "# generated from ILOC by decaf (build with gcc -static -no-pie)\n\n    .text\n");
+
+    int index = -1;
+    FOR_EACH (ILOCInsn*, i, iloc)
+    {
+        index++;
+        switch (i->form)
+        {
+            /* data movement */
+
+            case LOAD_I:    x86_emitf("movq $%ld, %s", OP0.imm, REG1);              break;
+            case LOAD:      x86_emitf("movq %s, %s", REG0, SCRATCH);
+                            x86_load(REG1);                                         break;
+            case LOAD_AI:   x86_address_ai(REG0, OP1.imm);
+                            x86_load(REG2);                                         break;
+            case LOAD_AO:   x86_emitf("leaq (%s,%s), %s", REG0, REG1, SCRATCH);
+                            x86_load(REG2);                                         break;
+            case STORE:     x86_emitf("movq %s, %s", REG1, SCRATCH);
+                            x86_store(REG0);                                        break;
+            case STORE_AI:  x86_address_ai(REG1, OP2.imm);
+                            x86_store(REG0);                                        break;
+            case STORE_AO:  x86_emitf("leaq (%s,%s), %s", REG1, REG2, SCRATCH);
+                            x86_store(REG0);                                        break;
+            case I2I:       if (strcmp(REG0, REG1) != 0) {
+                                x86_emitf("movq %s, %s", REG0, REG1);
+                            }
+                            break;
+            case PUSH:      x86_push(REG0);                                         break;
+            case POP:       x86_pop();
+                            x86_emitf("movq %s, %s", SCRATCH, REG0);                break;
+
+            /* unary and binary operations */
+
+            case ADD:       x86_bin_op("addq",  true,  REG0, REG1, REG2);           break;
+            case SUB:       x86_bin_op("subq",  false, REG0, REG1, REG2);           break;
+            case MULT:      x86_bin_op("imulq", true,  REG0, REG1, REG2);           break;
+            case AND:       x86_bin_op("andq",  true,  REG0, REG1, REG2);           break;
+            case OR:        x86_bin_op("orq",   true,  REG0, REG1, REG2);           break;
+
+            case ADD_I:     if (x86_fits_int32(OP1.imm)) {
+                                x86_emitf("leaq %ld(%s), %s", OP1.imm, REG0, REG2);
+                            } else {
+                                x86_emitf("movabsq $%ld, %s", OP1.imm, SCRATCH);
+                                x86_emitf("addq %s, %s", REG0, SCRATCH);
+                                x86_emitf("movq %s, %s", SCRATCH, REG2);
+                            }
+                            break;
+
+            case MULT_I:    if (x86_fits_int32(OP1.imm)) {
+                                x86_emitf("imulq $%ld, %s, %s", OP1.imm, REG0, REG2);
+                            } else {
+                                x86_emitf("movabsq $%ld, %s", OP1.imm, SCRATCH);
+                                x86_emitf("imulq %s, %s", REG0, SCRATCH);
+                                x86_emitf("movq %s, %s", SCRATCH, REG2);
+                            }
+                            break;
+
+            /* rdx may hold a register, so the divisor is kept on the native
+             * stack and rdx is restored before the quotient is stored;
+             * quotients that would trap are faults (negating the dividend
+             * overflows exactly when it is the most negative word) */
+            case DIV:       x86_emitf("testq %s, %s", REG1, REG1);
+                            x86_emit("jz decaf_divide_by_zero");
+                            x86_emitf("cmpq $-1, %s", REG1);
+                            x86_emit("jne 1f");
+                            x86_emitf("movq %s, %s", REG0, SCRATCH);
+                            x86_emitf("negq %s", SCRATCH);
+                            x86_emit("jo decaf_divide_overflow");
+                            fprintf(x86_out, "1:\n");
+                            x86_emitf("pushq %s", REG1);
+                            x86_emit("pushq %rdx");
+                            x86_emitf("movq %s, %s", REG0, SCRATCH);
+                            x86_emit("cqto");
+                            x86_emit("idivq 8(%rsp)");
+                            x86_emit("popq %rdx");
+                            x86_emit("leaq 8(%rsp), %rsp");
+                            x86_emitf("movq %s, %s", SCRATCH, REG2);
+                            break;
+
+            case NOT:       x86_emitf("movq %s, %s", REG0, SCRATCH);
+                            x86_emitf("notq %s", SCRATCH);
+                            x86_emitf("andq $1, %s", SCRATCH);
+                            x86_emitf("movq %s, %s", SCRATCH, REG1);
+                            break;
+
+            case NEG:       x86_emitf("movq %s, %s", REG0, SCRATCH);
+                            x86_emitf("negq %s", SCRATCH);
+                            x86_emitf("movq %s, %s", SCRATCH, REG1);
+                            break;
+
+            /* comparisons */
+
+            case CMP_LT:    x86_cmp("l",  REG0, REG1, REG2);                        break;
+            case CMP_LE:    x86_cmp("le", REG0, REG1, REG2);                        break;
+            case CMP_EQ:    x86_cmp("e",  REG0, REG1, REG2);                        break;
+            case CMP_NE:    x86_cmp("ne", REG0, REG1, REG2);                        break;
+            case CMP_GE:    x86_cmp("ge", REG0, REG1, REG2);                        break;
+            case CMP_GT:    x86_cmp("g",  REG0, REG1, REG2);                        break;
+
+            /* control flow (calls push the index of the next instruction,
+             * just like the simulator, so stack layouts are identical) */
+
+            case LABEL:
+                if (OP0.type == CALL_LABEL) {
+                    fprintf(x86_out, "\nfn_%s:\n", OP0.str);
+                } else {
+                    fprintf(x86_out, ".L%d:\n", OP0.id);
+                }
+                break;
+
+            case JUMP:
+                x86_emitf("jmp .L%d", OP0.id);
+                break;
+
+            case CBR:
+                x86_emitf("testq %s, %s", REG0, REG0);
+                x86_emitf("jne .L%d", OP1.id);  /* true */
+                x86_emitf("jmp .L%d", OP2.id);  /* false */
+                break;
+
+            case CALL:
+            {
+                char slot[MAX_ID_LEN];
+                snprintf(slot, MAX_ID_LEN, "$%d", index + 1);
+                x86_push(slot);
+                x86_emitf("call fn_%s", OP0.str);
+                break;
+            }
+
+            case RETURN:
+                /* returning with an empty stack ends the program */
+                x86_emitf("cmpq $%d, %%r14", MEM_SIZE);
+                x86_emit("je decaf_finish");
+                x86_pop();
+                x86_emit("ret");
+                break;
+
+            /* misc instructions */
+
+            case PRINT:
+                if (OP0.type == STR_CONST) {
+                    int sidx = num_strings;
+                    for (int s = 0; s < num_strings; s++) {
+                        if (token_str_eq(strings[s], OP0.str)) {
+                            sidx = s;
+                        }
+                    }
+                    if (sidx == MAX_STRINGS) {
+                        fprintf(stderr, "Too many string constants for translation to x86-64\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    if (sidx == num_strings) {
+                        strings[num_strings] = (const char*)&(OP0.str);
+                        num_strings++;
+                    }
+                    x86_emitf("leaq .Lstr%d(%%rip), %s", sidx, SCRATCH);
+                    x86_emit("call decaf_print_str");
+                } else {
+                    x86_emitf("movq %s, %s", REG0, SCRATCH);
+                    x86_emit("call decaf_print_int");
+                }
+                break;
+
+            case NOP:
+                x86_emit("nop");
+                break;
+
+            case PHI:
+                /* nothing to do */
+                break;
+
+            default:
+                printf("Unsupported instruction: ");
+                ILOCInsn_print(i, output);
+                printf("\n");
+                break;
+        }
+    }
+
+    x86_emit_runtime();
+
+    /* emit string table if needed */
+    if (num_strings > 0) {
+        fprintf(x86_out, "\n    .section .rodata\n");
+        for (int s = 0; s < num_strings; s++) {
+            fprintf(x86_out, ".Lstr%d:\n", s);
+            fprintf(x86_out, "    .string \"");
+            print_escaped_string(strings[s], x86_out);
+            fprintf(x86_out, "\"\n");
+        }
+    }
+}
@@ -63,6 +63,20 @@ function run_test {
     fi
 }
 
+# run decaf with a binary trace, then decode the trace with the given
+# iloc-trace options and compare the result against the expected output
+function run_trace_test {
+
+    # parameters
+    TAG=$1
+    ARGS=$2
+    TRACE_ARGS=$3
+    TRACE=outputs/$TAG.trace
+
+    $TIMEOUT $TIMEOUT_INTERVAL $EXE --trace "$TRACE" $ARGS &>/dev/null
+    EXE=../iloc-trace run_test "$TAG" "$TRACE_ARGS $TRACE"
+}
+
 # initialize output folders
 mkdir -p outputs
 mkdir -p valgrind
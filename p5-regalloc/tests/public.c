@@ -51,6 +51,649 @@ TEST_PROGRAM(B_spilled_regs, 72,
         "  return (((1+2)+(3+4))+((5+6)+(7+8)))+"
         "         (((1+2)+(3+4))+((5+6)+(7+8))); }")
 
+START_TEST (B_remat_constants)
+{
+    /* every pending operand is a literal, so evicting one never needs a
+     * stack slot */
+    InsnList* iloc = generate_program("def int main() { return 1+(2+(3+(4+(5+(6+(7+8)))))); }");
+    AllocStats* stats = allocate_registers_with_stats(iloc, 2);
+    ck_assert_int_gt (stats->functions[0].remats, 0);
+    ck_assert_int_eq (stats->functions[0].spills, 0);
+    ck_assert_int_eq (stats->functions[0].frame_bytes, 0);
+    FOR_EACH (ILOCInsn*, insn, iloc) {
+        ck_assert_int_ne (insn->form, STORE_AI);
+    }
+    AllocStats_free(stats);
+    ck_assert_int_eq (run_simulator(iloc, false), 36);
+    InsnList_free(iloc);
+}
+END_TEST
+
+TEST_PROGRAM_WITH_REGS(B_live_across_call, 2, 13,
+        "def int inc(int x) { return x + 1; } "
+        "def int main() { "
+        "  int a; a = 5; "
+        "  return (a * 2) + inc(a) + inc(inc(a) - 5) - a; }")
+
+START_TEST (B_dead_value_not_saved_at_call)
+{
+    /* r1 is live across the call and r2 is never read; clear() overwrites
+     * every register */
+    Operand r[4];
+    for (int i = 0; i < 4; i++) {
+        r[i] = virtual_register();
+    }
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_1op(PUSH, base_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, stack_register(), base_register()));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, stack_register(), int_const(0), stack_register()));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(3), r[0]));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[0], int_const(1), r[1]));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[0], int_const(2), r[2]));
+    InsnList_add(program, ILOCInsn_new_1op(CALL, call_label("clear")));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[1], int_const(10), r[3]));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, r[3], return_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, base_register(), stack_register()));
+    InsnList_add(program, ILOCInsn_new_1op(POP, base_register()));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("clear")));
+    for (int i = 0; i < DEFAULT_NUM_REGISTERS; i++) {
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(0), physical_register(i)));
+    }
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    AllocStats* stats = allocate_registers_with_stats(program, DEFAULT_NUM_REGISTERS);
+    ck_assert_str_eq (stats->functions[0].name, "main");
+    ck_assert_int_eq (stats->functions[0].call_site_spills, 1);
+    ck_assert_int_eq (stats->functions[0].spills, 1);
+    ck_assert_int_eq (stats->functions[0].frame_bytes, WORD_SIZE);
+    AllocStats_free(stats);
+    ck_assert_int_eq (run_simulator(program, false), 14);
+    InsnList_free(program);
+}
+END_TEST
+
+START_TEST (B_callee_clobbers)
+{
+    /* add_three() only writes two registers, so the values that twice() and
+     * main() keep across calls stay in the other two */
+    InsnList* iloc = generate_program(
+        "def int add_three(int x) { return x + 3; } "
+        "def int twice(int x) { return add_three(x) + add_three(x) - 6; } "
+        "def int main() { "
+        "  return add_three(10) + twice(10) + add_three(20) + 10; }");
+    AllocStats* stats = allocate_registers_with_stats(iloc, DEFAULT_NUM_REGISTERS);
+    ck_assert_str_eq (stats->functions[1].name, "twice");
+    ck_assert_int_eq (stats->functions[1].call_site_spills, 0);
+    ck_assert_str_eq (stats->functions[2].name, "main");
+    ck_assert_int_eq (stats->functions[2].call_site_spills, 0);
+    AllocStats_free(stats);
+    ck_assert_int_eq (run_simulator(iloc, false), 66);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (B_recursive_scc_clobbers)
+{
+    /* odd() and even() call each other, so each assumes the other clobbers
+     * every register and saves its pending "1"; main() calls into the cycle
+     * from outside, where the summary is complete */
+    InsnList* iloc = generate_program(
+        "def int odd(int n) { if (n == 0) { return 0; } return 1 + even(n - 1); } "
+        "def int even(int n) { if (n == 0) { return 0; } return 1 + odd(n - 1); } "
+        "def int main() { return 10 + even(11); }");
+    AllocStats* stats = allocate_registers_with_stats(iloc, DEFAULT_NUM_REGISTERS);
+    ck_assert_str_eq (stats->functions[0].name, "odd");
+    ck_assert_int_eq (stats->functions[0].call_site_spills, 1);
+    ck_assert_str_eq (stats->functions[1].name, "even");
+    ck_assert_int_eq (stats->functions[1].call_site_spills, 1);
+    ck_assert_str_eq (stats->functions[2].name, "main");
+    ck_assert_int_eq (stats->functions[2].call_site_spills, 0);
+    AllocStats_free(stats);
+    ck_assert_int_eq (run_simulator(iloc, false), 21);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (B_coalesced_ret_copies)
+{
+    /* each return value goes straight into RET, and two of the three call
+     * results are used from RET directly; no copy becomes "i2i Rx => Rx" */
+    InsnList* iloc = generate_program(
+        "def int g(int x) { return x * 2; } "
+        "def int main() { return g(g(3)) + g(1); }");
+    AllocStats* stats = allocate_registers_with_stats(iloc, 2);
+    ck_assert_int_eq (stats->coalesced_copies, 4);
+    ck_assert_int_eq (stats->removed_self_moves, 0);
+    int copies = 0;
+    FOR_EACH (ILOCInsn*, insn, iloc) {
+        if (insn->form == I2I) {
+            ck_assert (insn->op[0].type != insn->op[1].type || insn->op[0].id != insn->op[1].id);
+            copies += (insn->op[0].type == RETURN_REG || insn->op[1].type == RETURN_REG ? 1 : 0);
+        }
+    }
+    ck_assert_int_eq (copies, 1);
+    AllocStats_free(stats);
+    ck_assert_int_eq (run_simulator(iloc, false), 14);
+    InsnList_free(iloc);
+}
+END_TEST
+
+TEST_PROGRAM_WITH_REGS(B_per_function_registers, 3, 30,
+        "def int f(int x) { return (x + 1) * (x + 2); } "
+        "def int g(int x) { return f(x) + f(x + 1); } "
+        "def int main() { return g(1) + f(2); }")
+
+TEST_PROGRAM_WITH_REGS(C_nested_loops_2regs, 2, 18,
+        "def int main() { "
+        "  int i; int j; int sum; "
+        "  i = 1; sum = 0; "
+        "  while (i <= 3) { "
+        "    j = 1; "
+        "    while (j <= 2) { sum = sum + (i * j) + (1 - 1); j = j + 1; } "
+        "    i = i + 1; } "
+        "  return sum; }")
+
+TEST_PROGRAM_WITH_REGS(C_loop_split_break_return, 4, 51,
+        "def int f(int n) { "
+        "  int i; i = 0; "
+        "  while (true) { i = i + 1; if (i == n) { return i * 10; } } "
+        "  return 0; } "
+        "def int main() { "
+        "  int s; int i; s = 0; i = 0; "
+        "  while (i < 10) { i = i + 1; if (i == 7) { break; } s = s + i; } "
+        "  return s + f(3); }")
+
+TEST_PROGRAM_WITH_REGS(B_loop_split_across_call, 8, 30,
+        "def int g(int x) { return x * x; } "
+        "def int main() { "
+        "  int s; int i; s = 0; i = 0; "
+        "  while (i < 5) { s = s + g(i); i = i + 1; } "
+        "  return s; }")
+
+START_TEST (B_reload_two_spilled_operands)
+{
+    /* with two registers, r1 and r2 are both spilled by the time they are
+     * added, and r5 stays live in the only other register */
+    Operand r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = virtual_register();
+    }
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_1op(PUSH, base_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, stack_register(), base_register()));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, stack_register(), int_const(0), stack_register()));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(3), r[0]));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[0], int_const(4), r[1]));         /* 7 */
+    InsnList_add(program, ILOCInsn_new_3op(MULT_I, r[0], int_const(5), r[2]));        /* 15 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[2], int_const(1), r[3]));         /* 16 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, r[3], int_const(1), r[4]));         /* 17 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD, r[3], r[4], r[5]));                   /* 33 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD, r[1], r[2], r[6]));                   /* 22 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD, r[5], r[6], r[7]));                   /* 55 */
+    InsnList_add(program, ILOCInsn_new_2op(I2I, r[7], return_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, base_register(), stack_register()));
+    InsnList_add(program, ILOCInsn_new_1op(POP, base_register()));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    AllocStats* stats = allocate_registers_with_stats(program, 2);
+    ck_assert_int_ge (stats->functions[0].reloads, 2);
+    AllocStats_free(stats);
+    SimulatorConfig config = { .mode = SIM_CHECKED };
+    SimulatorResult result = simulate_program(program, &config);
+    ck_assert_int_eq (result.status, SIM_SUCCESS);
+    ck_assert_int_eq (result.return_value, 55);
+    InsnList_free(program);
+}
+END_TEST
+
+START_TEST (B_loop_weighted_spill_choice)
+{
+    /* with three registers, defining d has to evict a or b; a is textually
+     * farther away but is used on every iteration of the loop, so the
+     * weighted choice spills b (one store and one reload) instead of
+     * reloading a ten times (47 vs. 56 stack accesses) */
+    Operand v[13];
+    for (int i = 0; i < 13; i++) {
+        v[i] = virtual_register();
+    }
+    Operand x = v[0], a = v[1], b = v[2], c = v[3], d = v[4], e = v[5], f = v[6];
+    Operand n1 = v[7], n2 = v[8], s1 = v[9], s2 = v[10], k = v[11], sum = v[12];
+    Operand loop = anonymous_label();
+    Operand done = anonymous_label();
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_1op(PUSH, base_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, stack_register(), base_register()));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, stack_register(), int_const(-16), stack_register()));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(10), k));
+    InsnList_add(program, ILOCInsn_new_3op(STORE_AI, k, base_register(), int_const(-16)));  /* n = 10 */
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(10), x));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(10), b));       /* 20 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(0), a));        /* 10 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(20), c));       /* 30 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, c, int_const(1), d));        /* 31 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD, c, d, e));                     /* 61 */
+    InsnList_add(program, ILOCInsn_new_3op(ADD, e, b, f));                     /* 81 */
+    InsnList_add(program, ILOCInsn_new_3op(STORE_AI, f, base_register(), int_const(-8)));   /* s = 81 */
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, loop));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-16), n1));
+    InsnList_add(program, ILOCInsn_new_3op(ADD_I, n1, int_const(-1), n2));
+    InsnList_add(program, ILOCInsn_new_3op(STORE_AI, n2, base_register(), int_const(-16)));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-8), s1));
+    InsnList_add(program, ILOCInsn_new_3op(ADD, s1, a, s2));                   /* s = s + a */
+    InsnList_add(program, ILOCInsn_new_3op(STORE_AI, s2, base_register(), int_const(-8)));
+    InsnList_add(program, ILOCInsn_new_3op(CBR, n2, loop, done));
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, done));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-8), sum));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, sum, return_register()));
+    InsnList_add(program, ILOCInsn_new_2op(I2I, base_register(), stack_register()));
+    InsnList_add(program, ILOCInsn_new_1op(POP, base_register()));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    allocate_registers(program, 3);
+    CacheConfig l1 = { .size = 1024, .line_size = 64, .associativity = 1 };
+    MemoryHierarchy* memory = MemoryHierarchy_new(&l1, 1);
+    SimulatorConfig config = { .mode = SIM_CHECKED, .memory = memory };
+    SimulatorResult result = simulate_program(program, &config);
+    ck_assert_int_eq (result.status, SIM_SUCCESS);
+    ck_assert_int_eq (result.return_value, 181);
+    ck_assert_int_eq (memory->stack.reads, 23);
+    ck_assert_int_eq (memory->stack.writes, 24);
+    MemoryHierarchy_free(memory);
+    InsnList_free(program);
+}
+END_TEST
+
+START_TEST (B_loop_carried_value_stays_live)
+{
+    /* same loop as above, but t is defined after the last use of a in the
+     * body; a is read again on the next iteration, so it must still (or
+     * again) be in its register when control gets back to the header */
+    int num_regs[] = { 3, 4, 8 };
+    for (int r = 0; r < 3; r++) {
+        Operand v[15];
+        for (int i = 0; i < 15; i++) {
+            v[i] = virtual_register();
+        }
+        Operand x = v[0], a = v[1], b = v[2], c = v[3], d = v[4], e = v[5], f = v[6];
+        Operand n1 = v[7], n2 = v[8], s1 = v[9], s2 = v[10], k = v[11], sum = v[12];
+        Operand t = v[13], s3 = v[14];
+        Operand loop = anonymous_label();
+        Operand done = anonymous_label();
+        InsnList* program = InsnList_new();
+        InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+        InsnList_add(program, ILOCInsn_new_1op(PUSH, base_register()));
+        InsnList_add(program, ILOCInsn_new_2op(I2I, stack_register(), base_register()));
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, stack_register(), int_const(-16), stack_register()));
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(10), k));
+        InsnList_add(program, ILOCInsn_new_3op(STORE_AI, k, base_register(), int_const(-16)));  /* n = 10 */
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(10), x));
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(10), b));       /* 20 */
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(0), a));        /* 10 */
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, x, int_const(20), c));       /* 30 */
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, c, int_const(1), d));        /* 31 */
+        InsnList_add(program, ILOCInsn_new_3op(ADD, c, d, e));                     /* 61 */
+        InsnList_add(program, ILOCInsn_new_3op(ADD, e, b, f));                     /* 81 */
+        InsnList_add(program, ILOCInsn_new_3op(STORE_AI, f, base_register(), int_const(-8)));   /* s = 81 */
+        InsnList_add(program, ILOCInsn_new_1op(LABEL, loop));
+        InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-16), n1));
+        InsnList_add(program, ILOCInsn_new_3op(ADD_I, n1, int_const(-1), n2));
+        InsnList_add(program, ILOCInsn_new_3op(STORE_AI, n2, base_register(), int_const(-16)));
+        InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-8), s1));
+        InsnList_add(program, ILOCInsn_new_3op(ADD, s1, a, s2));                   /* s = s + a */
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(0), t));
+        InsnList_add(program, ILOCInsn_new_3op(ADD, s2, t, s3));
+        InsnList_add(program, ILOCInsn_new_3op(STORE_AI, s3, base_register(), int_const(-8)));
+        InsnList_add(program, ILOCInsn_new_3op(CBR, n2, loop, done));
+        InsnList_add(program, ILOCInsn_new_1op(LABEL, done));
+        InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, base_register(), int_const(-8), sum));
+        InsnList_add(program, ILOCInsn_new_2op(I2I, sum, return_register()));
+        InsnList_add(program, ILOCInsn_new_2op(I2I, base_register(), stack_register()));
+        InsnList_add(program, ILOCInsn_new_1op(POP, base_register()));
+        InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+        allocate_registers(program, num_regs[r]);
+        SimulatorConfig config = { .mode = SIM_CHECKED };
+        SimulatorResult result = simulate_program(program, &config);
+        ck_assert_int_eq (result.status, SIM_SUCCESS);
+        ck_assert_int_eq (result.return_value, 181);
+        InsnList_free(program);
+    }
+}
+END_TEST
+
+START_TEST (A_simulate_reports_faults)
+{
+    /* main() calls itself until the stack overflows */
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_1op(CALL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    SimulatorConfig checked = { .mode = SIM_CHECKED };
+    SimulatorConfig fast = { .mode = SIM_FAST };
+    SimulatorConfig* configs[] = { &checked, &fast };
+    for (int i = 0; i < 2; i++) {
+        SimulatorResult result = simulate_program(program, configs[i]);
+        ck_assert_int_eq (result.status, SIM_FAULT);
+        ck_assert_int_eq (result.fault, FAULT_STACK_OVERFLOW);
+        ck_assert_str_eq (result.message, "Stack overflow");
+    }
+    InsnList_free(program);
+
+    /* undefined quotients must not trap in any mode (including compiled
+     * code), and other divisions by -1 still work */
+    long dividends[] = { 5, INT64_MIN, 6 };
+    long divisors[] = { 0, -1, -1 };
+    const char* messages[] = { "Division by zero", "Division overflow (-9223372036854775808 / -1)", NULL };
+    SimulatorConfig jit = { .mode = SIM_JIT };
+    SimulatorConfig* all_configs[] = { &checked, &fast, &jit };
+    for (int d = 0; d < 3; d++) {
+        program = InsnList_new();
+        InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(dividends[d]), physical_register(0)));
+        InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(divisors[d]), physical_register(1)));
+        InsnList_add(program, ILOCInsn_new_3op(DIV, physical_register(0), physical_register(1), return_register()));
+        InsnList_add(program, ILOCInsn_new_0op(RETURN));
+        for (int i = 0; i < 3; i++) {
+            SimulatorResult result = simulate_program(program, all_configs[i]);
+            if (messages[d] != NULL) {
+                ck_assert_int_eq (result.status, SIM_FAULT);
+                ck_assert_int_eq (result.fault, FAULT_INVALID_DIVISION);
+                ck_assert_str_eq (result.message, messages[d]);
+            } else {
+                ck_assert_int_eq (result.status, SIM_SUCCESS);
+                ck_assert_int_eq (result.return_value, -6);
+            }
+        }
+        InsnList_free(program);
+    }
+}
+END_TEST
+
+START_TEST (A_fast_mode_wide_addresses)
+{
+    /* addresses beyond 32 bits must not wrap around into the address space */
+    long addresses[] = { 4294967552L, -4294967024L };
+    for (int i = 0; i < 2; i++) {
+        for (int store = 0; store < 2; store++) {
+            InsnList* program = InsnList_new();
+            InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+            InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(addresses[i]), physical_register(0)));
+            if (store) {
+                InsnList_add(program, ILOCInsn_new_2op(STORE, physical_register(0), physical_register(0)));
+            } else {
+                InsnList_add(program, ILOCInsn_new_2op(LOAD, physical_register(0), return_register()));
+            }
+            InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+            SimulatorConfig checked = { .mode = SIM_CHECKED, .output = OutputSink_new_capture() };
+            SimulatorConfig fast = { .mode = SIM_FAST, .output = OutputSink_new_capture() };
+            SimulatorResult expected = simulate_program(program, &checked);
+            SimulatorResult actual = simulate_program(program, &fast);
+            ck_assert_int_eq (expected.status, SIM_FAULT);
+            ck_assert_int_eq (expected.fault, FAULT_INVALID_ADDRESS);
+            ck_assert_int_eq (actual.status, SIM_FAULT);
+            ck_assert_int_eq (actual.fault, FAULT_INVALID_ADDRESS);
+            ck_assert_str_eq (actual.message, expected.message);
+            OutputSink_free(checked.output);
+            OutputSink_free(fast.output);
+            InsnList_free(program);
+        }
+    }
+}
+END_TEST
+
+START_TEST (A_batch_pool_isolates_runs)
+{
+    /* one program prints and returns, the other overflows the stack */
+    InsnList* ok = InsnList_new();
+    InsnList_add(ok, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(ok, ILOCInsn_new_1op(PRINT, str_const("hi")));
+    InsnList_add(ok, ILOCInsn_new_2op(LOAD_I, int_const(7), return_register()));
+    InsnList_add(ok, ILOCInsn_new_0op(RETURN));
+    InsnList* overflow = InsnList_new();
+    InsnList_add(overflow, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(overflow, ILOCInsn_new_1op(PRINT, str_const("x")));
+    InsnList_add(overflow, ILOCInsn_new_1op(CALL, call_label("main")));
+    InsnList_add(overflow, ILOCInsn_new_0op(RETURN));
+
+    SimulatorConfig config = { .mode = SIM_FAST };
+    BatchPool* pool = BatchPool_new(3, &config);
+    ck_assert (pool != NULL);
+    BatchJob* jobs[10];
+    for (int i = 0; i < 10; i++) {
+        jobs[i] = BatchJob_new(i % 2 == 0 ? ok : overflow);
+        BatchPool_submit(pool, jobs[i]);
+    }
+    BatchPool_wait(pool);
+    for (int i = 0; i < 10; i++) {
+        if (i % 2 == 0) {
+            ck_assert_int_eq (jobs[i]->result.status, SIM_SUCCESS);
+            ck_assert_int_eq (jobs[i]->result.return_value, 7);
+            ck_assert_int_eq (jobs[i]->result.instructions_executed, 3);
+            ck_assert_str_eq (OutputSink_text(jobs[i]->output), "hi");
+        } else {
+            ck_assert_int_eq (jobs[i]->result.fault, FAULT_STACK_OVERFLOW);
+            ck_assert_int_eq (strspn(OutputSink_text(jobs[i]->output), "x"), jobs[i]->output->length);
+        }
+        BatchJob_free(jobs[i]);
+    }
+    BatchPool_free(pool);
+    InsnList_free(ok);
+    InsnList_free(overflow);
+}
+END_TEST
+
+InsnList* build_test_program (void* arg, FILE* errors)
+{
+    InsnList* program = generate_program((char*)arg);
+    if (program == NULL) {
+        fprintf(errors, "Invalid program\n");
+        return NULL;
+    }
+    allocate_registers(program, DEFAULT_NUM_REGISTERS);
+    return program;
+}
+
+START_TEST (A_batch_pool_survives_division_faults)
+{
+    /* a job that divides by zero must fail alone, even in compiled code */
+    InsnList* ok = InsnList_new();
+    InsnList_add(ok, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(ok, ILOCInsn_new_1op(PRINT, str_const("hi")));
+    InsnList_add(ok, ILOCInsn_new_2op(LOAD_I, int_const(7), return_register()));
+    InsnList_add(ok, ILOCInsn_new_0op(RETURN));
+    InsnList* divide = InsnList_new();
+    InsnList_add(divide, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(divide, ILOCInsn_new_2op(LOAD_I, int_const(5), physical_register(0)));
+    InsnList_add(divide, ILOCInsn_new_2op(LOAD_I, int_const(0), physical_register(1)));
+    InsnList_add(divide, ILOCInsn_new_3op(DIV, physical_register(0), physical_register(1), return_register()));
+    InsnList_add(divide, ILOCInsn_new_0op(RETURN));
+
+    SimulatorMode modes[] = { SIM_CHECKED, SIM_FAST, SIM_JIT };
+    for (int m = 0; m < 3; m++) {
+        SimulatorConfig config = { .mode = modes[m] };
+        BatchPool* pool = BatchPool_new(2, &config);
+        ck_assert (pool != NULL);
+        BatchJob* jobs[6];
+        for (int i = 0; i < 6; i++) {
+            jobs[i] = BatchJob_new(i == 2 ? divide : ok);
+            BatchPool_submit(pool, jobs[i]);
+        }
+        BatchPool_wait(pool);
+        for (int i = 0; i < 6; i++) {
+            if (i == 2) {
+                ck_assert_int_eq (jobs[i]->result.status, SIM_FAULT);
+                ck_assert_int_eq (jobs[i]->result.fault, FAULT_INVALID_DIVISION);
+            } else {
+                ck_assert_int_eq (jobs[i]->result.status, SIM_SUCCESS);
+                ck_assert_int_eq (jobs[i]->result.return_value, 7);
+                ck_assert_str_eq (OutputSink_text(jobs[i]->output), "hi");
+            }
+            BatchJob_free(jobs[i]);
+        }
+        BatchPool_free(pool);
+    }
+    InsnList_free(ok);
+    InsnList_free(divide);
+}
+END_TEST
+
+START_TEST (A_batch_pool_builds_in_workers)
+{
+    char* sources[] = {
+        "def int main() { int i; int s; s = 0; i = 1; while (i <= 10) { s = s + i; i = i + 1; } return s; }",
+        "def int main() { return 6 * 7; }",
+        "def int main() { return }"
+    };
+    SimulatorConfig config = { .mode = SIM_FAST };
+    BatchPool* pool = BatchPool_new(4, &config);
+    ck_assert (pool != NULL);
+    BatchJob* jobs[12];
+    for (int i = 0; i < 12; i++) {
+        jobs[i] = BatchJob_new_build(build_test_program, sources[i % 3]);
+        BatchPool_submit(pool, jobs[i]);
+    }
+    BatchPool_free(pool);
+    for (int i = 0; i < 12; i++) {
+        if (i % 3 == 2) {
+            ck_assert (jobs[i]->program == NULL);
+            ck_assert_str_eq (jobs[i]->build_errors, "Invalid program\n");
+        } else {
+            ck_assert_int_eq (jobs[i]->result.status, SIM_SUCCESS);
+            ck_assert_int_eq (jobs[i]->result.return_value, (i % 3 == 0 ? 55 : 42));
+        }
+        BatchJob_free(jobs[i]);
+    }
+}
+END_TEST
+
+START_TEST (A_cache_counts_evictions)
+{
+    /* four sets of one 32-byte line each, so addresses 128 bytes apart collide */
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(1024), physical_register(0)));
+    InsnList_add(program, ILOCInsn_new_3op(STORE_AI, physical_register(0), physical_register(0), int_const(0)));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, physical_register(0), int_const(0), physical_register(1)));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, physical_register(0), int_const(128), physical_register(1)));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, physical_register(0), int_const(0), physical_register(1)));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    CacheConfig l1 = { .size = 128, .line_size = 32, .associativity = 1 };
+    MemoryHierarchy* memory = MemoryHierarchy_new(&l1, 1);
+    SimulatorConfig config = { .mode = SIM_FAST, .memory = memory };
+    ck_assert_int_eq (simulate_program(program, &config).status, SIM_SUCCESS);
+    ck_assert_int_eq (memory->levels[0].accesses, 4);
+    ck_assert_int_eq (memory->levels[0].hits, 1);
+    ck_assert_int_eq (memory->levels[0].misses, 3);
+    ck_assert_int_eq (memory->levels[0].writebacks, 1);
+    ck_assert_int_eq (memory->statics.reads, 3);
+    ck_assert_int_eq (memory->statics.writes, 1);
+    ck_assert_int_eq (memory->stack.reads + memory->stack.writes, 0);
+    ck_assert_int_eq (memory->functions[0].traffic.misses[0], 3);
+    MemoryHierarchy_free(memory);
+    InsnList_free(program);
+}
+END_TEST
+
+START_TEST (A_schedule_hides_load_latency)
+{
+    /* the two loadI instructions should fill the load-use delay */
+    InsnList* program = InsnList_new();
+    InsnList_add(program, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(1024), physical_register(0)));
+    InsnList_add(program, ILOCInsn_new_3op(LOAD_AI, physical_register(0), int_const(0), physical_register(1)));
+    InsnList_add(program, ILOCInsn_new_3op(ADD, physical_register(1), physical_register(1), return_register()));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(2), physical_register(2)));
+    InsnList_add(program, ILOCInsn_new_2op(LOAD_I, int_const(3), physical_register(3)));
+    InsnList_add(program, ILOCInsn_new_0op(RETURN));
+
+    PipelineConfig timing;
+    PipelineConfig_init(&timing);
+    PipelineModel* before = PipelineModel_new(&timing);
+    SimulatorConfig config = { .mode = SIM_FAST, .pipeline = before };
+    ck_assert_int_eq (simulate_program(program, &config).status, SIM_SUCCESS);
+
+    ck_assert_int_eq (schedule_instructions(program, &timing), 1);
+    ck_assert_int_eq (program->tail->form, RETURN);
+    ILOCInsn* insn = program->head;
+    while (insn->next->form != ADD) {
+        insn = insn->next;
+    }
+    ck_assert_int_eq (insn->form, LOAD_I);
+
+    PipelineModel* after = PipelineModel_new(&timing);
+    config.pipeline = after;
+    ck_assert_int_eq (simulate_program(program, &config).status, SIM_SUCCESS);
+    ck_assert_int_eq (after->instructions, before->instructions);
+    ck_assert_int_lt (after->cycles, before->cycles);
+    PipelineModel_free(before);
+    PipelineModel_free(after);
+    InsnList_free(program);
+}
+END_TEST
+
+START_TEST (A_jit_matches_fast_mode)
+{
+    /* a loop that prints running sums and calls a helper (which uses a
+     * physical register kept in memory by the JIT), then a store outside of
+     * the address space */
+    Operand loop = anonymous_label();
+    Operand done = anonymous_label();
+    InsnList* loops = InsnList_new();
+    InsnList_add(loops, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(loops, ILOCInsn_new_2op(LOAD_I, int_const(0), physical_register(0)));
+    InsnList_add(loops, ILOCInsn_new_2op(LOAD_I, int_const(1), physical_register(1)));
+    InsnList_add(loops, ILOCInsn_new_1op(LABEL, loop));
+    InsnList_add(loops, ILOCInsn_new_3op(ADD, physical_register(0), physical_register(1), physical_register(0)));
+    InsnList_add(loops, ILOCInsn_new_1op(PRINT, physical_register(0)));
+    InsnList_add(loops, ILOCInsn_new_3op(ADD_I, physical_register(1), int_const(1), physical_register(1)));
+    InsnList_add(loops, ILOCInsn_new_2op(LOAD_I, int_const(10), physical_register(2)));
+    InsnList_add(loops, ILOCInsn_new_3op(CMP_LE, physical_register(1), physical_register(2), physical_register(3)));
+    InsnList_add(loops, ILOCInsn_new_3op(CBR, physical_register(3), loop, done));
+    InsnList_add(loops, ILOCInsn_new_1op(LABEL, done));
+    InsnList_add(loops, ILOCInsn_new_1op(PRINT, str_const("!")));
+    InsnList_add(loops, ILOCInsn_new_1op(CALL, call_label("twice")));
+    InsnList_add(loops, ILOCInsn_new_2op(I2I, physical_register(0), return_register()));
+    InsnList_add(loops, ILOCInsn_new_0op(RETURN));
+    InsnList_add(loops, ILOCInsn_new_1op(LABEL, call_label("twice")));
+    InsnList_add(loops, ILOCInsn_new_3op(MULT_I, physical_register(0), int_const(2), physical_register(7)));
+    InsnList_add(loops, ILOCInsn_new_2op(I2I, physical_register(7), physical_register(0)));
+    InsnList_add(loops, ILOCInsn_new_0op(RETURN));
+    InsnList* out_of_range = InsnList_new();
+    InsnList_add(out_of_range, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(out_of_range, ILOCInsn_new_2op(LOAD_I, int_const(MEM_SIZE), physical_register(0)));
+    InsnList_add(out_of_range, ILOCInsn_new_2op(STORE, physical_register(0), physical_register(0)));
+    InsnList_add(out_of_range, ILOCInsn_new_0op(RETURN));
+
+    /* run to completion, time out partway through the loop, and fault */
+    InsnList* programs[] = { loops, loops, out_of_range };
+    long limits[] = { 0, 20, 0 };
+    for (int i = 0; i < 3; i++) {
+        SimulatorConfig fast = { .mode = SIM_FAST, .max_instructions_executed = limits[i],
+                                 .output = OutputSink_new_capture() };
+        SimulatorConfig jit = { .mode = SIM_JIT, .max_instructions_executed = limits[i],
+                                .output = OutputSink_new_capture() };
+        SimulatorResult expected = simulate_program(programs[i], &fast);
+        SimulatorResult actual = simulate_program(programs[i], &jit);
+        ck_assert_int_eq (actual.status, expected.status);
+        ck_assert_str_eq (actual.message, expected.message);
+        ck_assert_int_eq (actual.return_value, expected.return_value);
+        ck_assert_int_eq (actual.instructions_executed, expected.instructions_executed);
+        ck_assert_str_eq (OutputSink_text(jit.output), OutputSink_text(fast.output));
+        OutputSink_free(fast.output);
+        OutputSink_free(jit.output);
+    }
+    InsnList_free(loops);
+    InsnList_free(out_of_range);
+}
+END_TEST
+
 #endif
 
 /**
@@ -73,9 +716,31 @@ void public_tests (Suite *s)
     TEST(C_assign_multiple);
     TEST(C_conditional);
     TEST(C_while);
+    TEST(C_nested_loops_2regs);
+    TEST(C_loop_split_break_return);
 
     TEST(B_func_call);
     TEST(B_spilled_regs);
+    TEST(B_remat_constants);
+    TEST(B_live_across_call);
+    TEST(B_dead_value_not_saved_at_call);
+    TEST(B_callee_clobbers);
+    TEST(B_recursive_scc_clobbers);
+    TEST(B_coalesced_ret_copies);
+    TEST(B_per_function_registers);
+    TEST(B_loop_split_across_call);
+    TEST(B_loop_weighted_spill_choice);
+    TEST(B_loop_carried_value_stays_live);
+    TEST(B_reload_two_spilled_operands);
+
+    TEST(A_simulate_reports_faults);
+    TEST(A_fast_mode_wide_addresses);
+    TEST(A_batch_pool_isolates_runs);
+    TEST(A_batch_pool_survives_division_faults);
+    TEST(A_batch_pool_builds_in_workers);
+    TEST(A_cache_counts_evictions);
+    TEST(A_schedule_hides_load_latency);
+    TEST(A_jit_matches_fast_mode);
 
     suite_add_tcase (s, tc);
 }
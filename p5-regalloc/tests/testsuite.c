@@ -1,6 +1,7 @@
 #include "testsuite.h"
 
-jmp_buf decaf_error;
+/* one per thread, since batch workers may compile programs concurrently */
+_Thread_local jmp_buf decaf_error;
 
 void Error_throw_printf (const char* format, ...)
 {
@@ -12,26 +13,35 @@ long run_program (char* text)
     return run_program_with_allocation(text, DEFAULT_NUM_REGISTERS);
 }
 
-long run_program_with_allocation (char* text, int num_registers)
+InsnList* generate_program (char* text)
 {
     ASTNode* tree = NULL;
     if (setjmp(decaf_error) == 0) {
         /* no error */
         tree = parse(lex(text));
     } else {
-        /* parsing error; return code */
-        return ERROR_RETURN_CODE;
+        /* parsing error */
+        return NULL;
     }
     NodeVisitor_traverse_and_free(SetParentVisitor_new(), tree);
     NodeVisitor_traverse_and_free(CalcDepthVisitor_new(), tree);
     NodeVisitor_traverse_and_free(BuildSymbolTablesVisitor_new(), tree);
     ErrorList* errors = analyze(tree);
     if (!ErrorList_is_empty(errors)) {
-        /* static analysis error; return code */
-        return ERROR_RETURN_CODE;
+        /* static analysis error */
+        return NULL;
     }
     NodeVisitor_traverse_and_free(AllocateSymbolsVisitor_new(), tree);
-    InsnList* iloc = generate_code(tree);
+    return generate_code(tree);
+}
+
+long run_program_with_allocation (char* text, int num_registers)
+{
+    InsnList* iloc = generate_program(text);
+    if (iloc == NULL) {
+        /* parsing or static analysis error; return code */
+        return ERROR_RETURN_CODE;
+    }
     allocate_registers(iloc, num_registers);
     FOR_EACH (ILOCInsn*, insn, iloc) {
         for (int i = 0; i < 3; i++) {
@@ -18,6 +18,9 @@
 #include "p4-codegen.h"
 #include "p5-regalloc.h"
 
+#include "batch.h"
+#include "memory-model.h"
+
 /**
  * @brief Number of physical registers for most tests
  */
@@ -82,6 +85,15 @@ END_TEST
  */
 #define TEST(NAME) tcase_add_test (tc, NAME)
 
+/**
+ * @brief Run lexer, parser, analysis, and code generation (but not register allocation) on given
+ * program
+ *
+ * @param text Code to lex, parse, analyze, and generate
+ * @returns Generated ILOC or @c NULL if there was an error
+ */
+InsnList* generate_program (char* text);
+
 /**
  * @brief Run lexer, parser, analysis, code generation, and register allocation on given program
  * 
@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+# Compare the native translations of every program in tests2/inputs/ to the
+# simulator, using "decaf --check-<backend>" for each backend ("c": C compiled
+# with gcc -O2; "x86": x86-64 assembly built into a static executable).
+#
+# Usage: run_native_tests.sh [c | x86]...   (default: every backend)
+#
+# Run this script from anywhere; it uses the decaf binary in p5-regalloc.
+
+set -u
+
+cd "$(dirname "$0")/.." || exit 1
+
+ME="./decaf"
+IN_DIR="tests2/inputs"
+DIFF_DIR="tests2/diffs"
+
+backends=( "$@" )
+if (( ${#backends[@]} == 0 )); then
+  backends=( c x86 )
+fi
+
+mkdir -p "$DIFF_DIR"
+
+shopt -s nullglob
+tests=( "$IN_DIR"/*.decaf )
+shopt -u nullglob
+
+failures=0
+skipped=0
+for backend in "${backends[@]}"; do
+  case "$backend" in
+    c|x86) ;;
+    *) echo "Unknown backend: $backend (expected c or x86)" >&2; exit 2 ;;
+  esac
+  for src in "${tests[@]}"; do
+    base="$(basename "$src" .decaf)"
+    diff_file="$DIFF_DIR/$base.$backend.diff"
+
+    if "$ME" --check-"$backend" "$src" > "$diff_file" 2>&1; then
+      echo "$base [$backend]: $(tail -n 1 "$diff_file")"
+      rm -f "$diff_file"
+    elif grep -q '^MISMATCH\|^FAILED' "$diff_file"; then
+      echo "$base [$backend]: MISMATCH (see $diff_file)"
+      failures=$((failures + 1))
+    else
+      echo "$base [$backend]: does not compile (see $diff_file)"
+      skipped=$((skipped + 1))
+    fi
+  done
+done
+
+echo "$(( ${#tests[@]} * ${#backends[@]} )) checks (${backends[*]}), $failures mismatched, $skipped did not compile"
+(( failures == 0 ))